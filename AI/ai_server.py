@@ -1,10 +1,18 @@
-import cv2
-import numpy as np
 import paho.mqtt.client as mqtt
-from flask import Flask, request
+from flask import Flask, request, jsonify
 from ultralytics import YOLO
 import threading
+import time
+import os
+import itertools
+from collections import OrderedDict, deque
 import requests  # <--- [เพิ่ม] สำหรับส่งเข้า Discord
+from inference_pool import InferencePool
+from preprocess import parse_roi, preprocess
+from frame_cache import FrameCache, signature
+from tracker import BowlTracker, status_of
+from cascade import Cascade
+from egress import AlertRule, StatusEgress
 
 # ==========================================
 # 1. ตั้งค่า NETPIE
@@ -37,95 +45,485 @@ def start_mqtt():
     except Exception as e:
         print(f"❌ Cannot connect to NETPIE: {e}")
 
-mqtt_thread = threading.Thread(target=start_mqtt)
-mqtt_thread.daemon = True
-mqtt_thread.start()
-
 # ==========================================
 # [เพิ่ม] ฟังก์ชันส่งแจ้งเตือนเข้า Discord
 # ==========================================
+# เรียกจาก thread ของ egress เท่านั้น (ดู egress.py) ใช้ session เดิมให้ connection
+# ไป Discord ถูกใช้ซ้ำ ไม่ต้อง TLS handshake ใหม่ทุกครั้ง
+DISCORD_TIMEOUT_S = 5
+discord_session = requests.Session()
+
 def send_discord_alert(message):
     try:
         data = {
             "content": message,
             "username": "Hamster Alert Bot" # ชื่อที่จะขึ้นใน Discord
         }
-        response = requests.post(DISCORD_WEBHOOK_URL, json=data)
+        response = discord_session.post(DISCORD_WEBHOOK_URL, json=data, timeout=DISCORD_TIMEOUT_S)
         if response.status_code == 204:
             print("🔔 Discord Alert Sent!")
+            return True
+        if response.status_code == 429:
+            print(f"⚠️ Discord rate limited, retry after {response.headers.get('Retry-After')} s")
         else:
             print(f"⚠️ Discord Send Failed: {response.status_code}")
     except Exception as e:
         print(f"❌ Error sending to Discord: {e}")
+    return False
+
+def publish_netpie(camera, status):
+    if mqtt_client and mqtt_client.is_connected():
+        mqtt_client.publish(TOPIC_STATUS, status)
+        print(f"📡 Published to NETPIE [{camera}]: {status}")
+        return True
+    print("⚠️ NETPIE not connected. Cannot publish.")
+    return False
 
 # ==========================================
 # 2. โหลดโมเดล AI
 # ==========================================
-print("⏳ Loading AI Model...")
-model = YOLO('cup_model.pt') 
+# เลือก backend ด้วย AI_MODEL_BACKEND ไฟล์ที่ไม่ใช่ .pt สร้างด้วย export_model.py
+# วัดความแม่นยำ/ความเร็วเทียบกับ PyTorch ด้วย export_model.py compare
+MODEL_BACKENDS = {
+    "pytorch": "cup_model.pt",
+    "onnx": "cup_model.onnx",
+    "onnx-int8": "cup_model_int8.onnx",
+    "openvino": "cup_model_openvino_model",
+    "openvino-int8": "cup_model_int8_openvino_model",
+}
+MODEL_BACKEND = os.environ.get("AI_MODEL_BACKEND", "pytorch")
+MODEL_INPUT = int(os.environ.get("AI_MODEL_INPUT", "640"))  # imgsz ตอน train/export
+
+# บริเวณชามในภาพ x,y,w,h หน่วย 1/1000 ของภาพ (เหมือน bowl_classifier.py --crop)
+# ว่าง = ใช้ทั้งภาพ รูปจะถูก decode แบบย่อให้พอดีกับ MODEL_INPUT (ดู preprocess.py)
+BOWL_ROI = parse_roi(os.environ.get("AI_BOWL_ROI", ""))
+if MODEL_BACKEND not in MODEL_BACKENDS:
+    raise SystemExit(f"❌ Unknown AI_MODEL_BACKEND '{MODEL_BACKEND}', use one of {', '.join(MODEL_BACKENDS)}")
+
+print(f"⏳ Loading AI Model ({MODEL_BACKEND})...")
+model = YOLO(MODEL_BACKENDS[MODEL_BACKEND], task='detect')
 print("✅ Model Loaded!")
 
 # ==========================================
-# 3. สร้าง Web Server
+# 3. คิวรอ Inference (ล่าสุดชนะ + micro-batch)
+# ==========================================
+# แต่ละกล้องมีเฟรมรอได้แค่ 1 เฟรม เฟรมใหม่มาแทนเฟรมเก่าที่ยังไม่ได้ทำ
+# ผลจึงไม่ค้างเก่าเมื่อมีหลายกล้อง worker ที่ว่างจะรวมเฟรมของหลายกล้อง
+# เป็น batch เดียวส่งเข้า model.predict (ดู inference_pool.py)
+QUEUE_MAX_CAMERAS = 16     # จำนวนกล้องที่รอพร้อมกันได้ เกินนี้ตอบ 503
+BATCH_MAX = 8              # เฟรมสูงสุดต่อ batch
+BATCH_WAIT_S = 0.02        # รอเฟรมของกล้องอื่นมาเข้า batch หลังได้เฟรมแรก
+RESULT_WAIT_S = 3.0        # ?wait=1 รอผลได้นานสุดเท่านี้
+SYNC_WAIT_S = 30.0         # ค่าเริ่มต้น (ไม่มี ?async / ?wait) รอผลได้นานสุดเท่านี้ เกินตอบ 504
+LATENCY_WINDOW = 500       # จำนวนเฟรมล่าสุดที่ใช้คิด percentile
+
+class InferenceJob:
+    _ids = itertools.count(1)
+
+    def __init__(self, camera, img, received):
+        self.id = next(InferenceJob._ids)
+        self.camera = camera
+        self.img = img
+        self.received = received
+        self.done = threading.Event()
+        self.result = None
+        self.started = None     # เข้า batch เมื่อไร
+        self.predict_ms = None
+        self.hash = None        # signature() ของเฟรม สำหรับ frame_cache
+        self.escalated = None   # cascade ส่งต่อให้ YOLO เมื่อไร
+
+    def finish(self, result):
+        self.result = result
+        self.img = None
+        self.done.set()
+
+class LatestFrameQueue:
+    def __init__(self, max_cameras):
+        self.max_cameras = max_cameras
+        self.pending = OrderedDict()  # camera -> InferenceJob, เรียงตามกล้องที่รอนานสุด
+        self.cond = threading.Condition()
+        self.replaced = 0
+
+    def put(self, job):
+        with self.cond:
+            old = self.pending.get(job.camera)
+            if old is None and len(self.pending) >= self.max_cameras:
+                return False
+            if old is not None:
+                # กล้องยังรอคิวเดิมอยู่ → ให้รอต่อที่ตำแหน่งเดิม แต่เปลี่ยนเป็นเฟรมใหม่
+                self.replaced += 1
+                old.finish({"status": "superseded", "by": job.id})
+            self.pending[job.camera] = job
+            self.cond.notify()
+            return True
+
+    def take_batch(self, max_size, wait_s):
+        with self.cond:
+            # worker อื่นอาจเอาเฟรมไปหมดระหว่างที่รอ batch เต็ม
+            while True:
+                while not self.pending:
+                    self.cond.wait()
+                deadline = time.monotonic() + wait_s
+                while len(self.pending) < max_size:
+                    left = deadline - time.monotonic()
+                    if left <= 0 or not self.cond.wait(left):
+                        break
+                if self.pending:
+                    break
+            batch = []
+            while self.pending and len(batch) < max_size:
+                batch.append(self.pending.popitem(last=False)[1])
+            return batch
+
+    def depth(self):
+        with self.cond:
+            return len(self.pending)
+
+inference_queue = LatestFrameQueue(QUEUE_MAX_CAMERAS)
+latest_results = {}  # camera -> ผลล่าสุด สำหรับ GET /result/<camera>
+
+# เฟรมที่แทบไม่ต่างจากเฟรมล่าสุดที่ predict ไปแล้ว (dHash ต่างกันไม่เกิน
+# AI_DEDUP_DISTANCE bit จาก 64 และไม่มีช่องไหนใน 16x16 สว่างเปลี่ยนเกิน
+# AI_DEDUP_CELL_DIFF ระดับ) ใช้ผลเดิมเลยไม่ต้องเข้าคิว แต่ผลที่เก่ากว่า
+# AI_DEDUP_REFRESH_S วินาทีจะ predict ใหม่เสมอ ตั้ง AI_DEDUP_DISTANCE=-1 เพื่อปิด
+DEDUP_DISTANCE = int(os.environ.get("AI_DEDUP_DISTANCE", "4"))
+DEDUP_CELL_DIFF = int(os.environ.get("AI_DEDUP_CELL_DIFF", "24"))
+DEDUP_REFRESH_S = float(os.environ.get("AI_DEDUP_REFRESH_S", "30"))
+frame_cache = FrameCache(DEDUP_DISTANCE, DEDUP_CELL_DIFF, DEDUP_REFRESH_S) if DEDUP_DISTANCE >= 0 else None
+
+# โหมด detector + tracker (ดู tracker.py): AI_TRACK_EVERY=N ให้ YOLO ทำงาน 1 ใน N เฟรม
+# เฟรมระหว่างนั้นตามกล่องชามด้วย template matching แล้วแยก tipped/normal จากภาพในกล่อง
+# ถ้า tracker ไม่แน่ใจ (หลุด/ภาพไม่เหมือนเดิม) เฟรมนั้นเข้า YOLO ทันที 0 = ปิด
+TRACK_EVERY = int(os.environ.get("AI_TRACK_EVERY", "0"))
+tracker = BowlTracker(TRACK_EVERY) if TRACK_EVERY > 0 else None
+
+# cascade (ดู cascade.py): classifier int8 ตัวเดียวกับบนกล้อง (bowl_classifier.py train)
+# ตัดสินก่อน มั่นใจว่า normal/tipped ถึงเกณฑ์ก็ตอบเลย ที่เหลือ (ไม่แน่ใจ/not_found)
+# ค่อยเข้า YOLO ว่าง = ปิด AI_CASCADE_TIPPED > 1 = tipped ต้องให้ YOLO ยืนยันเสมอ
+CASCADE_MODEL = os.environ.get("AI_CASCADE_MODEL", "")
+CASCADE_NORMAL = float(os.environ.get("AI_CASCADE_NORMAL", "0.9"))
+CASCADE_TIPPED = float(os.environ.get("AI_CASCADE_TIPPED", "0.97"))
+CASCADE_LOG_EVERY = 100    # พิมพ์สรุปอัตราออกแต่ละ stage ทุกกี่เฟรม
+cascade = Cascade(CASCADE_MODEL, CASCADE_NORMAL, CASCADE_TIPPED) if CASCADE_MODEL else None
+
+class InferenceMetrics:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.accepted = 0
+        self.rejected = 0
+        self.frames = 0
+        self.batches = 0
+        self.batch_sizes = {}
+        self.latency_ms = deque(maxlen=LATENCY_WINDOW)    # รับรูป → ได้ผล
+        self.queue_ms = deque(maxlen=LATENCY_WINDOW)      # รับรูป → เข้า batch
+        self.predict_ms = deque(maxlen=LATENCY_WINDOW)    # model.predict ต่อ batch
+        self.preprocess_ms = deque(maxlen=LATENCY_WINDOW) # decode + crop + letterbox ต่อรูป
+        self.reductions = {}                              # ย่อตอน decode กี่เท่า -> จำนวนรูป
+
+    def record_preprocess(self, ms, factor):
+        with self.lock:
+            self.preprocess_ms.append(ms)
+            self.reductions[factor] = self.reductions.get(factor, 0) + 1
+
+    def record_batch(self, batch, started, predict_ms):
+        now = time.monotonic()
+        with self.lock:
+            self.batches += 1
+            self.frames += len(batch)
+            self.batch_sizes[len(batch)] = self.batch_sizes.get(len(batch), 0) + 1
+            self.predict_ms.append(predict_ms)
+            for job in batch:
+                self.queue_ms.append((started - job.received) * 1000)
+                self.latency_ms.append((now - job.received) * 1000)
+
+    def snapshot(self):
+        def summary(values):
+            if not values:
+                return {"count": 0}
+            v = sorted(values)
+            return {
+                "count": len(v),
+                "avg": round(sum(v) / len(v), 1),
+                "p50": round(v[len(v) // 2], 1),
+                "p95": round(v[min(len(v) - 1, int(len(v) * 0.95))], 1),
+                "max": round(v[-1], 1),
+            }
+        with self.lock:
+            return {
+                "backend": MODEL_BACKEND,
+                "workers": INFERENCE_PROCESSES,
+                "pool_error": pool.failed,
+                "queue_depth": inference_queue.depth(),
+                "accepted": self.accepted,
+                "rejected": self.rejected,
+                "superseded": inference_queue.replaced,
+                "frames": self.frames,
+                "batches": self.batches,
+                "avg_batch": round(self.frames / self.batches, 2) if self.batches else 0,
+                "batch_sizes": {str(k): n for k, n in sorted(self.batch_sizes.items())},
+                "latency_ms": summary(self.latency_ms),
+                "queue_ms": summary(self.queue_ms),
+                "predict_ms": summary(self.predict_ms),
+                "preprocess_ms": summary(self.preprocess_ms),
+                "decode_reduction": {f"1/{k}": n for k, n in sorted(self.reductions.items())},
+                "dedup": frame_cache.snapshot() if frame_cache else None,
+                "tracker": tracker.snapshot() if tracker else None,
+                "cascade": cascade.snapshot() if cascade else None,
+                "egress": egress.snapshot(),
+            }
+
+metrics = InferenceMetrics()
+
+# --- [ส่วนใหม่] เงื่อนไขแจ้งเตือน Discord ---
+# แจ้งตอนเปลี่ยนเข้าสถานะนั้น ถ้าเพิ่งแจ้งไปไม่ถึง ALERT_MIN_GAP_S ไม่แจ้งซ้ำ (ชามกระพริบ
+# ระหว่าง normal/tipped) และแจ้งย้ำทุก ALERT_REPEAT_S ถ้ายังอยู่ในสถานะเดิม
+ALERT_MIN_GAP_S = 60
+ALERT_REPEAT_S = 15 * 60
+ALERT_RULES = {
+    # ถ้าแก้วหก ให้ส่งแจ้งเตือน!
+    "tipped": AlertRule("🚨 **แจ้งเตือนด่วน!** AI ตรวจพบ **ชามข้าวหก (Tipped)** ⚠️", ALERT_MIN_GAP_S, ALERT_REPEAT_S),
+    # (ถ้าอยากให้แจ้งเตือนตอนหาไม่เจอด้วย ก็เปิดบรรทัดล่างนี้)
+    # "not_found": AlertRule("⚠️ แจ้งเตือน: AI มองไม่เห็นแก้วน้ำ (Not Found)", ALERT_MIN_GAP_S, ALERT_REPEAT_S),
+}
+# --- ส่งผลลัพธ์ไป NETPIE เฉพาะตอนเปลี่ยน และซ้ำทุก STATUS_REPUBLISH_S (เหมือนกล้อง) ---
+STATUS_REPUBLISH_S = 60
+
+egress = StatusEgress(
+    publish_netpie,
+    lambda camera, message: send_discord_alert(f"{message} (กล้อง {camera})"),
+    ALERT_RULES,
+    STATUS_REPUBLISH_S,
+)
+
+def publish_status(camera, status, detections):
+    for d in detections:
+        print(f"AI detected [{camera}]: {d['class']} ({d['conf']:.2f})")
+    # Discord / NETPIE ทำใน thread ของ egress ไม่ให้ webhook ที่ช้าถ่วงคำตอบของกล้อง
+    egress.submit(camera, status)
+
+def on_batch(batch, outcomes, started, predict_ms):
+    if outcomes is None:
+        print(f"❌ Inference failed: {predict_ms}")
+        for job in batch:
+            job.finish({"status": "error", "error": predict_ms})
+        return
+    metrics.record_batch(batch, started, predict_ms)
+    print(f"\n--- Batch of {len(batch)} in {predict_ms:.0f} ms ---")
+
+    for job, (status, detections) in zip(batch, outcomes):
+        job.started = started
+        job.predict_ms = predict_ms
+        outcome = {
+            "status": status,
+            "detections": detections,
+            "job": job.id,
+            "latency_ms": round((time.monotonic() - job.received) * 1000, 1),
+            "time": time.time(),
+        }
+        latest_results[job.camera] = outcome
+        if frame_cache and job.hash is not None:
+            frame_cache.store(job.camera, job.hash, outcome, predict_ms / len(batch))
+        if tracker:
+            tracker.detected(job.camera, job.img, detections)
+        if cascade and job.escalated is not None:
+            cascade.record_stage2((time.monotonic() - job.escalated) * 1000)
+        job.finish(outcome)
+        publish_status(job.camera, status, detections)
+
+# worker หลาย process (AI_WORKERS=N หรือ auto = 1 ตัวต่อ core) fork จากโมเดลที่โหลดไว้แล้ว
+# ต้อง fork ก่อนเริ่ม thread อื่น ๆ (MQTT) ค่าเริ่มต้น 0 = predict ใน process นี้เหมือนเดิม
+workers_env = os.environ.get("AI_WORKERS", "0")
+INFERENCE_PROCESSES = len(os.sched_getaffinity(0)) if workers_env == "auto" else int(workers_env)
+INFERENCE_THREADS = int(os.environ["AI_WORKER_THREADS"]) if "AI_WORKER_THREADS" in os.environ else None
+
+pool = InferencePool(model, INFERENCE_PROCESSES, INFERENCE_THREADS)
+pool.start(lambda: inference_queue.take_batch(BATCH_MAX, BATCH_WAIT_S), on_batch)
+print(f"✅ Inference: {INFERENCE_PROCESSES or 'in-process'} worker(s), {pool.threads or 'default'} thread(s) each")
+
+mqtt_thread = threading.Thread(target=start_mqtt)
+mqtt_thread.daemon = True
+mqtt_thread.start()
+egress.start()
+
+# ==========================================
+# 4. สร้าง Web Server
 # ==========================================
 app = Flask(__name__)
 
+# รับรูปแบบ raw (image/jpeg) อ่าน body ตรงเข้า buffer ที่ใช้ซ้ำของแต่ละ thread
+RAW_MAX_BYTES = 4 * 1024 * 1024
+KEEPALIVE_IDLE_S = 60      # ปิด connection ที่ไม่มี request มานานเท่านี้
+HTTP_THREADS = 8           # thread ของ waitress แต่ละตัวมี buffer ของตัวเอง
+raw_buffers = threading.local()
+
+def camera_id():
+    # กล้องระบุตัวเองได้ด้วย ?camera= / field "camera" / header X-Camera-Id ไม่งั้นใช้ IP
+    return (request.args.get('camera') or request.form.get('camera') or request.headers.get('X-Camera-Id')
+            or request.remote_addr)
+
+def server_timing(received, stages, job=None, note=None):
+    """header Server-Timing: ขั้นตอนก่อนเข้าคิว [(ชื่อ, ms)], รอคิว + predict ถ้าผ่าน YOLO,
+    รวม (ms) note บอกว่าได้ผลทางลัดไหนโดยไม่ผ่าน YOLO"""
+    parts = [f"{name};dur={ms:.1f}" for name, ms in stages]
+    if note:
+        parts.append(note)
+    if job is not None and job.started is not None:
+        parts.append(f"queue;dur={(job.started - job.received) * 1000 - sum(ms for _, ms in stages):.1f}")
+        parts.append(f"infer;dur={job.predict_ms:.1f}")
+    parts.append(f"total;dur={(time.monotonic() - received) * 1000:.1f}")
+    return ", ".join(parts)
+
+def wants_json():
+    # ?wait=1 และ ?async=1 ตอบเป็น JSON ที่เหลือตอบข้อความ "Processed: <status>" แบบเดิม
+    return request.args.get('wait') == '1' or request.args.get('async') == '1'
+
+def answer(outcome, headers):
+    if wants_json():
+        return jsonify(outcome), 200, headers
+    if outcome["status"] == "error":
+        return "Inference failed", 500, headers
+    return f"Processed: {outcome['status']}", 200, headers
+
+def answer_now(camera, outcome, received, stages, note):
+    """ได้ผลโดยไม่ผ่าน YOLO → ส่งต่อเหมือนผลใหม่แล้วตอบทันที"""
+    latest_results[camera] = outcome
+    publish_status(camera, outcome["status"], outcome["detections"])
+    headers = {"Server-Timing": server_timing(received, stages, note=note)}
+    if "job" in outcome:
+        headers["X-Job-Id"] = str(outcome["job"])
+    return answer(outcome, headers)
+
+def submit(data, received, read_ms):
+    """preprocess + เข้าคิว แล้วตอบแบบเดียวกันทั้ง /upload และ /upload/raw"""
+    camera = camera_id()
+    stages = [("read", read_ms)]
+
+    # cascade: classifier จิ๋วตัดสินก่อน ถ้ามั่นใจพอไม่ต้อง decode สีและไม่ต้องเข้า YOLO
+    escalated = None
+    if cascade:
+        stage1_start = time.monotonic()
+        early = cascade.classify(data)
+        escalated = time.monotonic()
+        stages.append(("cascade", (escalated - stage1_start) * 1000))
+        if cascade.frames % CASCADE_LOG_EVERY == 0:
+            print(cascade.log_line())
+        if early is not None:
+            status, confidence = early
+            outcome = {
+                "status": status,
+                "detections": [{"class": status, "conf": round(confidence, 3)}],
+                "stage": 1,
+                "latency_ms": round((time.monotonic() - received) * 1000, 1),
+                "time": time.time(),
+            }
+            return answer_now(camera, outcome, received, stages, 'exit;desc="cascade"')
+
+    # decode แบบย่อ + ครอบชาม + letterbox ใน thread ของ request, worker ทำแค่ predict
+    pre_start = time.monotonic()
+    img, factor = preprocess(data, BOWL_ROI, MODEL_INPUT)
+    if img is None:
+        return "Invalid image", 400
+    frame_hash = signature(img) if frame_cache else None
+    cached = frame_cache.lookup(camera, frame_hash) if frame_cache else None
+    pre_ms = (time.monotonic() - pre_start) * 1000
+    metrics.record_preprocess(pre_ms, factor)
+    stages.append(("pre", pre_ms))
+
+    if cached is not None:
+        # ภาพเหมือนเฟรมที่ predict ล่าสุด → ตอบผลเดิม
+        cached["time"] = time.time()
+        return answer_now(camera, cached, received, stages, 'dedup;desc="hit"')
+
+    if tracker:
+        track_start = time.monotonic()
+        tracked = tracker.track(camera, img)
+        if tracked is not None:
+            stages.append(("track", (time.monotonic() - track_start) * 1000))
+            outcome = {
+                "status": status_of(tracked),
+                "detections": tracked,
+                "tracked": True,
+                "latency_ms": round((time.monotonic() - received) * 1000, 1),
+                "time": time.time(),
+            }
+            return answer_now(camera, outcome, received, stages, None)
+
+    job = InferenceJob(camera, img, received)
+    job.hash = frame_hash
+    job.escalated = escalated
+    if not inference_queue.put(job):
+        with metrics.lock:
+            metrics.rejected += 1
+        return "Queue full", 503
+    with metrics.lock:
+        metrics.accepted += 1
+
+    # ค่าเริ่มต้นรอผลแล้วตอบ "Processed: <status>" เหมือนก่อนมีคิว
+    # ?async=1 ตอบ 202 ทันที ผลออกทาง NETPIE และ GET /result/<camera>
+    # ?wait=1 รอได้ไม่เกิน RESULT_WAIT_S แล้วตอบผลเป็น JSON (ยังไม่เสร็จตอบ 202 pending)
+    if request.args.get('async') == '1':
+        body, code = {"job": job.id, "camera": job.camera}, 202
+    elif not job.done.wait(RESULT_WAIT_S if wants_json() else SYNC_WAIT_S):
+        if not wants_json():
+            return "Processing timed out", 504, {"X-Job-Id": str(job.id)}
+        body, code = {"job": job.id, "camera": job.camera, "status": "pending"}, 202
+    else:
+        return answer(job.result, {"Server-Timing": server_timing(received, stages, job), "X-Job-Id": str(job.id)})
+    return jsonify(body), code, {"Server-Timing": server_timing(received, stages, job), "X-Job-Id": str(job.id)}
+
 @app.route('/upload', methods=['POST'])
 def upload_file():
+    received = time.monotonic()
     if 'imageFile' not in request.files:
         return "No image sent", 400
-        
-    file = request.files['imageFile']
-    npimg = np.frombuffer(file.read(), np.uint8)
-    img = cv2.imdecode(npimg, cv2.IMREAD_COLOR)
-    print("\n--- Received an image! Processing... ---")
-
-    # --- ให้ AI ทำนายผล ---
-    results = model.predict(img, conf=0.5, verbose=False)
-    
-    status = "not_found"
-    found_any_cup = False
-    is_tipped = False
-
-    for result in results:
-        if len(result.boxes) > 0:
-            found_any_cup = True
-            for box in result.boxes:
-                class_id = int(box.cls[0])
-                class_name = model.names[class_id]
-                confidence = box.conf[0]
-                print(f"AI detected: {class_name} ({confidence:.2f})")
-                
-                if class_name == 'tipped':
-                    is_tipped = True
-    
-    # สรุปสถานะสุดท้าย
-    if is_tipped:
-        status = "tipped"
-    elif found_any_cup:
-        status = "normal"
-    else:
-        status = "not_found"
-
-    # --- [ส่วนใหม่] เช็คเงื่อนไขแจ้งเตือน Discord ---
-    if status == "tipped":
-        # ถ้าแก้วหก ให้ส่งแจ้งเตือน!
-        msg = f"🚨 **แจ้งเตือนด่วน!** AI ตรวจพบ **ชามข้าวหก (Tipped)** ⚠️"
-        send_discord_alert(msg)
-    
-    # (ถ้าอยากให้แจ้งเตือนตอนหาไม่เจอด้วย ก็เปิดบรรทัดล่างนี้)
-    # elif status == "not_found":
-    #     send_discord_alert("⚠️ แจ้งเตือน: AI มองไม่เห็นแก้วน้ำ (Not Found)")
 
-    # --- ส่งผลลัพธ์ไป NETPIE ---
-    if mqtt_client and mqtt_client.is_connected():
-        mqtt_client.publish(TOPIC_STATUS, status)
-        print(f"📡 Published to NETPIE: {status}")
-    else:
-        print("⚠️ NETPIE not connected. Cannot publish.")
+    data = request.files['imageFile'].read()
+    return submit(data, received, (time.monotonic() - received) * 1000)
 
-    return f"Processed: {status}", 200
+# body เป็น JPEG ล้วน ไม่ต้องสร้าง multipart ฝั่งกล้อง ใช้ connection เดิมต่อได้
+# (HTTP/1.1 keep-alive) และส่งรูปถัดไปก่อนได้คำตอบของรูปก่อนหน้าได้ (pipelining)
+@app.route('/upload/raw', methods=['POST'])
+def upload_raw():
+    received = time.monotonic()
+    length = request.content_length
+    if request.mimetype != 'image/jpeg':
+        return "Expected image/jpeg", 415
+    if not length:
+        return "Content-Length required", 411
+    if length > RAW_MAX_BYTES:
+        return "Image too large", 413
+
+    buf = getattr(raw_buffers, 'buf', None)
+    if buf is None or len(buf) < length:
+        buf = raw_buffers.buf = bytearray(length)
+    view = memoryview(buf)[:length]
+    got = 0
+    while got < length:
+        n = request.stream.readinto(view[got:])
+        if not n:
+            return "Incomplete body", 400
+        got += n
+    # buffer ใช้ซ้ำได้เพราะ preprocess decode เสร็จก่อน submit คืนค่า
+    return submit(view, received, (time.monotonic() - received) * 1000)
+
+@app.route('/result/<camera>', methods=['GET'])
+def get_result(camera):
+    result = latest_results.get(camera)
+    if result is None:
+        return "No result yet", 404
+    return jsonify(result), 200
+
+@app.route('/metrics', methods=['GET'])
+def get_metrics():
+    return jsonify(metrics.snapshot()), 200
 
 if __name__ == '__main__':
     print("🚀 Server is starting on port 5001...")
-    app.run(host='0.0.0.0', port=5001)
\ No newline at end of file
+    # dev server ของ Flask ปิด connection ทุก request → ใช้ waitress ให้กล้อง
+    # ส่งรูปต่อเนื่องใน connection เดิม (keep-alive + pipelining)
+    try:
+        from waitress import serve
+        serve(app, host='0.0.0.0', port=5001, threads=HTTP_THREADS, channel_timeout=KEEPALIVE_IDLE_S)
+    except ImportError:
+        print("⚠️ ไม่พบ waitress (pip install waitress): ใช้ dev server แทน ไม่มี keep-alive")
+        app.run(host='0.0.0.0', port=5001, threaded=True)
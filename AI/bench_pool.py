@@ -0,0 +1,93 @@
+"""Throughput of the inference pool against the number of worker processes.
+
+Feeds the same images to InferencePool (inference_pool.py) as fast as the
+workers take them, for each worker count in turn, and reports images per
+second and the speedup over one worker. Run it on the machine the server
+runs on, with nothing else loading the CPU:
+
+    python bench_pool.py cup_model.pt --images dataset/normal --workers 0,1,2,4 --seconds 20
+
+Worker count 0 is the in-process mode with the library's own threading, the
+baseline the server had before. Each worker gets cores // workers threads
+unless --threads is given.
+"""
+import argparse
+import glob
+import os
+import threading
+import time
+
+import cv2
+
+from inference_pool import InferencePool
+
+
+class Job:
+    def __init__(self, img):
+        self.img = img
+
+
+def run(model, imgs, processes, threads, batch, seconds):
+    lock = threading.Lock()
+    state = {"next": 0, "done": 0, "stop": time.monotonic() + seconds + 2, "start": None, "predict_ms": []}
+
+    def source():
+        with lock:
+            if time.monotonic() >= state["stop"]:
+                return None
+            i = state["next"]
+            state["next"] += batch
+        return [Job(imgs[(i + k) % len(imgs)]) for k in range(batch)]
+
+    def sink(jobs, outcomes, started, predict_ms):
+        if outcomes is None:
+            raise RuntimeError(predict_ms)
+        with lock:
+            # the first 2 s warm the workers up and are not counted
+            now = time.monotonic()
+            if now >= state["stop"] - seconds:
+                if state["start"] is None:
+                    state["start"] = now
+                state["done"] += len(jobs)
+                state["predict_ms"].append(predict_ms)
+            state["end"] = now
+
+    pool = InferencePool(model, processes, threads)
+    pool.start(source, sink)
+    pool.join()
+    elapsed = state["end"] - state["start"]
+    ms = sorted(state["predict_ms"])
+    return state["done"] / elapsed, ms[len(ms) // 2] if ms else 0, pool.threads
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("model")
+    parser.add_argument("--images", required=True, help="directory of .jpg test images")
+    parser.add_argument("--workers", default="0,1,2,4", help="worker process counts, 0 = in-process")
+    parser.add_argument("--threads", type=int, default=None, help="threads per worker")
+    parser.add_argument("--batch", type=int, default=1, help="images per predict call")
+    parser.add_argument("--seconds", type=float, default=20)
+    args = parser.parse_args()
+
+    from ultralytics import YOLO
+    model = YOLO(args.model)
+    imgs = [cv2.imread(p) for p in sorted(glob.glob(os.path.join(args.images, "*.jpg")))[:64]]
+    imgs = [img for img in imgs if img is not None]
+    if not imgs:
+        raise SystemExit(f"no images in {args.images}")
+
+    cores = len(os.sched_getaffinity(0))
+    print(f"{cores} cores, {len(imgs)} images, batch {args.batch}")
+    print("workers  threads   img/s  predict_p50_ms  speedup_vs_1")
+    one = None
+    for n in [int(w) for w in args.workers.split(",")]:
+        rate, p50, threads = run(model, imgs, n, args.threads, args.batch, args.seconds)
+        if n == 1:
+            one = rate
+        speedup = f"{rate / one:12.2f}" if one else f"{'-':>12}"
+        print(f"{n:7d}  {str(threads or 'default'):>7}  {rate:6.1f}  {p50:14.0f}  {speedup}")
+
+
+if __name__ == "__main__":
+    main()
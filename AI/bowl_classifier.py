@@ -0,0 +1,315 @@
+"""Train / export / compare the on-device bowl classifier.
+
+The camera runs a tiny int8 network (CameraProud/bowl_classifier.cpp) whose
+weights live in the "fr" flash partition. This script keeps the server side of
+that network: it trains it on a recorded image set, writes the flash blob, and
+compares it with the YOLO path used by ai_server.py.
+
+Recorded image set layout: <root>/<normal|tipped|not_found>/*.jpg
+
+    python bowl_classifier.py train   dataset/ bowl_model.bin --crop 250,350,500,600
+    python bowl_classifier.py export  dataset/ dataset_pgm/
+    python bowl_classifier.py compare dataset/ bowl_model.bin
+    parttool.py write_partition --partition-name fr --input bowl_model.bin
+"""
+import argparse
+import glob
+import os
+import struct
+import time
+
+import cv2
+import numpy as np
+
+CLASSES = ["normal", "tipped", "not_found"]
+MAGIC = 0x314C5742  # "BWL1"
+VERSION = 1
+HEADER = struct.Struct("<IHHIHHHHHHHHiifIIII")
+PARTITION_SIZE = 0x20000
+DECODE_MIN_WIDTH = 160  # BOWL_DECODE_MIN_WIDTH in CameraProud.ino
+
+# ==========================================
+# 1. Preprocessing (bit-exact with bowl_preprocess())
+# ==========================================
+def decode_luma(buf, width=None):
+    """Decode at the same reduced JPEG scale the camera picks in luma_pick_scale().
+
+    Without the frame width it is found by a full decode first."""
+    buf = np.frombuffer(buf, np.uint8)
+    full = None
+    if width is None:
+        full = cv2.imdecode(buf, cv2.IMREAD_GRAYSCALE)
+        if full is None:
+            return None
+        width = full.shape[1]
+    scale = 3
+    while scale > 0 and (width >> scale) < DECODE_MIN_WIDTH:
+        scale -= 1
+    if scale == 0:
+        return full if full is not None else cv2.imdecode(buf, cv2.IMREAD_GRAYSCALE)
+    flag = {1: cv2.IMREAD_REDUCED_GRAYSCALE_2, 2: cv2.IMREAD_REDUCED_GRAYSCALE_4, 3: cv2.IMREAD_REDUCED_GRAYSCALE_8}[scale]
+    return cv2.imdecode(buf, flag)
+
+
+def load_luma(path):
+    return decode_luma(np.fromfile(path, np.uint8))
+
+
+def preprocess(luma, crop, in_w, in_h):
+    height, width = luma.shape
+    cx, cy = crop[0] * width // 1000, crop[1] * height // 1000
+    cw, ch = crop[2] * width // 1000, crop[3] * height // 1000
+    if cw < in_w:
+        cw = min(in_w, width)
+    if ch < in_h:
+        ch = min(in_h, height)
+    cx = min(cx, width - cw)
+    cy = min(cy, height - ch)
+
+    if cw >= in_w and ch >= in_h:
+        # every cell is at least 1x1 and they tile the crop: sum rows, then columns
+        ys = cy + np.arange(in_h + 1) * ch // in_h
+        xs = cx + np.arange(in_w + 1) * cw // in_w
+        region = luma[ys[0]:ys[-1], xs[0]:xs[-1]].astype(np.int64)
+        sums = np.add.reduceat(np.add.reduceat(region, ys[:-1] - ys[0], axis=0), xs[:-1] - xs[0], axis=1)
+        cells = (sums // (np.diff(ys)[:, None] * np.diff(xs)[None, :])).ravel()
+        return _normalize(cells)
+
+    cells = np.zeros(in_w * in_h, np.int64)
+    for oy in range(in_h):
+        y0 = cy + oy * ch // in_h
+        y1 = max(cy + (oy + 1) * ch // in_h, y0 + 1)
+        for ox in range(in_w):
+            x0 = cx + ox * cw // in_w
+            x1 = max(cx + (ox + 1) * cw // in_w, x0 + 1)
+            block = luma[y0:y1, x0:x1]
+            cells[oy * in_w + ox] = int(block.sum()) // block.size
+    return _normalize(cells)
+
+
+def _normalize(cells):
+    n = cells.size
+    mean = int(cells.sum()) // n
+    mad = max(int(np.abs(cells - mean).sum()) // n, 1)
+    d = (cells - mean) * 32
+    v = np.sign(d) * (np.abs(d) // mad)  # C division truncates toward zero
+    return np.clip(v, -127, 127).astype(np.int8)
+
+
+def load_set(root):
+    items = []
+    for label, name in enumerate(CLASSES):
+        for path in sorted(glob.glob(os.path.join(root, name, "*.jpg"))):
+            items.append((path, label))
+    if not items:
+        raise SystemExit(f"❌ No images under {root}/<{'|'.join(CLASSES)}>/")
+    return items
+
+# ==========================================
+# 2. Training + int8 quantization
+# ==========================================
+def train_float(x, y, hidden, epochs, lr=0.05, l2=1e-4, seed=0):
+    rng = np.random.default_rng(seed)
+    w1 = rng.normal(0, np.sqrt(2.0 / x.shape[1]), (x.shape[1], hidden))
+    b1 = np.zeros(hidden)
+    w2 = rng.normal(0, np.sqrt(2.0 / hidden), (hidden, len(CLASSES)))
+    b2 = np.zeros(len(CLASSES))
+    onehot = np.eye(len(CLASSES))[y]
+    for epoch in range(epochs):
+        order = rng.permutation(len(x))
+        for start in range(0, len(x), 32):
+            idx = order[start:start + 32]
+            h = np.maximum(x[idx] @ w1 + b1, 0)
+            logits = h @ w2 + b2
+            p = np.exp(logits - logits.max(axis=1, keepdims=True))
+            p /= p.sum(axis=1, keepdims=True)
+            g = (p - onehot[idx]) / len(idx)
+            gw2 = h.T @ g + l2 * w2
+            gh = (g @ w2.T) * (h > 0)
+            gw1 = x[idx].T @ gh + l2 * w1
+            w2 -= lr * gw2
+            b2 -= lr * g.sum(axis=0)
+            w1 -= lr * gw1
+            b1 -= lr * gh.sum(axis=0)
+    return w1, b1, w2, b2
+
+
+def quantize(w1, b1, w2, b2, x):
+    s_in = 1.0 / 32
+    s_w1 = max(np.abs(w1).max(), 1e-8) / 127
+    h = np.maximum((x * s_in) @ w1 + b1, 0)
+    s_h = max(h.max(), 1e-8) / 127
+    m = s_in * s_w1 / s_h
+    shift = int(np.clip(np.floor(30 - np.log2(m)), 0, 62))
+    mult = int(round(m * (1 << shift)))
+    s_w2 = max(np.abs(w2).max(), 1e-8) / 127
+    return {
+        "w1": np.clip(np.round(w1.T / s_w1), -127, 127).astype(np.int8),
+        "b1": np.round(b1 / (s_in * s_w1)).astype(np.int32),
+        "w2": np.clip(np.round(w2.T / s_w2), -127, 127).astype(np.int8),
+        "b2": np.round(b2 / (s_h * s_w2)).astype(np.int32),
+        "l1_mult": mult,
+        "l1_shift": shift,
+        "out_scale": s_h * s_w2,
+    }
+
+
+def infer_q(q, x):
+    """Same integer arithmetic as bowl_infer()."""
+    acc1 = q["w1"].astype(np.int64) @ x.astype(np.int64) + q["b1"]
+    hidden = np.clip((acc1 * q["l1_mult"]) >> q["l1_shift"], 0, 127)
+    logits = q["w2"].astype(np.int64) @ hidden + q["b2"]
+    best = int(np.argmax(logits))
+    p = np.exp((logits - logits[best]) * q["out_scale"])
+    return best, float(1.0 / p.sum())
+
+
+def write_blob(path, q, in_w, in_h, crop):
+    hidden = q["b1"].size
+    # bowl_model_load() rejects sections that are not 4-byte aligned
+    w1_off = HEADER.size
+    b1_off = w1_off + ((q["w1"].size + 3) & ~3)
+    w2_off = b1_off + q["b1"].size * 4
+    b2_off = w2_off + ((q["w2"].size + 3) & ~3)
+    total = b2_off + q["b2"].size * 4
+    header = HEADER.pack(MAGIC, VERSION, HEADER.size, total, in_w, in_h, hidden, len(CLASSES), *crop,
+                         q["l1_mult"], q["l1_shift"], q["out_scale"], w1_off, b1_off, w2_off, b2_off)
+    blob = bytearray(header)
+    blob += q["w1"].tobytes()
+    blob += bytes(b1_off - len(blob))
+    blob += q["b1"].astype("<i4").tobytes()
+    blob += q["w2"].tobytes()
+    blob += bytes(b2_off - len(blob))
+    blob += q["b2"].astype("<i4").tobytes()
+    if len(blob) > PARTITION_SIZE:
+        raise SystemExit(f"❌ Model is {len(blob)} bytes, the fr partition holds {PARTITION_SIZE}")
+    with open(path, "wb") as f:
+        f.write(blob)
+    return len(blob)
+
+
+def read_blob(path):
+    with open(path, "rb") as f:
+        blob = f.read()
+    (magic, version, _, total, in_w, in_h, hidden, classes, cx, cy, cw, ch,
+     mult, shift, out_scale, w1_off, b1_off, w2_off, b2_off) = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION:
+        raise SystemExit(f"❌ {path} is not a bowl model")
+    n = in_w * in_h
+    q = {
+        "w1": np.frombuffer(blob, np.int8, n * hidden, w1_off).reshape(hidden, n),
+        "b1": np.frombuffer(blob, "<i4", hidden, b1_off),
+        "w2": np.frombuffer(blob, np.int8, classes * hidden, w2_off).reshape(classes, hidden),
+        "b2": np.frombuffer(blob, "<i4", classes, b2_off),
+        "l1_mult": mult,
+        "l1_shift": shift,
+        "out_scale": out_scale,
+    }
+    return q, in_w, in_h, (cx, cy, cw, ch)
+
+# ==========================================
+# 3. Commands
+# ==========================================
+def cmd_train(args):
+    crop = tuple(int(v) for v in args.crop.split(","))
+    if args.size * args.size > 48 * 48 or not 0 < args.hidden <= 64:
+        raise SystemExit("❌ Input must be at most 48x48 and hidden at most 64 (BOWL_MAX_INPUT/BOWL_MAX_HIDDEN)")
+    items = load_set(args.dataset)
+    x, y = [], []
+    for path, label in items:
+        luma = load_luma(path)
+        if luma is not None:
+            x.append(preprocess(luma, crop, args.size, args.size))
+            y.append(label)
+    x = np.array(x, np.float64)
+    y = np.array(y)
+    print(f"⏳ Training on {len(x)} images ({args.size}x{args.size} crop, {args.hidden} hidden)...")
+    w1, b1, w2, b2 = train_float(x / 32.0, y, args.hidden, args.epochs)
+    q = quantize(w1, b1, w2, b2, x)
+    size = write_blob(args.output, q, args.size, args.size, crop)
+    correct = sum(infer_q(q, xi.astype(np.int8))[0] == yi for xi, yi in zip(x, y))
+    print(f"✅ Wrote {args.output} ({size} bytes), int8 train accuracy {100.0 * correct / len(x):.1f}%")
+
+
+def cmd_export(args):
+    """Write the reduced-scale luma frames for CameraProud/host/bowl_classify_host."""
+    os.makedirs(args.output, exist_ok=True)
+    lines = []
+    for path, label in load_set(args.dataset):
+        luma = load_luma(path)
+        if luma is None:
+            continue
+        name = f"{CLASSES[label]}_{os.path.splitext(os.path.basename(path))[0]}.pgm"
+        cv2.imwrite(os.path.join(args.output, name), luma)
+        lines.append(f"{CLASSES[label]} {name}\n")
+    with open(os.path.join(args.output, "manifest.txt"), "w") as f:
+        f.writelines(lines)
+    print(f"✅ Exported {len(lines)} frames to {args.output}")
+
+
+def report(name, expected, predicted, latency):
+    acc = 100.0 * np.mean(np.array(expected) == np.array(predicted))
+    lat = np.array(latency) * 1000
+    print(f"{name:<12} accuracy {acc:5.1f}%   latency mean {lat.mean():8.2f}ms  p95 {np.percentile(lat, 95):8.2f}ms")
+
+
+def cmd_compare(args):
+    from ultralytics import YOLO
+
+    q, in_w, in_h, crop = read_blob(args.model)
+    yolo = YOLO(args.yolo)
+    items = load_set(args.dataset)
+    expected, dev_pred, dev_lat, srv_pred, srv_lat = [], [], [], [], []
+    for path, label in items:
+        luma = load_luma(path)
+        img = cv2.imread(path, cv2.IMREAD_COLOR)
+        if luma is None or img is None:
+            continue
+        expected.append(label)
+
+        start = time.perf_counter()
+        dev_pred.append(infer_q(q, preprocess(luma, crop, in_w, in_h))[0])
+        dev_lat.append(time.perf_counter() - start)
+
+        # same decision rule as upload_file() in ai_server.py
+        start = time.perf_counter()
+        results = yolo.predict(img, conf=0.5, verbose=False)
+        names = [yolo.names[int(b.cls[0])] for r in results for b in r.boxes]
+        srv_lat.append(time.perf_counter() - start)
+        srv_pred.append(1 if "tipped" in names else (0 if names else 2))
+
+    print(f"📊 {len(expected)} images (device latency is the Python port, see host/bowl_classify_host for C)")
+    report("device int8", expected, dev_pred, dev_lat)
+    report("server yolo", expected, srv_pred, srv_lat)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("train")
+    p.add_argument("dataset")
+    p.add_argument("output")
+    p.add_argument("--crop", default="0,0,1000,1000", help="bowl region x,y,w,h in 1/1000 of the frame")
+    p.add_argument("--size", type=int, default=32)
+    p.add_argument("--hidden", type=int, default=16)
+    p.add_argument("--epochs", type=int, default=200)
+    p.set_defaults(func=cmd_train)
+
+    p = sub.add_parser("export")
+    p.add_argument("dataset")
+    p.add_argument("output")
+    p.set_defaults(func=cmd_export)
+
+    p = sub.add_parser("compare")
+    p.add_argument("dataset")
+    p.add_argument("model")
+    p.add_argument("--yolo", default="cup_model.pt")
+    p.set_defaults(func=cmd_compare)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
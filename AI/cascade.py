@@ -0,0 +1,94 @@
+"""Cheap-classifier-first cascade for ai_server.py.
+
+Stage 1 is the camera's own bowl classifier (bowl_classifier.py writes its
+blob, CameraProud/bowl_classifier.cpp runs it on the device): the upload is
+decoded as grayscale at 1/8 scale, the bowl crop stored in the blob is
+averaged down to the network input, and the int8 network says normal,
+tipped or not_found with a softmax confidence. It costs about a millisecond
+where YOLO costs tens to hundreds.
+
+A frame leaves at stage 1 when the classifier says normal with at least
+normal_min confidence, or tipped with at least tipped_min. Everything else
+(not_found, low confidence) is uncertain and goes on to YOLO, stage 2, as
+before. tipped_min above 1 sends every tipped frame to YOLO, so only YOLO
+can raise an alert.
+
+    python bowl_classifier.py train dataset/ bowl_model.bin --crop 250,350,500,600
+    AI_CASCADE_MODEL=bowl_model.bin python ai_server.py
+"""
+import threading
+import time
+from collections import deque
+
+from bowl_classifier import CLASSES, decode_luma, infer_q, preprocess, read_blob
+from preprocess import jpeg_size
+
+LATENCY_WINDOW = 500
+
+
+def _summary(values):
+    if not values:
+        return {"count": 0}
+    v = sorted(values)
+    return {
+        "count": len(v),
+        "avg": round(sum(v) / len(v), 2),
+        "p50": round(v[len(v) // 2], 2),
+        "p95": round(v[min(len(v) - 1, int(len(v) * 0.95))], 2),
+    }
+
+
+class Cascade:
+    def __init__(self, model_path, normal_min, tipped_min):
+        self.q, self.in_w, self.in_h, self.crop = read_blob(model_path)
+        self.thresholds = {"normal": normal_min, "tipped": tipped_min}
+        self.lock = threading.Lock()
+        self.frames = 0
+        self.exits = dict.fromkeys(self.thresholds, 0)
+        self.uncertain = 0
+        self.stage1_ms = deque(maxlen=LATENCY_WINDOW)  # decode + classify
+        self.stage2_ms = deque(maxlen=LATENCY_WINDOW)  # uncertain frames: stage 1 done -> YOLO result
+
+    def classify(self, buf):
+        """(status, confidence) if the frame can leave at stage 1, else None."""
+        start = time.monotonic()
+        dims = jpeg_size(buf)
+        luma = decode_luma(buf, dims[0] if dims else None)
+        label, confidence = None, 0.0
+        if luma is not None:
+            best, confidence = infer_q(self.q, preprocess(luma, self.crop, self.in_w, self.in_h))
+            label = CLASSES[best]
+        ms = (time.monotonic() - start) * 1000
+        exit_ok = label in self.thresholds and confidence >= self.thresholds[label]
+        with self.lock:
+            self.frames += 1
+            self.stage1_ms.append(ms)
+            if exit_ok:
+                self.exits[label] += 1
+            else:
+                self.uncertain += 1
+        return (label, confidence) if exit_ok else None
+
+    def record_stage2(self, ms):
+        with self.lock:
+            self.stage2_ms.append(ms)
+
+    def snapshot(self):
+        with self.lock:
+            n = max(self.frames, 1)
+            return {
+                "thresholds": dict(self.thresholds),
+                "frames": self.frames,
+                "exits": dict(self.exits),
+                "uncertain": self.uncertain,
+                "exit_rate": round(sum(self.exits.values()) / n, 3),
+                "stage1_ms": _summary(self.stage1_ms),
+                "stage2_ms": _summary(self.stage2_ms),
+            }
+
+    def log_line(self):
+        s = self.snapshot()
+        n = max(s["frames"], 1)
+        exits = ", ".join(f"{k} {100.0 * v / n:.0f}%" for k, v in s["exits"].items())
+        return (f"📊 Cascade: {s['frames']} frames, {100.0 * s['exit_rate']:.0f}% left at stage 1 ({exits}), "
+                f"stage 1 {s['stage1_ms'].get('avg', 0)} ms, stage 2 {s['stage2_ms'].get('avg', 0)} ms")
@@ -0,0 +1,99 @@
+"""Alert and MQTT egress for ai_server.py, off the request path.
+
+Results used to be published from the thread that produced them: the upload
+request (cache, tracker and cascade answers) or an inference dispatcher, so
+a slow Discord webhook held up the camera's HTTP response or the next
+batch. Now results only go on a queue, and one worker thread:
+
+  * publishes @msg/status for a camera when its status changes, and again
+    every republish_s while it does not (BOWL_REPUBLISH_INTERVAL on the
+    camera follows the same rule), so a gateway that reconnects still
+    learns the state;
+  * sends an alert when a camera enters a status that has a rule, unless
+    the same alert went out less than min_gap_s ago (a bowl flickering
+    between normal and tipped alerts once), and repeats it every
+    realert_s for as long as the status holds.
+
+A publish that fails (broker not connected) is retried with the next result
+of that camera. An alert that fails is retried after min_gap_s.
+"""
+import queue
+import threading
+import time
+
+
+class AlertRule:
+    def __init__(self, message, min_gap_s, realert_s):
+        self.message = message
+        self.min_gap_s = min_gap_s
+        self.realert_s = realert_s
+
+
+class _CameraState:
+    def __init__(self):
+        self.status = None
+        self.published = None     # last status published, and when
+        self.published_at = 0.0
+        self.alerted = {}         # status -> (time of the last alert attempt, sent)
+
+
+class StatusEgress:
+    def __init__(self, publish, alert, rules, republish_s, max_queue=1000):
+        """publish(camera, status) and alert(camera, message) return True on success."""
+        self.publish = publish
+        self.alert = alert
+        self.rules = rules
+        self.republish_s = republish_s
+        self.queue = queue.Queue(max_queue)
+        self.cameras = {}
+        self.lock = threading.Lock()
+        self.counts = dict.fromkeys(
+            ["results", "dropped", "published", "unchanged", "publish_failed", "alerts", "alerts_debounced", "alert_failed"], 0)
+        self.thread = threading.Thread(target=self._run, daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def submit(self, camera, status):
+        """Never blocks: when the worker is that far behind the result is dropped."""
+        try:
+            self.queue.put_nowait((camera, status, time.monotonic()))
+        except queue.Full:
+            self._count("dropped")
+
+    def _count(self, name):
+        with self.lock:
+            self.counts[name] += 1
+
+    def _run(self):
+        while True:
+            camera, status, now = self.queue.get()
+            self._count("results")
+            cam = self.cameras.setdefault(camera, _CameraState())
+            entered = status != cam.status
+            cam.status = status
+
+            if status != cam.published or now - cam.published_at >= self.republish_s:
+                if self.publish(camera, status):
+                    cam.published, cam.published_at = status, now
+                    self._count("published")
+                else:
+                    self._count("publish_failed")
+            else:
+                self._count("unchanged")
+
+            rule = self.rules.get(status)
+            if rule is None:
+                continue
+            last, sent = cam.alerted.get(status, (None, True))
+            since = now - last if last is not None else None
+            if since is None or since >= rule.realert_s or ((entered or not sent) and since >= rule.min_gap_s):
+                sent = self.alert(camera, rule.message)
+                cam.alerted[status] = (now, sent)
+                self._count("alerts" if sent else "alert_failed")
+            elif entered:
+                self._count("alerts_debounced")
+
+    def snapshot(self):
+        with self.lock:
+            return dict(self.counts, queue_depth=self.queue.qsize())
@@ -0,0 +1,233 @@
+"""Export the cup detector to a CPU runtime and compare it with PyTorch.
+
+ai_server.py picks the backend with AI_MODEL_BACKEND (see MODEL_BACKENDS
+there). This script builds the files it expects next to cup_model.pt:
+
+    python export_model.py export cup_model.pt --format onnx
+    python export_model.py export cup_model.pt --format onnx --int8 --calib cage_images/
+    python export_model.py export cup_model.pt --format openvino --int8 --calib cage_images/
+    python export_model.py compare cup_model.pt cup_model_int8.onnx --data dataset/
+
+int8 is post-training static quantization, calibrated on cage images as the
+camera uploads them (any .jpg under --calib). ONNX is quantized with ONNX
+Runtime (Conv/MatMul weights and activations, the box decoding stays float);
+OpenVINO with NNCF through the Ultralytics exporter.
+
+compare runs both models over --data and reports how often the bowl status
+and the boxes agree with PyTorch, and the latency of each. When --data has the
+<normal|tipped|not_found>/*.jpg layout of bowl_classifier.py, the status
+accuracy against those labels is reported too.
+"""
+import argparse
+import glob
+import os
+import tempfile
+import time
+
+import cv2
+import numpy as np
+
+from inference_pool import CONF, summarize, warmup
+from preprocess import parse_roi, preprocess
+
+CLASSES = ["normal", "tipped", "not_found"]
+CALIB_MAX_IMAGES = 300
+
+# ==========================================
+# 1. Helpers
+# ==========================================
+def list_images(root):
+    return sorted(glob.glob(os.path.join(root, "**", "*.jpg"), recursive=True))
+
+
+def to_tensor(path, roi, size):
+    """Model input exactly as ai_server.py prepares an upload."""
+    with open(path, "rb") as f:
+        img, _ = preprocess(f.read(), roi, size)
+    if img is None:
+        return None
+    x = img[:, :, ::-1].transpose(2, 0, 1)  # BGR HWC -> RGB CHW
+    return np.ascontiguousarray(x, np.float32)[None] / 255.0
+
+
+# ==========================================
+# 2. Export
+# ==========================================
+def quantize_onnx(src, dst, calib, roi, imgsz):
+    from onnxruntime.quantization import CalibrationDataReader, CalibrationMethod, QuantFormat, QuantType, quantize_static
+
+    paths = list_images(calib)[:CALIB_MAX_IMAGES]
+    if not paths:
+        raise SystemExit(f"❌ No .jpg calibration images in {calib}")
+
+    class CageImages(CalibrationDataReader):
+        def __init__(self):
+            import onnxruntime
+            self.input = onnxruntime.InferenceSession(src, providers=["CPUExecutionProvider"]).get_inputs()[0].name
+            self.paths = iter(paths)
+
+        def get_next(self):
+            for path in self.paths:
+                x = to_tensor(path, roi, imgsz)
+                if x is not None:
+                    return {self.input: x}
+            return None
+
+    print(f"⏳ Calibrating int8 on {len(paths)} images...")
+    quantize_static(
+        src, dst, CageImages(),
+        quant_format=QuantFormat.QDQ,
+        op_types_to_quantize=["Conv", "MatMul"],
+        per_channel=True,
+        activation_type=QuantType.QUInt8,
+        weight_type=QuantType.QInt8,
+        calibrate_method=CalibrationMethod.Percentile,
+    )
+
+
+def calib_yaml(calib, names, workdir):
+    """Dataset file for the Ultralytics int8 exporter; calibration needs no labels."""
+    path = os.path.join(workdir, "calib.yaml")
+    with open(path, "w") as f:
+        f.write(f"path: {os.path.abspath(calib)}\ntrain: .\nval: .\nnames:\n")
+        for i, name in sorted(names.items()):
+            f.write(f"  {i}: {name}\n")
+    return path
+
+
+def cmd_export(args):
+    from ultralytics import YOLO
+
+    model = YOLO(args.model)
+    stem = os.path.splitext(args.model)[0]
+    if args.int8 and not args.calib:
+        raise SystemExit("❌ --int8 needs --calib <cage images>")
+
+    if args.format == "onnx":
+        out = model.export(format="onnx", imgsz=args.imgsz, dynamic=False, simplify=True)
+        if args.int8:
+            dst = f"{stem}_int8.onnx"
+            quantize_onnx(out, dst, args.calib, parse_roi(args.roi), args.imgsz)
+            out = dst
+    else:
+        with tempfile.TemporaryDirectory() as workdir:
+            data = calib_yaml(args.calib, model.names, workdir) if args.int8 else None
+            out = model.export(format="openvino", imgsz=args.imgsz, int8=args.int8, data=data, fraction=1.0)
+    print(f"✅ Exported {out}")
+
+
+# ==========================================
+# 3. Compare
+# ==========================================
+def load(path):
+    from ultralytics import YOLO
+
+    model = YOLO(path, task="detect")
+    warmup(model, os.path.basename(path.rstrip("/")))
+    return model
+
+
+def run(model, img):
+    start = time.perf_counter()
+    result = model.predict(img, conf=CONF, verbose=False)[0]
+    latency = time.perf_counter() - start
+    status, _ = summarize(result, model.names)
+    boxes = [(int(c), b) for c, b in zip(result.boxes.cls.tolist(), result.boxes.xyxy.tolist())]
+    return status, boxes, latency
+
+
+def iou(a, b):
+    x1, y1 = max(a[0], b[0]), max(a[1], b[1])
+    x2, y2 = min(a[2], b[2]), min(a[3], b[3])
+    inter = max(0.0, x2 - x1) * max(0.0, y2 - y1)
+    union = (a[2] - a[0]) * (a[3] - a[1]) + (b[2] - b[0]) * (b[3] - b[1]) - inter
+    return inter / union if union > 0 else 0.0
+
+
+def matched(base, cand, threshold=0.5):
+    """Baseline boxes the candidate found again: same class, IoU >= threshold."""
+    free = list(cand)
+    hits = 0
+    for cls, box in base:
+        best = max(((iou(box, b), i) for i, (c, b) in enumerate(free) if c == cls), default=(0.0, -1))
+        if best[0] >= threshold:
+            free.pop(best[1])
+            hits += 1
+    return hits
+
+
+def report(name, latency, statuses, labels):
+    lat = np.array(latency) * 1000
+    line = f"{name:<28} latency mean {lat.mean():7.1f}ms  p50 {np.percentile(lat, 50):7.1f}ms  p95 {np.percentile(lat, 95):7.1f}ms"
+    if labels:
+        acc = 100.0 * np.mean([s == l for s, l in zip(statuses, labels)])
+        line += f"  status accuracy {acc:5.1f}%"
+    print(line)
+
+
+def cmd_compare(args):
+    paths = list_images(args.data)
+    if not paths:
+        raise SystemExit(f"❌ No .jpg images in {args.data}")
+    base_model, cand_model = load(args.baseline), load(args.candidate)
+
+    base_lat, cand_lat, base_status, cand_status, labels = [], [], [], [], []
+    agree = base_boxes = box_hits = cand_boxes = 0
+    for path in paths:
+        if args.roi:
+            with open(path, "rb") as f:
+                img, _ = preprocess(f.read(), parse_roi(args.roi), args.imgsz)
+        else:
+            img = cv2.imread(path)
+        if img is None:
+            continue
+        labels.append(os.path.basename(os.path.dirname(path)))
+        bs, bb, bl = run(base_model, img)
+        cs, cb, cl = run(cand_model, img)
+        base_lat.append(bl)
+        cand_lat.append(cl)
+        base_status.append(bs)
+        cand_status.append(cs)
+        agree += bs == cs
+        base_boxes += len(bb)
+        cand_boxes += len(cb)
+        box_hits += matched(bb, cb)
+
+    n = len(base_lat)
+    # labels from the bowl_classifier.py layout, when every image has one
+    labels = labels if all(l in CLASSES for l in labels) else None
+    print(f"📊 {n} images, conf {CONF}")
+    report(os.path.basename(args.baseline), base_lat, base_status, labels)
+    report(os.path.basename(args.candidate.rstrip("/")), cand_lat, cand_status, labels)
+    print(f"status agreement with baseline {100.0 * agree / n:5.1f}%")
+    print(f"baseline boxes found again     {100.0 * box_hits / max(base_boxes, 1):5.1f}% ({box_hits}/{base_boxes}, candidate has {cand_boxes})")
+    print(f"speedup (mean latency)         {np.mean(base_lat) / np.mean(cand_lat):5.2f}x")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("export")
+    p.add_argument("model")
+    p.add_argument("--format", choices=["onnx", "openvino"], default="onnx")
+    p.add_argument("--int8", action="store_true")
+    p.add_argument("--calib", help="directory of cage images for int8 calibration")
+    p.add_argument("--roi", help="bowl region x,y,w,h in 1/1000, as AI_BOWL_ROI in ai_server.py (ONNX only)")
+    p.add_argument("--imgsz", type=int, default=640)
+    p.set_defaults(func=cmd_export)
+
+    p = sub.add_parser("compare")
+    p.add_argument("baseline")
+    p.add_argument("candidate")
+    p.add_argument("--data", required=True)
+    p.add_argument("--roi", help="feed both models the preprocessed bowl region, as ai_server.py does")
+    p.add_argument("--imgsz", type=int, default=640)
+    p.set_defaults(func=cmd_compare)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
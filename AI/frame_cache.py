@@ -0,0 +1,111 @@
+"""Per-camera frame deduplication for ai_server.py.
+
+The cage is still most of the time, so most uploads show what the last one
+showed. Every preprocessed frame gets a 64-bit dHash: the model input is
+shrunk to a 9x8 grayscale thumbnail and each bit says whether a pixel is
+brighter than its right neighbour. It follows edges rather than absolute
+brightness, so auto-exposure drift and JPEG noise barely move it, while a
+camera that was bumped or a hamster in front of the lens flips many bits.
+
+The hash sees the frame as a whole, so a bowl that fills a few percent of
+it can tip without flipping a single bit. Each frame therefore also keeps a
+16x16 thumbnail of block means, and a frame only matches when no block
+moved by more than max_cell_diff gray levels once the overall brightness
+shift (median over blocks) is taken out.
+
+When a frame matches the last frame the model actually ran on for that
+camera, that result is reused. The reference is always the inferred frame,
+never the previous hit, so slow changes cannot creep past the thresholds one
+small step at a time; and a result older than refresh_s is never reused.
+"""
+import threading
+import time
+
+import cv2
+import numpy as np
+
+HASH_SIZE = 8  # 8x8 comparisons = 64 bits
+THUMB_SIZE = 16  # blocks per side for the local change check
+
+
+def dhash(gray):
+    """64-bit difference hash of a grayscale image."""
+    small = cv2.resize(gray, (HASH_SIZE + 1, HASH_SIZE), interpolation=cv2.INTER_AREA)
+    bits = small[:, 1:] > small[:, :-1]
+    return int.from_bytes(np.packbits(bits).tobytes(), "big")
+
+
+def signature(img):
+    """(dHash, 16x16 block means) of a BGR image."""
+    gray = cv2.cvtColor(img, cv2.COLOR_BGR2GRAY)
+    thumb = cv2.resize(gray, (THUMB_SIZE, THUMB_SIZE), interpolation=cv2.INTER_AREA).astype(np.int16)
+    return dhash(gray), thumb
+
+
+def distance(a, b):
+    return bin(a ^ b).count("1")
+
+
+def cell_diff(a, b):
+    """Largest block change after removing the overall brightness shift."""
+    d = a - b
+    d -= int(np.median(d))
+    return int(np.abs(d).max())
+
+
+class _Entry:
+    def __init__(self, sig, result, cost_ms, inferred):
+        self.hash, self.thumb = sig
+        self.result = result
+        self.cost_ms = cost_ms  # model time one inference of this frame took
+        self.inferred = inferred
+
+
+class FrameCache:
+    def __init__(self, max_distance, max_cell_diff, refresh_s):
+        self.max_distance = max_distance
+        self.max_cell_diff = max_cell_diff
+        self.refresh_s = refresh_s
+        self.lock = threading.Lock()
+        self.entries = {}  # camera -> _Entry of the last inferred frame
+        self.hits = 0
+        self.misses = 0
+        self.refreshes = 0  # close enough, but the result was too old
+        self.saved_ms = 0.0
+
+    def lookup(self, camera, sig):
+        """The reusable result for this frame (a signature()), or None if it
+        must be inferred."""
+        now = time.monotonic()
+        h, thumb = sig
+        with self.lock:
+            entry = self.entries.get(camera)
+            if (entry is None or distance(entry.hash, h) > self.max_distance
+                    or cell_diff(entry.thumb, thumb) > self.max_cell_diff):
+                self.misses += 1
+                return None
+            if now - entry.inferred >= self.refresh_s:
+                self.refreshes += 1
+                self.misses += 1
+                return None
+            self.hits += 1
+            self.saved_ms += entry.cost_ms
+            return dict(entry.result, cached=True, age_s=round(now - entry.inferred, 1))
+
+    def store(self, camera, sig, result, cost_ms):
+        with self.lock:
+            self.entries[camera] = _Entry(sig, result, cost_ms, time.monotonic())
+
+    def snapshot(self):
+        with self.lock:
+            total = self.hits + self.misses
+            return {
+                "max_distance": self.max_distance,
+                "max_cell_diff": self.max_cell_diff,
+                "refresh_s": self.refresh_s,
+                "hits": self.hits,
+                "misses": self.misses,
+                "refreshes": self.refreshes,
+                "hit_rate": round(self.hits / total, 3) if total else 0,
+                "saved_ms": round(self.saved_ms, 1),
+            }
@@ -0,0 +1,213 @@
+"""Inference workers for ai_server.py.
+
+With processes=0 the model runs in a thread of the server process, as it
+always did. With processes=N the model is loaded once in the server and N
+worker processes are forked from it, so the weights are shared copy-on-write
+instead of loaded N times. Each worker is pinned to its own cores and limited
+to `threads` intra-op threads, so workers do not fight over the same cores.
+
+Every worker has a dispatcher thread in the server. A dispatcher only asks
+for the next batch when its worker is idle, so requests go to whichever
+worker is free, and frames wait in the latest-wins queue instead of going
+stale in a worker's backlog.
+
+A worker that dies is not replaced: forking it again from a server that now
+runs dispatcher, MQTT and HTTP threads can copy a lock some thread holds and
+hang the child, and a spawned worker would have to re-run ai_server.py to get
+the model. The pool stops instead, and every batch from then on fails with
+the error in InferencePool.failed until the server is restarted.
+
+    python bench_pool.py cup_model.pt --images dataset/normal --workers 0,1,2,4
+
+Linux only (fork, sched_setaffinity).
+"""
+import multiprocessing as mp
+import os
+import threading
+import time
+
+CONF = 0.5  # model.predict confidence threshold
+WARMUP_RUNS = 3  # first predict calls build the runtime's kernels and buffers
+
+# ==========================================
+# 1. Result summary, shared by the server and the workers
+# ==========================================
+def summarize(result, names):
+    """Bowl status of one YOLO result: tipped > normal > not_found."""
+    detections = []
+    found_any_cup = False
+    is_tipped = False
+    for box in result.boxes:
+        found_any_cup = True
+        class_name = names[int(box.cls[0])]
+        confidence = float(box.conf[0])
+        box_xyxy = [round(float(v), 1) for v in box.xyxy[0]]  # model input pixels
+        detections.append({"class": class_name, "conf": round(confidence, 3), "box": box_xyxy})
+        if class_name == "tipped":
+            is_tipped = True
+
+    if is_tipped:
+        status = "tipped"
+    elif found_any_cup:
+        status = "normal"
+    else:
+        status = "not_found"
+    return status, detections
+
+
+def predict(model, imgs):
+    """Returns ([(status, detections)] per image, predict time in ms)."""
+    start = time.monotonic()
+    results = model.predict(imgs, conf=CONF, verbose=False)
+    outcomes = [summarize(r, model.names) for r in results]
+    return outcomes, (time.monotonic() - start) * 1000
+
+
+def warmup(model, name):
+    """Runs on the worker itself: ONNX Runtime and OpenVINO sessions are
+    created on the first predict and must not be inherited through fork."""
+    import numpy as np
+    start = time.monotonic()
+    img = np.zeros((480, 640, 3), np.uint8)
+    for _ in range(WARMUP_RUNS):
+        model.predict(img, conf=CONF, verbose=False)
+    print(f"🔥 {name} warmed up in {(time.monotonic() - start) * 1000:.0f} ms")
+
+
+def set_threads(threads):
+    try:
+        import torch
+        torch.set_num_threads(threads)
+    except ImportError:
+        pass
+    try:
+        import cv2
+        cv2.setNumThreads(threads)
+    except ImportError:
+        pass
+
+
+# ==========================================
+# 2. Worker process
+# ==========================================
+def _worker_main(model, index, threads, cores, conn):
+    if cores:
+        os.sched_setaffinity(0, cores)
+    set_threads(threads)
+    warmup(model, f"Worker {index}")
+    while True:
+        imgs = conn.recv()
+        if imgs is None:
+            break
+        try:
+            conn.send(predict(model, imgs))
+        except Exception as e:
+            conn.send((None, str(e)))
+
+
+def core_sets(processes, threads):
+    """Cores each worker is pinned to, None when there are not enough."""
+    cores = sorted(os.sched_getaffinity(0))
+    if processes * threads > len(cores):
+        return [None] * processes
+    return [set(cores[i * threads:(i + 1) * threads]) for i in range(processes)]
+
+
+# ==========================================
+# 3. Pool
+# ==========================================
+class InferencePool:
+    def __init__(self, model, processes=0, threads=None, pin=True):
+        """threads=None leaves the library default in-process, and splits
+        the cores evenly between worker processes."""
+        self.model = model
+        self.processes = processes
+        if threads is None and processes:
+            threads = max(1, len(os.sched_getaffinity(0)) // processes)
+        self.threads = threads
+        self.cores = core_sets(processes, threads) if pin and processes else [None] * processes
+        self.workers = []
+        self.dispatchers = []
+        self.failed = None  # why the worker processes were shut down
+        self.lock = threading.Lock()
+
+    def _spawn(self, index):
+        ctx = mp.get_context("fork")
+        parent, child = ctx.Pipe()
+        proc = ctx.Process(target=_worker_main, args=(self.model, index, self.threads, self.cores[index], child), daemon=True)
+        proc.start()
+        child.close()
+        return proc, parent
+
+    def start(self, source, sink):
+        """Runs until source() returns None.
+
+        source() blocks until it has a batch of jobs (objects with .img);
+        sink(batch, outcomes, started, predict_ms) gets the outcomes in batch
+        order, or outcomes=None and the error text in place of predict_ms.
+        """
+        if self.processes == 0:
+            if self.threads:
+                set_threads(self.threads)
+            self.dispatchers = [threading.Thread(target=self._dispatch_local, args=(source, sink), daemon=True)]
+        else:
+            # fork every worker before any dispatcher thread exists
+            self.workers = [self._spawn(i) for i in range(self.processes)]
+            self.dispatchers = [
+                threading.Thread(target=self._dispatch, args=(i, source, sink), daemon=True) for i in range(self.processes)
+            ]
+        for t in self.dispatchers:
+            t.start()
+
+    def _dispatch_local(self, source, sink):
+        warmup(self.model, "Model")
+        while True:
+            batch = source()
+            if batch is None:
+                return
+            started = time.monotonic()
+            try:
+                outcomes, predict_ms = predict(self.model, [job.img for job in batch])
+            except Exception as e:
+                sink(batch, None, started, str(e))
+                continue
+            sink(batch, outcomes, started, predict_ms)
+
+    def _dispatch(self, index, source, sink):
+        proc, conn = self.workers[index]
+        while True:
+            batch = source()
+            if batch is None:
+                if not self.failed:
+                    conn.send(None)
+                return
+            started = time.monotonic()
+            if self.failed:
+                sink(batch, None, started, self.failed)
+                continue
+            try:
+                conn.send([job.img for job in batch])
+                outcomes, predict_ms = conn.recv()
+            except (EOFError, OSError):
+                proc.join(timeout=1)
+                self._shutdown(f"inference worker {index} died (exit code {proc.exitcode}), restart the server")
+                outcomes, predict_ms = None, self.failed
+            sink(batch, outcomes, started, predict_ms)
+
+    def _shutdown(self, reason):
+        """Stops every worker process after one died, see the module docstring."""
+        with self.lock:
+            if self.failed:
+                return
+            self.failed = reason
+        print(f"❌ {reason}")
+        for proc, _ in self.workers:
+            proc.terminate()
+
+    def join(self):
+        for t in self.dispatchers:
+            t.join()
+        for proc, conn in self.workers:
+            proc.join(timeout=5)
+            conn.close()
+        self.workers = []
@@ -0,0 +1,96 @@
+"""Upload preprocessing for ai_server.py: reduced decode, bowl crop, letterbox.
+
+A UXGA upload decoded at full size is 1600x1200, which YOLO then shrinks to
+its 640 input again. Instead, the JPEG header is read first and the frame is
+decoded at the largest DCT reduction (1/2, 1/4, 1/8, cv2.IMREAD_REDUCED_*)
+that still leaves the bowl region at least as large as the model input.
+That region is resized straight into the gray-padded model input, one
+resize and no intermediate copies, so YOLO's own letterbox has nothing left
+to do.
+
+The bowl region is x,y,w,h in 1/1000 of the frame, the same convention as
+bowl_classifier.py --crop.
+"""
+import cv2
+import numpy as np
+
+PAD_VALUE = 114  # gray the Ultralytics letterbox pads with
+
+REDUCED_DECODES = [
+    (8, cv2.IMREAD_REDUCED_COLOR_8),
+    (4, cv2.IMREAD_REDUCED_COLOR_4),
+    (2, cv2.IMREAD_REDUCED_COLOR_2),
+    (1, cv2.IMREAD_COLOR),
+]
+
+
+def parse_roi(text):
+    """"x,y,w,h" in 1/1000 of the frame, None for the whole frame."""
+    if not text:
+        return None
+    roi = tuple(int(v) for v in text.split(","))
+    if len(roi) != 4 or roi[2] <= 0 or roi[3] <= 0 or roi[0] + roi[2] > 1000 or roi[1] + roi[3] > 1000:
+        raise ValueError(f"bad region '{text}', expected x,y,w,h in 1/1000 of the frame")
+    return roi
+
+
+def jpeg_size(buf):
+    """(width, height) from the SOF marker, without decoding."""
+    i = 2
+    n = len(buf)
+    if n < 4 or buf[0] != 0xFF or buf[1] != 0xD8:
+        return None
+    while i + 9 <= n and buf[i] == 0xFF:
+        marker = buf[i + 1]
+        if marker == 0xFF:
+            i += 1
+            continue
+        if 0xC0 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC):
+            return (buf[i + 7] << 8) | buf[i + 8], (buf[i + 5] << 8) | buf[i + 6]
+        if marker == 0xDA:
+            break
+        i += 2 + ((buf[i + 2] << 8) | buf[i + 3])
+    return None
+
+
+def region(width, height, roi):
+    if roi is None:
+        return 0, 0, width, height
+    x, y, w, h = roi
+    return width * x // 1000, height * y // 1000, max(1, width * w // 1000), max(1, height * h // 1000)
+
+
+def pick_reduction(width, height, roi, size):
+    """Largest reduction that does not make the letterbox upscale the region."""
+    _, _, rw, rh = region(width, height, roi)
+    for factor, flag in REDUCED_DECODES:
+        if max(rw, rh) // factor >= size:
+            return factor, flag
+    return REDUCED_DECODES[-1]
+
+
+def letterbox(img, size):
+    """Resize into a size x size gray canvas, keeping the aspect ratio."""
+    h, w = img.shape[:2]
+    r = min(size / h, size / w)
+    nh, nw = max(1, round(h * r)), max(1, round(w * r))
+    out = np.full((size, size, 3), PAD_VALUE, np.uint8)
+    top, left = (size - nh) // 2, (size - nw) // 2
+    interp = cv2.INTER_AREA if r < 1 else cv2.INTER_LINEAR
+    cv2.resize(img, (nw, nh), dst=out[top:top + nh, left:left + nw], interpolation=interp)
+    return out
+
+
+def preprocess(buf, roi, size):
+    """JPEG bytes -> size x size BGR model input, and the decode reduction.
+
+    Returns (None, 0) when the data is not a decodable image.
+    """
+    npbuf = np.frombuffer(buf, np.uint8)
+    dims = jpeg_size(buf)
+    factor, flag = pick_reduction(*dims, roi, size) if dims else REDUCED_DECODES[-1]
+    img = cv2.imdecode(npbuf, flag)
+    if img is None:
+        return None, 0
+    x, y, w, h = region(img.shape[1], img.shape[0], roi)
+    return letterbox(img[y:y + h, x:x + w], size), factor
@@ -0,0 +1,108 @@
+"""Round trip of the flash blob through the camera's loader.
+
+bowl_model_load() refuses sections that are not 4-byte aligned or run past
+the blob, so a model whose weight counts are not multiples of 4 is the case
+write_blob() has to pad. Builds CameraProud/host/bowl_classify_host with the
+device sources and checks it loads such a blob and classifies like infer_q().
+
+    python -m unittest test_bowl_classifier
+"""
+import os
+import shutil
+import subprocess
+import tempfile
+import unittest
+
+import cv2
+import numpy as np
+
+import bowl_classifier as bc
+
+CAMERA_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "CameraProud")
+
+
+def odd_model(rng, in_w, in_h, hidden):
+    """Random quantized model, w1 and w2 sizes deliberately not multiples of 4."""
+    n = in_w * in_h
+    return {
+        "w1": rng.integers(-127, 128, (hidden, n), dtype=np.int8),
+        "b1": rng.integers(-2000, 2000, hidden).astype(np.int32),
+        "w2": rng.integers(-127, 128, (len(bc.CLASSES), hidden), dtype=np.int8),
+        "b2": rng.integers(-2000, 2000, len(bc.CLASSES)).astype(np.int32),
+        "l1_mult": 1 << 20,
+        "l1_shift": 30,
+        "out_scale": 0.05,
+    }
+
+
+def section_ok(header_size, total, off, length):
+    """Same check as section_ok() in bowl_classifier.cpp."""
+    return off & 3 == 0 and off >= header_size and off + length <= total
+
+
+class BlobRoundTrip(unittest.TestCase):
+    IN_W, IN_H, HIDDEN = 15, 15, 3  # w1 is 675 bytes, w2 9
+    CROP = (100, 100, 800, 800)
+
+    def setUp(self):
+        self.tmp = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmp, "bowl_model.bin")
+        self.q = odd_model(np.random.default_rng(1), self.IN_W, self.IN_H, self.HIDDEN)
+        self.size = bc.write_blob(self.path, self.q, self.IN_W, self.IN_H, self.CROP)
+
+    def tearDown(self):
+        shutil.rmtree(self.tmp)
+
+    def test_sections_aligned(self):
+        with open(self.path, "rb") as f:
+            blob = f.read()
+        fields = bc.HEADER.unpack_from(blob)
+        header_size, total = fields[2], fields[3]
+        w1_off, b1_off, w2_off, b2_off = fields[-4:]
+        n, classes = self.IN_W * self.IN_H, len(bc.CLASSES)
+        self.assertEqual(total, len(blob))
+        self.assertTrue(section_ok(header_size, total, w1_off, n * self.HIDDEN))
+        self.assertTrue(section_ok(header_size, total, b1_off, self.HIDDEN * 4))
+        self.assertTrue(section_ok(header_size, total, w2_off, classes * self.HIDDEN))
+        self.assertTrue(section_ok(header_size, total, b2_off, classes * 4))
+
+    def test_read_back(self):
+        q, in_w, in_h, crop = bc.read_blob(self.path)
+        self.assertEqual((in_w, in_h, crop), (self.IN_W, self.IN_H, self.CROP))
+        for key in ("w1", "b1", "w2", "b2"):
+            np.testing.assert_array_equal(q[key], self.q[key])
+
+    @unittest.skipUnless(shutil.which("g++"), "needs g++ to build the host classifier")
+    def test_device_loader(self):
+        exe = os.path.join(self.tmp, "bowl_classify_host")
+        subprocess.run(["g++", "-O2", "-I" + CAMERA_DIR, "-o", exe,
+                        os.path.join(CAMERA_DIR, "host", "bowl_classify_host.cpp"),
+                        os.path.join(CAMERA_DIR, "bowl_classifier.cpp")], check=True)
+
+        rng = np.random.default_rng(2)
+        expected = {}
+        with open(os.path.join(self.tmp, "manifest.txt"), "w") as f:
+            for i in range(8):
+                luma = rng.integers(0, 256, (120, 160), dtype=np.uint8)
+                name = f"frame{i}.pgm"
+                cv2.imwrite(os.path.join(self.tmp, name), luma)
+                f.write(f"normal {name}\n")
+                x = bc.preprocess(luma, self.CROP, self.IN_W, self.IN_H)
+                expected[name] = bc.infer_q(self.q, x)
+
+        out = subprocess.run([exe, self.path, os.path.join(self.tmp, "manifest.txt")],
+                             capture_output=True, text=True)
+        self.assertEqual(out.returncode, 0, out.stderr)
+        seen = 0
+        for line in out.stdout.splitlines():
+            parts = line.split()
+            if len(parts) == 4 and parts[0] in expected:
+                label, conf = expected[parts[0]]
+                self.assertEqual(parts[2], bc.CLASSES[label])
+                self.assertAlmostEqual(float(parts[3]), conf, places=3)
+                seen += 1
+        self.assertEqual(seen, len(expected))
+
+
+if __name__ == "__main__":
+    unittest.main()
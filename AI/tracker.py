@@ -0,0 +1,202 @@
+"""Detector-plus-tracker mode for ai_server.py.
+
+A cage camera looks at the same bowl all day, yet every frame used to go
+through the full detector just to find it again. With AI_TRACK_EVERY=N the
+detector runs on one frame in N, and on any frame the tracker is not sure
+about. In between, for every box of the last detection:
+
+  * the box is followed by template matching on a 1/4 scale grayscale copy
+    of the model input, in a window around where it last was. The bowl
+    barely moves, so there is no scale search, and the template is only
+    replaced by the next detection so it cannot drift;
+  * the tracked crop is classified by normalized correlation against crops
+    the detector itself labelled on this camera, the few latest per class.
+
+A frame goes back to the detector when a box is lost, when the crop does
+not clearly look like one labelled class, or when it looks like another
+class than the detector last gave that box. A tipped bowl does not look
+like the normal one it was tracked as, so the frame it tips on is detected
+in full and the alert comes from the detector, as without tracking.
+
+Boxes are x1,y1,x2,y2 in model input pixels, as summarize() reports them.
+"""
+import math
+import threading
+import time
+from collections import deque
+
+import cv2
+import numpy as np
+
+TRACK_SCALE = 4           # template matching at 1/4 of the model input
+TRACK_SEARCH = 0.5        # search window margin, in box sizes
+TRACK_MIN_SCORE = 0.7     # TM_CCOEFF_NORMED below this: box lost
+TRACK_MIN_SIZE = 6        # smallest template side at track scale
+FEATURE_SIZE = 24         # crops are compared at 24x24
+FEATURE_CONTEXT = 1.2     # crop side, in the box's longer side
+EXEMPLARS_PER_CLASS = 4   # latest detector crops kept per class
+CLASSIFY_MIN_SCORE = 0.8  # correlation with the best class
+CLASSIFY_MARGIN = 0.05    # ahead of the next class by at least this much
+LATENCY_WINDOW = 500
+
+REASONS = ["no_track", "scheduled", "lost", "unsure", "changed"]
+
+
+def status_of(detections):
+    """Same rule as inference_pool.summarize(): tipped > normal > not_found."""
+    classes = [d["class"] for d in detections]
+    if "tipped" in classes:
+        return "tipped"
+    return "normal" if classes else "not_found"
+
+
+def _planes(img):
+    gray = cv2.cvtColor(img, cv2.COLOR_BGR2GRAY)
+    small = cv2.resize(gray, (gray.shape[1] // TRACK_SCALE, gray.shape[0] // TRACK_SCALE), interpolation=cv2.INTER_AREA)
+    return gray, small
+
+
+def _feature(gray, box):
+    """Zero-mean, unit-norm 24x24 square around the box, None if it is empty
+    or flat. Square so that the outline (upright or on its side) counts."""
+    h, w = gray.shape
+    half = max(box[2] - box[0], box[3] - box[1]) * FEATURE_CONTEXT / 2
+    cx, cy = (box[0] + box[2]) / 2, (box[1] + box[3]) / 2
+    x1, y1 = max(0, int(cx - half)), max(0, int(cy - half))
+    x2, y2 = min(w, int(math.ceil(cx + half))), min(h, int(math.ceil(cy + half)))
+    if x2 - x1 < 2 or y2 - y1 < 2:
+        return None
+    f = cv2.resize(gray[y1:y2, x1:x2], (FEATURE_SIZE, FEATURE_SIZE), interpolation=cv2.INTER_AREA)
+    f = f.astype(np.float32).ravel()
+    f -= f.mean()
+    n = float(np.linalg.norm(f))
+    return f / n if n > 1e-3 else None
+
+
+class _Track:
+    def __init__(self, cls, box, small):
+        self.cls = cls
+        self.box = list(box)
+        self.origin = list(box)
+        x1, y1 = int(box[0]) // TRACK_SCALE, int(box[1]) // TRACK_SCALE
+        x2, y2 = int(math.ceil(box[2] / TRACK_SCALE)), int(math.ceil(box[3] / TRACK_SCALE))
+        self.corner = (x1, y1)  # template top-left when it was cut
+        self.template = small[y1:y2, x1:x2].copy()
+        # too small or featureless to match: every frame goes to the detector
+        if min(self.template.shape) < TRACK_MIN_SIZE or self.template.std() < 1.0:
+            self.template = None
+
+    def follow(self, small):
+        """New box and match score, box None when it is lost."""
+        if self.template is None:
+            return None, 0.0
+        th, tw = self.template.shape
+        x1, y1, x2, y2 = (v / TRACK_SCALE for v in self.box)
+        mx, my = (x2 - x1) * TRACK_SEARCH, (y2 - y1) * TRACK_SEARCH
+        sx1, sy1 = max(0, int(x1 - mx)), max(0, int(y1 - my))
+        sx2, sy2 = min(small.shape[1], int(math.ceil(x2 + mx))), min(small.shape[0], int(math.ceil(y2 + my)))
+        window = small[sy1:sy2, sx1:sx2]
+        if window.shape[0] < th or window.shape[1] < tw:
+            return None, 0.0
+        res = cv2.matchTemplate(window, self.template, cv2.TM_CCOEFF_NORMED)
+        _, score, _, loc = cv2.minMaxLoc(res)
+        if not score >= TRACK_MIN_SCORE:  # also catches NaN
+            return None, score
+        dx = (sx1 + loc[0] - self.corner[0]) * TRACK_SCALE
+        dy = (sy1 + loc[1] - self.corner[1]) * TRACK_SCALE
+        o = self.origin
+        return [o[0] + dx, o[1] + dy, o[2] + dx, o[3] + dy], score
+
+
+class _Camera:
+    def __init__(self):
+        self.tracks = []
+        self.exemplars = {}  # class -> deque of _feature()
+        self.since_detect = 0
+
+    def classify(self, f):
+        """(class, correlation), class None when no class is clearly best."""
+        if f is None or not self.exemplars:
+            return None, 0.0
+        scores = sorted(((max(float(e @ f) for e in ex), cls) for cls, ex in self.exemplars.items()), reverse=True)
+        best, label = scores[0]
+        if best < CLASSIFY_MIN_SCORE or (len(scores) > 1 and best - scores[1][0] < CLASSIFY_MARGIN):
+            return None, best
+        return label, best
+
+
+class BowlTracker:
+    def __init__(self, detect_every):
+        self.detect_every = detect_every
+        self.lock = threading.Lock()
+        self.cameras = {}
+        self.tracked = 0
+        self.detect = dict.fromkeys(REASONS, 0)  # frames sent to the detector, by reason
+        self.track_ms = deque(maxlen=LATENCY_WINDOW)
+
+    def track(self, camera, img):
+        """Tracked detections for this frame, or None if it needs the detector."""
+        start = time.monotonic()
+        gray, small = _planes(img)
+        with self.lock:
+            cam = self.cameras.get(camera)
+            reason = None
+            if cam is None or not cam.tracks:
+                reason = "no_track"
+            elif cam.since_detect + 1 >= self.detect_every:
+                reason = "scheduled"
+            else:
+                detections, boxes = [], []
+                for t in cam.tracks:
+                    box, score = t.follow(small)
+                    if box is None:
+                        reason = "lost"
+                        break
+                    label, sim = cam.classify(_feature(gray, box))
+                    if label is None:
+                        reason = "unsure"
+                        break
+                    if label != t.cls:
+                        reason = "changed"
+                        break
+                    boxes.append(box)
+                    detections.append({"class": label, "conf": round(sim, 3), "box": [round(v, 1) for v in box],
+                                       "track": round(score, 3)})
+            self.track_ms.append((time.monotonic() - start) * 1000)
+            if reason is not None:
+                self.detect[reason] += 1
+                if cam is not None:
+                    # a detection is on its way, do not schedule another one meanwhile
+                    cam.since_detect = 0
+                return None
+            for t, box in zip(cam.tracks, boxes):
+                t.box = box
+            cam.since_detect += 1
+            self.tracked += 1
+            return detections
+
+    def detected(self, camera, img, detections):
+        """Restart tracking from a detector result on img."""
+        gray, small = _planes(img)
+        tracks = [_Track(d["class"], d["box"], small) for d in detections]
+        features = [(d["class"], _feature(gray, d["box"])) for d in detections]
+        with self.lock:
+            cam = self.cameras.setdefault(camera, _Camera())
+            cam.tracks = tracks
+            cam.since_detect = 0
+            for cls, f in features:
+                if f is not None:
+                    cam.exemplars.setdefault(cls, deque(maxlen=EXEMPLARS_PER_CLASS)).append(f)
+
+    def snapshot(self):
+        with self.lock:
+            frames = self.tracked + sum(self.detect.values())
+            ms = sorted(self.track_ms)
+            return {
+                "detect_every": self.detect_every,
+                "tracked": self.tracked,
+                "detected": dict(self.detect),
+                "tracked_rate": round(self.tracked / frames, 3) if frames else 0,
+                "track_ms_avg": round(sum(ms) / len(ms), 2) if ms else 0,
+                "track_ms_p95": round(ms[min(len(ms) - 1, int(len(ms) * 0.95))], 2) if ms else 0,
+            }
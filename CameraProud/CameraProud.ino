@@ -1,5 +1,15 @@
 #include "esp_camera.h"
 #include <WiFi.h>
+#include <PubSubClient.h>
+#include "bowl_classifier.h"
+#include "img_luma.h"
+#include "camera_roi.h"
+#include "uploader.h"
+#include "frame_ring.h"
+#include "analytics_frame.h"
+#include "jpg_pool.h"
+#include "scene_stats.h"
+#include "perf_metrics.h"
 
 // ===========================
 // Select camera model in board_config.h
@@ -12,9 +22,283 @@
 const char *ssid = "yada";
 const char *password = "proudppp";
 
+// ===========================
+// NETPIE device of the camera, leave the client id empty to disable MQTT
+// ===========================
+const char *mqtt_server = "mqtt.netpie.io";
+const int mqtt_port = 1883;
+const char *netpie_client_id = "";
+const char *netpie_token = "";
+const char *netpie_secret = "";
+
+// ===========================
+// On-device bowl classifier, weights are read from the "fr" partition
+// ===========================
+#define BOWL_TOPIC_STATUS        "@msg/status"
+#define GATEWAY_TOPIC_FED        "@msg/gateway/fed"
+#define CAMERA_TOPIC_CLIP        "@msg/camera/clip"
+#define BOWL_CLASSIFY_INTERVAL   2000   // ms between two classifications
+#define BOWL_REPUBLISH_INTERVAL  60000  // publish an unchanged state this often
+#define BOWL_MIN_CONFIDENCE      0.6f
+#define BOWL_DECODE_MIN_WIDTH    160    // smallest luma width the JPEG is decoded to
+
+// ===========================
+// Periodic upload to AI/ai_server.py, leave the host empty to disable.
+// The region is picked at run time with /roi?upload=<name> and kept in NVS.
+// Frames go as raw JPEG over one kept-alive connection, the server tells
+// cameras apart by their MAC address. ?async=1 has the server answer as soon
+// as the frame is queued; the result goes out over NETPIE.
+// ===========================
+const char *ai_server_host = "";
+const uint16_t ai_server_port = 5001;
+const char *ai_server_path = "/upload/raw?async=1";
+#define UPLOAD_INTERVAL          5000   // ms between two uploads
+
+// ===========================
+// Scene brightness per region for the gateway's light alerts and feeding
+// trigger, from the JPEG DC coefficients of one frame per message
+// ===========================
+#define CAMERA_TOPIC_SCENE       "@msg/camera/scene"
+#define SCENE_PUBLISH_INTERVAL   10000  // ms
+#define MQTT_BUFFER_SIZE         512    // the scene message does not fit PubSubClient's default 256
+
+WiFiClient mqttNet;
+PubSubClient mqtt(mqttNet);
+unsigned long lastMqttAttempt = 0;
+
+bowl_model_t bowl_model;
+uint8_t *bowl_luma = NULL;
+size_t bowl_luma_len = 0;
+unsigned long lastClassify = 0;
+unsigned long lastBowlPublish = 0;
+int lastBowlState = -1;
+unsigned long lastUpload = 0;
+String cameraId;
+unsigned long lastScenePublish = 0;
+
 void startCameraServer();
 void setupLedFlash();
 
+// Without a region the analytics frame is uploaded, re-encoded from its
+// RGB565 plane, so the detector gets a small image whatever the viewing size.
+static int uploadAnalytics(size_t *len) {
+  analytics_frame_t af;
+  if (!analytics_get(0, &af, pdMS_TO_TICKS(1000))) {
+    return -1;
+  }
+  camera_fb_t fb = {};
+  fb.buf = (uint8_t *)af.rgb565;
+  fb.len = (size_t)af.width * af.height * 2;
+  fb.width = af.width;
+  fb.height = af.height;
+  fb.format = PIXFORMAT_RGB565;
+  jpg_buf_t jpg;
+  bool ok = jpg_pool_encode(&fb, JPG_POOL_QUALITY, &jpg);
+  analytics_release(&af);
+  if (!ok) {
+    return -1;
+  }
+  *len = jpg.len;
+  int status = upload_jpeg_raw(ai_server_host, ai_server_port, ai_server_path, cameraId.c_str(), jpg.buf, jpg.len);
+  jpg_pool_release(&jpg);
+  return status;
+}
+
+void uploadFrame() {
+  const char *roi = roi_upload_name();
+  int64_t start = esp_timer_get_time();
+  size_t len = 0;
+  int status;
+  if (!roi[0] && analytics_enabled()) {
+    status = uploadAnalytics(&len);
+  } else if (!roi[0] && frame_ring_enabled()) {
+    // the capture task owns the driver, upload its newest frame
+    ring_frame_t frame;
+    if (!frame_ring_latest(0, &frame, pdMS_TO_TICKS(1000))) {
+      Serial.println("Upload: no ring frame");
+      return;
+    }
+    len = frame.len;
+    status = upload_jpeg_raw(ai_server_host, ai_server_port, ai_server_path, cameraId.c_str(), frame.buf, frame.len);
+    frame_ring_release(&frame);
+  } else {
+    camera_fb_t *fb = roi[0] ? roi_capture(roi) : esp_camera_fb_get();
+    if (!fb) {
+      Serial.println("Upload: camera capture failed");
+      return;
+    }
+    if (fb->format != PIXFORMAT_JPEG) {
+      esp_camera_fb_return(fb);
+      return;
+    }
+    len = fb->len;
+    status = upload_jpeg_raw(ai_server_host, ai_server_port, ai_server_path, cameraId.c_str(), fb->buf, fb->len);
+    esp_camera_fb_return(fb);
+  }
+  // status and Server-Timing belong to the previous upload, answered while this one was sent
+  Serial.printf(
+    "Upload: %uB (roi '%s') in %ums, previous -> %d [%s]\n", len, roi, (uint32_t)((esp_timer_get_time() - start) / 1000), status, upload_server_timing()
+  );
+}
+
+// Feeding, a tipped bowl or an explicit request hold a pre/post-event clip in
+// the frame ring, exported from http://<camera>:81/clip
+void mqttCallback(char *topic, byte *payload, unsigned int length) {
+  bool fed = !strcmp(topic, GATEWAY_TOPIC_FED) && length == 1 && payload[0] == '1';
+  bool tipped = !strcmp(topic, BOWL_TOPIC_STATUS) && length == 6 && !memcmp(payload, "tipped", 6);
+  if (fed || tipped || !strcmp(topic, CAMERA_TOPIC_CLIP)) {
+    if (frame_ring_hold(RING_CLIP_PRE_MS, RING_CLIP_POST_MS, RING_CLIP_KEEP_MS)) {
+      Serial.printf("Clip held on %s\n", topic);
+    }
+  }
+}
+
+void reconnectMQTT() {
+  // never block the loop, retry every 5 seconds
+  if (millis() - lastMqttAttempt < 5000) {
+    return;
+  }
+  lastMqttAttempt = millis();
+  Serial.println("Connecting NETPIE...");
+  if (mqtt.connect(netpie_client_id, netpie_token, netpie_secret)) {
+    Serial.println("NETPIE Connected");
+    mqtt.subscribe(GATEWAY_TOPIC_FED);
+    mqtt.subscribe(BOWL_TOPIC_STATUS);
+    mqtt.subscribe(CAMERA_TOPIC_CLIP);
+  } else {
+    Serial.printf("NETPIE connect failed, state = %d\n", mqtt.state());
+  }
+}
+
+// Decodes a JPEG at the scale AI/bowl_classifier.py trains on, the model
+// expects that resolution (an analytics frame is at least twice as wide).
+static bool decodeBowlLuma(const uint8_t *buf, size_t len, uint16_t width, uint16_t height, uint16_t *w, uint16_t *h) {
+  jpg_scale_t scale = luma_pick_scale(width, BOWL_DECODE_MIN_WIDTH);
+  size_t need = (size_t)(width >> scale) * (height >> scale);
+  if (need > bowl_luma_len) {
+    free(bowl_luma);
+    bowl_luma = (uint8_t *)(psramFound() ? ps_malloc(need) : malloc(need));
+    bowl_luma_len = bowl_luma ? need : 0;
+  }
+  return bowl_luma && jpg2luma(buf, len, scale, bowl_luma, bowl_luma_len, w, h);
+}
+
+void classifyBowl() {
+  int64_t start = esp_timer_get_time();
+  const uint8_t *luma = NULL;
+  uint16_t w = 0, h = 0;
+  camera_fb_t *fb = NULL;
+  ring_frame_t frame;
+  bool ring = frame_ring_enabled();
+
+  if (ring) {
+    // the capture task owns the driver, the newest ring frame is the same one
+    if (!frame_ring_latest(0, &frame, pdMS_TO_TICKS(1000))) {
+      Serial.println("Bowl: no ring frame");
+      return;
+    }
+    if (decodeBowlLuma(frame.buf, frame.len, frame.width, frame.height, &w, &h)) {
+      luma = bowl_luma;
+    }
+  } else {
+    fb = esp_camera_fb_get();
+    if (!fb) {
+      Serial.println("Bowl: camera capture failed");
+      return;
+    }
+    if (fb->format == PIXFORMAT_GRAYSCALE) {
+      luma = fb->buf;
+      w = fb->width;
+      h = fb->height;
+    } else if (fb->format == PIXFORMAT_JPEG && decodeBowlLuma(fb->buf, fb->len, fb->width, fb->height, &w, &h)) {
+      luma = bowl_luma;
+    }
+  }
+
+  bowl_result_t r;
+  bool ok = luma && bowl_classify(&bowl_model, luma, w, h, &r);
+  if (ring) {
+    frame_ring_release(&frame);
+  } else {
+    esp_camera_fb_return(fb);
+  }
+  if (!ok) {
+    Serial.println("Bowl: unsupported frame");
+    return;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  Serial.printf("Bowl: %s (%.2f) on %ux%u in %ums\n", bowl_class_name(r.label), r.confidence, w, h, (uint32_t)(elapsed / 1000));
+
+  if (r.confidence < BOWL_MIN_CONFIDENCE) {
+    return;
+  }
+  if (r.label == lastBowlState && millis() - lastBowlPublish < BOWL_REPUBLISH_INTERVAL) {
+    return;
+  }
+  if (mqtt.connected() && mqtt.publish(BOWL_TOPIC_STATUS, bowl_class_name(r.label))) {
+    lastBowlState = r.label;
+    lastBowlPublish = millis();
+  }
+}
+
+static bool sceneFromJpeg(const uint8_t *buf, size_t len, scene_stats_t *stats) {
+  int64_t start = esp_timer_get_time();
+  bool ok = scene_stats_from_jpeg(buf, len, stats);
+  metrics_record(METRIC_SCENE_US, esp_timer_get_time() - start);
+  return ok;
+}
+
+// Exposure and gain the sensor's AEC/AGC is running at, in sensor units
+// (status.aec_value and agc_gain only hold the manual settings)
+static void readExposure(sensor_t *s, int *aec, int *agc) {
+  *aec = -1;
+  *agc = -1;
+  if (s->id.PID == OV2640_PID) {
+    // sensor bank: AEC[15:10] in REG45, AEC[9:2] in AEC, AEC[1:0] in REG04
+    int hi = s->get_reg(s, 0x145, 0x3F), mid = s->get_reg(s, 0x110, 0xFF), lo = s->get_reg(s, 0x104, 0x03);
+    if (hi >= 0 && mid >= 0 && lo >= 0) {
+      *aec = (hi << 10) | (mid << 2) | lo;
+    }
+    *agc = s->get_reg(s, 0x100, 0xFF);
+  } else if (s->id.PID == OV3660_PID || s->id.PID == OV5640_PID) {
+    // exposure in lines, gain in 1/16
+    int hi = s->get_reg(s, 0x3500, 0x0F), mid = s->get_reg(s, 0x3501, 0xFF), lo = s->get_reg(s, 0x3502, 0xF0);
+    if (hi >= 0 && mid >= 0 && lo >= 0) {
+      *aec = (hi << 12) | (mid << 4) | (lo >> 4);
+    }
+    int gain_hi = s->get_reg(s, 0x350A, 0x03), gain_lo = s->get_reg(s, 0x350B, 0xFF);
+    if (gain_hi >= 0 && gain_lo >= 0) {
+      *agc = (gain_hi << 8) | gain_lo;
+    }
+  }
+}
+
+void publishScene() {
+  scene_stats_t stats;
+  bool ok = false;
+  if (frame_ring_enabled()) {
+    ring_frame_t frame;
+    if (frame_ring_latest(0, &frame, pdMS_TO_TICKS(1000))) {
+      ok = sceneFromJpeg(frame.buf, frame.len, &stats);
+      frame_ring_release(&frame);
+    }
+  } else {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb) {
+      ok = fb->format == PIXFORMAT_JPEG && sceneFromJpeg(fb->buf, fb->len, &stats);
+      esp_camera_fb_return(fb);
+    }
+  }
+  if (!ok) {
+    Serial.println("Scene: no baseline JPEG frame");
+    return;
+  }
+  readExposure(esp_camera_sensor_get(), &stats.aec, &stats.agc);
+  char json[320];
+  scene_stats_json(&stats, json, sizeof(json));
+  mqtt.publish(CAMERA_TOPIC_SCENE, json);
+}
+
 void setup() {
   Serial.begin(115200);
   Serial.setDebugOutput(true);
@@ -80,6 +364,10 @@ void setup() {
     return;
   }
 
+  if (!bowl_model_load_partition(&bowl_model, "fr")) {
+    Serial.println("Bowl classifier disabled, no model in the 'fr' partition");
+  }
+
   sensor_t *s = esp_camera_sensor_get();
   // initial sensors are flipped vertically and colors are a bit saturated
   if (s->id.PID == OV3660_PID) {
@@ -87,9 +375,11 @@ void setup() {
     s->set_brightness(s, 1);   // up the brightness just a bit
     s->set_saturation(s, -2);  // lower the saturation
   }
-  // drop down frame size for higher initial frame rate
+  // drop down frame size for higher initial frame rate. With PSRAM the
+  // analytics frame is derived from the stream, so the stream keeps a viewing
+  // size instead of dropping to QVGA for the detectors.
   if (config.pixel_format == PIXFORMAT_JPEG) {
-    s->set_framesize(s, FRAMESIZE_QVGA);
+    s->set_framesize(s, psramFound() ? FRAMESIZE_SVGA : FRAMESIZE_QVGA);
   }
 
 #if defined(CAMERA_MODEL_M5STACK_WIDE) || defined(CAMERA_MODEL_M5STACK_ESP32CAM)
@@ -116,15 +406,41 @@ void setup() {
   }
   Serial.println("");
   Serial.println("WiFi connected");
+  cameraId = WiFi.macAddress();
 
   startCameraServer();
 
+  mqtt.setServer(mqtt_server, mqtt_port);
+  mqtt.setCallback(mqttCallback);
+  mqtt.setBufferSize(MQTT_BUFFER_SIZE);
+
   Serial.print("Camera Ready! Use 'http://");
   Serial.print(WiFi.localIP());
   Serial.println("' to connect");
 }
 
 void loop() {
-  // Do nothing. Everything is done in another task by the web server
-  delay(10000);
+  // The web server runs in its own tasks, the loop only serves MQTT and the classifier
+  if (netpie_client_id[0]) {
+    if (!mqtt.connected()) {
+      reconnectMQTT();
+    }
+    mqtt.loop();
+  }
+
+  if (mqtt.connected() && millis() - lastScenePublish >= SCENE_PUBLISH_INTERVAL) {
+    lastScenePublish = millis();
+    publishScene();
+  }
+
+  if (bowl_model.hdr && millis() - lastClassify >= BOWL_CLASSIFY_INTERVAL) {
+    lastClassify = millis();
+    classifyBowl();
+  }
+
+  if (ai_server_host[0] && WiFi.status() == WL_CONNECTED && millis() - lastUpload >= UPLOAD_INTERVAL) {
+    lastUpload = millis();
+    uploadFrame();
+  }
+  delay(10);
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp32-hal-log.h"
+#include "frame_ring.h"
+#include "img_luma.h"
+#include "analytics_frame.h"
+
+#define ANALYTICS_POLL_TICKS pdMS_TO_TICKS(5)
+
+typedef struct {
+  analytics_frame_t frame;
+  uint8_t *buf;     // luma plane followed by the RGB565 plane
+  size_t pixels;    // capacity
+  uint16_t refs;
+  bool ready;
+} analytics_slot_t;
+
+static analytics_slot_t slots[ANALYTICS_SLOTS];
+static int newest = -1;
+static SemaphoreHandle_t analytics_mutex = NULL;
+static TaskHandle_t task = NULL;
+
+bool analytics_enabled() {
+  return task != NULL;
+}
+
+static int mean_abs_diff(const uint8_t *a, const uint8_t *b, size_t n) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+  }
+  return sum / n;
+}
+
+// Called with the mutex held, returns a slot no reader holds.
+static int free_slot() {
+  for (int i = 0; i < ANALYTICS_SLOTS; i++) {
+    if (i != newest && !slots[i].refs) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool slot_reserve(analytics_slot_t *slot, size_t pixels) {
+  if (slot->pixels >= pixels) {
+    return true;
+  }
+  free(slot->buf);
+  slot->buf = (uint8_t *)heap_caps_malloc(pixels * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  slot->pixels = slot->buf ? pixels : 0;
+  return slot->buf != NULL;
+}
+
+static void analytics_task(void *arg) {
+  uint32_t last_seq = 0;
+  while (true) {
+    TickType_t start = xTaskGetTickCount();
+    ring_frame_t src;
+    if (!frame_ring_latest(last_seq, &src, pdMS_TO_TICKS(1000))) {
+      continue;
+    }
+    last_seq = src.seq;
+
+    xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+    int index = free_slot();
+    if (index >= 0) {
+      slots[index].ready = false;
+    }
+    xSemaphoreGive(analytics_mutex);
+    if (index < 0) {
+      frame_ring_release(&src);
+      vTaskDelay(ANALYTICS_POLL_TICKS);
+      continue;
+    }
+
+    analytics_slot_t *slot = &slots[index];
+    jpg_scale_t scale = luma_pick_scale(src.width, ANALYTICS_MIN_WIDTH);
+    size_t pixels = (size_t)(src.width >> scale) * (src.height >> scale);
+    uint16_t w = 0, h = 0;
+    bool ok = slot_reserve(slot, pixels) && jpg2luma_rgb565(src.buf, src.len, scale, slot->buf, slot->buf + slot->pixels, slot->pixels, &w, &h);
+    frame_ring_release(&src);
+    if (!ok) {
+      log_e("Analytics: decode of frame %u failed", src.seq);
+      continue;
+    }
+
+    analytics_frame_t *f = &slot->frame;
+    f->seq = src.seq;
+    f->timestamp = src.timestamp;
+    f->width = w;
+    f->height = h;
+    f->luma = slot->buf;
+    f->rgb565 = slot->buf + slot->pixels;
+    f->motion = -1;
+
+    xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+    // the previous frame is still in the newest slot, nobody writes there
+    if (newest >= 0 && slots[newest].ready && slots[newest].frame.width == w && slots[newest].frame.height == h) {
+      const uint8_t *prev = slots[newest].frame.luma;
+      xSemaphoreGive(analytics_mutex);
+      f->motion = mean_abs_diff(f->luma, prev, (size_t)w * h);
+      xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+    }
+    slot->ready = true;
+    newest = index;
+    xSemaphoreGive(analytics_mutex);
+
+    TickType_t spent = xTaskGetTickCount() - start;
+    if (spent < pdMS_TO_TICKS(ANALYTICS_INTERVAL_MS)) {
+      vTaskDelay(pdMS_TO_TICKS(ANALYTICS_INTERVAL_MS) - spent);
+    }
+  }
+}
+
+bool analytics_start(UBaseType_t priority, BaseType_t core) {
+  if (task) {
+    return true;
+  }
+  if (!frame_ring_enabled()) {
+    return false;
+  }
+  analytics_mutex = xSemaphoreCreateMutex();
+  return xTaskCreatePinnedToCore(analytics_task, "analytics", 4096, NULL, priority, &task, core) == pdPASS;
+}
+
+bool analytics_get(uint32_t after_seq, analytics_frame_t *frame, TickType_t wait) {
+  if (!task) {
+    return false;
+  }
+  TickType_t start = xTaskGetTickCount();
+  while (true) {
+    xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+    if (newest >= 0 && slots[newest].ready && slots[newest].frame.seq > after_seq) {
+      slots[newest].refs++;
+      *frame = slots[newest].frame;
+      xSemaphoreGive(analytics_mutex);
+      return true;
+    }
+    xSemaphoreGive(analytics_mutex);
+    if (xTaskGetTickCount() - start >= wait) {
+      return false;
+    }
+    vTaskDelay(ANALYTICS_POLL_TICKS);
+  }
+}
+
+void analytics_release(const analytics_frame_t *frame) {
+  xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+  for (int i = 0; i < ANALYTICS_SLOTS; i++) {
+    if (slots[i].frame.seq == frame->seq && slots[i].refs) {
+      slots[i].refs--;
+      break;
+    }
+  }
+  xSemaphoreGive(analytics_mutex);
+}
+
+int analytics_motion() {
+  if (!task) {
+    return -1;
+  }
+  xSemaphoreTake(analytics_mutex, portMAX_DELAY);
+  int motion = newest >= 0 ? slots[newest].frame.motion : -1;
+  xSemaphoreGive(analytics_mutex);
+  return motion;
+}
@@ -0,0 +1,43 @@
+#ifndef ANALYTICS_FRAME_H
+#define ANALYTICS_FRAME_H
+
+//
+// Low-resolution analytics frame derived from the viewing stream.
+//
+// The sensor stays at the viewing resolution. A task takes the newest ring
+// frame a few times per second and decodes it at a reduced DCT scale (no
+// full-size decode) into RGB565 and luma planes of at least
+// ANALYTICS_MIN_WIDTH pixels. Motion detection and the uploader read these
+// frames, so neither forces the sensor resolution. The bowl classifier decodes
+// the ring frame itself, at the smaller scale its model is trained on.
+//
+
+#include "freertos/FreeRTOS.h"
+
+#define ANALYTICS_MIN_WIDTH   320
+#define ANALYTICS_INTERVAL_MS 200  // at most 5 analytics frames per second
+#define ANALYTICS_SLOTS       2    // a reader may pin one while the next is decoded
+
+typedef struct {
+  uint32_t seq;           // ring seq of the source frame
+  int64_t timestamp;      // start of the source frame, esp_timer clock in us
+  uint16_t width;
+  uint16_t height;
+  const uint8_t *rgb565;  // big-endian, like the driver's RGB565 frames
+  const uint8_t *luma;
+  int motion;             // mean absolute luma difference to the previous frame, -1 if unknown
+} analytics_frame_t;
+
+// Starts the analytics task, needs the frame ring.
+bool analytics_start(UBaseType_t priority, BaseType_t core);
+bool analytics_enabled();
+
+// Pins the newest analytics frame built from a ring frame newer than
+// `after_seq`, waiting up to `wait` ticks.
+bool analytics_get(uint32_t after_seq, analytics_frame_t *frame, TickType_t wait);
+void analytics_release(const analytics_frame_t *frame);
+
+// Motion score of the newest analytics frame, -1 before there are two.
+int analytics_motion();
+
+#endif  // ANALYTICS_FRAME_H
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "esp_http_server.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_timer.h"
 #include "esp_camera.h"
 #include "img_converters.h"
@@ -20,6 +22,18 @@
 #include "sdkconfig.h"
 #include "camera_index.h"
 #include "board_config.h"
+#include "camera_roi.h"
+#include "frame_ring.h"
+#include "avi_recorder.h"
+#include "ws_channel.h"
+#include "perf_metrics.h"
+#include "flash_sync.h"
+#include "img_stream.h"
+#include "jpg_pool.h"
+#include "analytics_frame.h"
+#include "rtsp_server.h"
+#include "httpd_profile.h"
+#include "sensor_modes.h"
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -34,6 +48,28 @@ bool isStreaming = false;
 
 #endif
 
+// Pre-event frame ring, only enabled when PSRAM is found
+#define CONFIG_RING_BUDGET    (1536 * 1024)
+#define CONFIG_RING_WINDOW_MS 10000
+
+// /capture serves the newest ring frame when it is at most this old
+#define CONFIG_CAPTURE_MAX_AGE_MS 500
+
+// ?newer=<timestamp> long polls: how long to wait for a newer frame, and how
+// many polls may wait at once, each in its own waiter task so none waits
+// behind another. Each waiting poll holds a control server socket, so the
+// waiters are the HTTPD_LONGPOLL_SOCKETS of the HTTPD_CONTROL_SOCKETS budget
+// in httpd_profile.h; a poll while all of them are busy gets a 503.
+#define CONFIG_LONGPOLL_MS      10000
+#define CONFIG_LONGPOLL_WAITERS HTTPD_LONGPOLL_SOCKETS
+
+// RTSP/RTP (RFC 2435) alternative to /stream, served from the frame ring
+#define CONFIG_RTSP_PORT 554
+
+// Index into the profiles of httpd_profile.cpp, 1 = "pinned". The one stored
+// with /control?var=httpd_profile takes precedence.
+#define CONFIG_HTTPD_PROFILE 1
+
 typedef struct {
   httpd_req_t *req;
   size_t len;
@@ -43,144 +79,409 @@ typedef struct {
 static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
 static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
 static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
+static const char *_STREAM_END = "\r\n--" PART_BOUNDARY "--\r\n";
 
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
+static int httpd_profile = 0;
 
-typedef struct {
-  size_t size;   //number of values used for filtering
-  size_t index;  //current value index
-  size_t count;  //value count
-  int sum;
-  int *values;  //array to be filled with values
-} ra_filter_t;
+#if defined(LED_GPIO_NUM)
+void enable_led(bool en) {  // Turn LED On or Off
+  int duty = en ? led_duty : 0;
+  if (en && isStreaming && (led_duty > CONFIG_LED_MAX_INTENSITY)) {
+    duty = CONFIG_LED_MAX_INTENSITY;
+  }
+  ledcWrite(LED_GPIO_NUM, duty);
+  //ledc_set_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL, duty);
+  //ledc_update_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL);
+  log_i("Set LED intensity to %d", duty);
+}
+#endif
 
-static ra_filter_t ra_filter;
+static int parse_get_var(char *buf, const char *key, int def) {
+  char _int[16];
+  if (httpd_query_key_value(buf, key, _int, sizeof(_int)) != ESP_OK) {
+    return def;
+  }
+  return atoi(_int);
+}
 
-static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size) {
-  memset(filter, 0, sizeof(ra_filter_t));
+static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_t len) {
+  jpg_chunking_t *j = (jpg_chunking_t *)arg;
+  if (!index) {
+    j->len = 0;
+  }
+  if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) {
+    return 0;
+  }
+  j->len += len;
+  return len;
+}
+
+// `not_before` drops frames that started before it, see flash_acquire()
+static camera_fb_t *capture_frame(const char *roi, int64_t not_before) {
+  if (roi[0]) {
+    return roi_capture(roi, not_before);
+  }
+  if (not_before) {
+    return flash_fb_get(not_before);
+  }
+  int64_t start = esp_timer_get_time();
+  camera_fb_t *fb = esp_camera_fb_get();
+  metrics_record(METRIC_FB_GET_US, esp_timer_get_time() - start);
+  return fb;
+}
 
-  filter->values = (int *)malloc(sample_size * sizeof(int));
-  if (!filter->values) {
-    return NULL;
+typedef struct {
+  httpd_req_t *req;
+  esp_err_t (*handler)(httpd_req_t *req);
+} longpoll_t;
+
+static QueueHandle_t longpoll_queue = NULL;
+static SemaphoreHandle_t longpoll_free = NULL;  // counts idle waiters
+static TaskHandle_t longpoll_waiters[CONFIG_LONGPOLL_WAITERS];
+
+// The server has a single task, so long polls wait here on async copies of
+// their requests while /status and /control keep being served. A poll is
+// only queued once a waiter is known to be idle, so it is picked up at once.
+static void longpoll_task(void *arg) {
+  longpoll_t poll;
+  while (true) {
+    if (xQueueReceive(longpoll_queue, &poll, portMAX_DELAY) == pdTRUE) {
+      poll.handler(poll.req);
+      httpd_req_async_handler_complete(poll.req);
+      xSemaphoreGive(longpoll_free);
+    }
   }
-  memset(filter->values, 0, sample_size * sizeof(int));
+}
 
-  filter->size = sample_size;
-  return filter;
+static bool longpoll_running_here() {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < CONFIG_LONGPOLL_WAITERS; i++) {
+    if (longpoll_waiters[i] == self) {
+      return true;
+    }
+  }
+  return false;
 }
 
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-static int ra_filter_run(ra_filter_t *filter, int value) {
-  if (!filter->values) {
-    return value;
+// ESP_OK when the request was handed to a long-poll waiter, which calls
+// `handler` on it again; ESP_ERR_INVALID_STATE when already running there.
+static esp_err_t longpoll_defer(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *req)) {
+  if (longpoll_running_here()) {
+    return ESP_ERR_INVALID_STATE;
   }
-  filter->sum -= filter->values[filter->index];
-  filter->values[filter->index] = value;
-  filter->sum += filter->values[filter->index];
-  filter->index++;
-  filter->index = filter->index % filter->size;
-  if (filter->count < filter->size) {
-    filter->count++;
+  longpoll_t poll = {NULL, handler};
+  if (!longpoll_free || xSemaphoreTake(longpoll_free, 0) != pdTRUE) {
+    return ESP_FAIL;
   }
-  return filter->sum / filter->count;
+  if (httpd_req_async_handler_begin(req, &poll.req) != ESP_OK) {
+    xSemaphoreGive(longpoll_free);
+    return ESP_FAIL;
+  }
+  // cannot be full: there are as many slots as waiters
+  xQueueSend(longpoll_queue, &poll, portMAX_DELAY);
+  return ESP_OK;
 }
-#endif
 
-#if defined(LED_GPIO_NUM)
-void enable_led(bool en) {  // Turn LED On or Off
-  int duty = en ? led_duty : 0;
-  if (en && isStreaming && (led_duty > CONFIG_LED_MAX_INTENSITY)) {
-    duty = CONFIG_LED_MAX_INTENSITY;
+static int64_t parse_get_timestamp(char *buf, const char *key) {
+  char value[24];
+  if (httpd_query_key_value(buf, key, value, sizeof(value)) != ESP_OK) {
+    return 0;
   }
-  ledcWrite(LED_GPIO_NUM, duty);
-  //ledc_set_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL, duty);
-  //ledc_update_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL);
-  log_i("Set LED intensity to %d", duty);
+  return strtoll(value, NULL, 10);  // stops at an ETag's variant suffix
 }
-#endif
 
-static esp_err_t bmp_handler(httpd_req_t *req) {
+// A frame's ETag is its start timestamp in us plus the representation, so it
+// also works as the ?newer= value of the next long poll.
+static void frame_etag(char *etag, size_t len, int64_t timestamp, const char *variant) {
+  snprintf(etag, len, "\"%lld%s\"", timestamp, variant);
+}
+
+static bool etag_match(httpd_req_t *req, const char *etag) {
+  char value[64];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+    return false;
+  }
+  return !strcmp(value, "*") || strstr(value, etag);
+}
+
+static esp_err_t send_not_modified(httpd_req_t *req, const char *etag) {
+  httpd_resp_set_status(req, "304 Not Modified");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  if (etag) {
+    httpd_resp_set_hdr(req, "ETag", etag);
+  }
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t send_busy(httpd_req_t *req) {
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_hdr(req, "Retry-After", "1");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+// Decodes the newest frame straight into the response a band of rows at a
+// time, see img_stream.h. ?scale=0..3 reduces the size by 1 << scale.
+static esp_err_t image_stream(httpd_req_t *req, img_stream_format_t format, esp_err_t (*handler)(httpd_req_t *req)) {
   camera_fb_t *fb = NULL;
+  ring_frame_t frame;
+  bool pinned = false;
   esp_err_t res = ESP_OK;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  uint64_t fr_start = esp_timer_get_time();
-#endif
-  fb = esp_camera_fb_get();
-  if (!fb) {
+  int64_t fr_start = esp_timer_get_time();
+
+  int scale = JPG_SCALE_NONE;
+  int64_t newer = 0;
+  char query[64];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    scale = parse_get_var(query, "scale", JPG_SCALE_NONE);
+    if (scale < JPG_SCALE_NONE || scale > JPG_SCALE_8X) {
+      scale = JPG_SCALE_NONE;
+    }
+    newer = parse_get_timestamp(query, "newer");
+  }
+  if (newer) {
+    esp_err_t deferred = longpoll_defer(req, handler);
+    if (deferred == ESP_OK) {
+      return ESP_OK;
+    } else if (deferred != ESP_ERR_INVALID_STATE) {
+      return send_busy(req);
+    }
+  }
+
+  if (frame_ring_enabled()) {
+    pinned = newer ? frame_ring_since(newer + 1, &frame, pdMS_TO_TICKS(CONFIG_LONGPOLL_MS)) : frame_ring_latest(0, &frame, pdMS_TO_TICKS(1000));
+  } else {
+    fb = capture_frame("", newer ? newer + 1 : 0);
+  }
+  if (!fb && !pinned) {
+    if (newer) {
+      return send_not_modified(req, NULL);
+    }
     log_e("Camera capture failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
 
-  httpd_resp_set_type(req, "image/x-windows-bmp");
-  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  int64_t timestamp = pinned ? frame.timestamp : (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  char variant[12];
+  char etag[40];
+  snprintf(variant, sizeof(variant), "-%s%d", format == IMG_STREAM_BMP ? "bmp" : format == IMG_STREAM_RGB565 ? "rgb565" : "gray", scale);
+  frame_etag(etag, sizeof(etag), timestamp, variant);
+  if (timestamp <= newer || etag_match(req, etag)) {
+    if (pinned) {
+      frame_ring_release(&frame);
+    } else {
+      esp_camera_fb_return(fb);
+    }
+    return send_not_modified(req, etag);
+  }
 
+  uint16_t width = (pinned ? frame.width : fb->width) >> scale;
+  uint16_t height = (pinned ? frame.height : fb->height) >> scale;
   char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+  char w[8];
+  char h[8];
+  snprintf(ts, 32, "%lld.%06lld", timestamp / 1000000, timestamp % 1000000);
+  snprintf(w, 8, "%u", width);
+  snprintf(h, 8, "%u", height);
+
+  if (format == IMG_STREAM_BMP) {
+    httpd_resp_set_type(req, "image/x-windows-bmp");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
+  } else {
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "X-Format", format == IMG_STREAM_RGB565 ? "rgb565be" : "gray");
+  }
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "ETag, X-Timestamp, X-Width, X-Height, X-Format");
+  httpd_resp_set_hdr(req, "ETag", (const char *)etag);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
-
-  uint8_t *buf = NULL;
-  size_t buf_len = 0;
-  bool converted = frame2bmp(fb, &buf, &buf_len);
-  esp_camera_fb_return(fb);
+  httpd_resp_set_hdr(req, "X-Width", (const char *)w);
+  httpd_resp_set_hdr(req, "X-Height", (const char *)h);
+
+  jpg_chunking_t jchunk = {req, 0};
+  int64_t encode_start = esp_timer_get_time();
+  bool converted;
+  if (pinned) {
+    converted = jpg2stream(frame.buf, frame.len, (jpg_scale_t)scale, format, jpg_encode_stream, &jchunk, &width, &height);
+    frame_ring_release(&frame);
+  } else {
+    converted = frame2stream(fb, (jpg_scale_t)scale, format, jpg_encode_stream, &jchunk, &width, &height);
+    esp_camera_fb_return(fb);
+  }
+  // decode and send are interleaved, this is the time for both
+  metrics_record(METRIC_ENCODE_US, esp_timer_get_time() - encode_start);
   if (!converted) {
-    log_e("BMP Conversion failed");
-    httpd_resp_send_500(req);
-    return ESP_FAIL;
+    log_e("Stream conversion failed");
+    res = ESP_FAIL;
   }
-  res = httpd_resp_send(req, (const char *)buf, buf_len);
-  free(buf);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  uint64_t fr_end = esp_timer_get_time();
-#endif
-  log_i("BMP: %llums, %uB", (uint64_t)((fr_end - fr_start) / 1000), buf_len);
+  httpd_resp_send_chunk(req, NULL, 0);
+  log_i("IMG: %ux%u %uB %ums", width, height, jchunk.len, (uint32_t)((esp_timer_get_time() - fr_start) / 1000));
   return res;
 }
 
-static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_t len) {
-  jpg_chunking_t *j = (jpg_chunking_t *)arg;
-  if (!index) {
-    j->len = 0;
-  }
-  if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) {
-    return 0;
+static esp_err_t bmp_handler(httpd_req_t *req) {
+  return image_stream(req, IMG_STREAM_BMP, bmp_handler);
+}
+
+// Uncompressed pixels for analytics clients: ?format=gray (default) or rgb565
+static esp_err_t raw_handler(httpd_req_t *req) {
+  char query[48];
+  char format[8] = "";
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "format", format, sizeof(format));
   }
-  j->len += len;
-  return len;
+  return image_stream(req, !strcmp(format, "rgb565") ? IMG_STREAM_RGB565 : IMG_STREAM_GRAY, raw_handler);
 }
 
 static esp_err_t capture_handler(httpd_req_t *req) {
   camera_fb_t *fb = NULL;
+  ring_frame_t frame;
+  bool pinned = false;
   esp_err_t res = ESP_OK;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   int64_t fr_start = esp_timer_get_time();
-#endif
 
+  // optional ?roi=<name> to window the sensor on a saved region, ?fresh=1 to
+  // skip the snapshot cache and ?maxage=<ms> to bound the age of a cached frame
+  // ?newer=<timestamp or ETag> long-polls for a frame that started later
+  // ?framesize=<index> switches the sensor for this one frame and back
+  char roi[ROI_NAME_LEN] = "";
+  char query[96];
+  int fresh = 0;
+  int max_age = CONFIG_CAPTURE_MAX_AGE_MS;
+  int64_t newer = 0;
+  int framesize = -1;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "roi", roi, sizeof(roi));
+    fresh = parse_get_var(query, "fresh", 0);
+    max_age = parse_get_var(query, "maxage", CONFIG_CAPTURE_MAX_AGE_MS);
+    newer = parse_get_timestamp(query, "newer");
+    framesize = parse_get_var(query, "framesize", -1);
+  }
+  if (roi[0] && !roi_find(roi)) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  if (framesize >= FRAMESIZE_INVALID || (framesize >= 0 && (roi[0] || newer))) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "framesize does not combine with roi or newer");
+    return ESP_FAIL;
+  }
+  sensor_t *s = esp_camera_sensor_get();
+  if (s->pixformat != PIXFORMAT_JPEG || framesize == s->status.framesize) {
+    framesize = -1;
+  }
+  if (newer) {
+    esp_err_t deferred = longpoll_defer(req, capture_handler);
+    if (deferred == ESP_OK) {
+      return ESP_OK;
+    } else if (deferred != ESP_ERR_INVALID_STATE) {
+      return send_busy(req);
+    }
+  }
+  TickType_t wait = pdMS_TO_TICKS(newer ? CONFIG_LONGPOLL_MS : 1000);
+
+  // frames from `switched` on are exposed in the requested size; the ring is
+  // paused until the sensor is switched back, so the snapshot comes from the
+  // driver
+  int64_t switched = 0;
+  if (framesize >= 0) {
+    switched = sensor_mode_enter((framesize_t)framesize);
+    if (!switched) {
+      log_e("Mode switch failed");
+      httpd_resp_send_500(req);
+      return ESP_FAIL;
+    }
+  }
+
+  bool cached = !roi[0] && !switched && frame_ring_enabled();
+  bool flash = false;
 #if defined(LED_GPIO_NUM)
-  enable_led(true);
-  vTaskDelay(150 / portTICK_PERIOD_MS);  // The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
-  fb = esp_camera_fb_get();              // or it won't be visible in the frame. A better way to do this is needed.
-  enable_led(false);
-#else
-  fb = esp_camera_fb_get();
+  flash = led_duty > 0;
 #endif
+  if (flash) {
+    // wait for the first frame exposed entirely with the LED on, bursts of
+    // captures share one flash-on period
+    int64_t lit_ts = flash_acquire();
+    if (lit_ts <= newer) {
+      lit_ts = newer + 1;
+    }
+    if (lit_ts < switched) {
+      lit_ts = switched;
+    }
+    if (cached) {
+      pinned = frame_ring_since(lit_ts, &frame, wait);
+    } else {
+      fb = capture_frame(roi, lit_ts);
+    }
+    flash_release();
+    if (fb || pinned) {
+      metrics_record(METRIC_LIT_CAPTURE_US, esp_timer_get_time() - fr_start);
+    }
+  } else if (cached) {
+    // the ring's newest frame is the snapshot cache, shared with /stream
+    int64_t since = fresh ? fr_start : fr_start - (int64_t)max_age * 1000;
+    if (since <= newer) {
+      since = newer + 1;
+    }
+    pinned = frame_ring_since(since, &frame, wait);
+  } else {
+    fb = capture_frame(roi, newer ? newer + 1 : switched);
+  }
+
+  if (switched) {
+    if (fb) {
+      if (sensor_mode_check(fb->buf, fb->len)) {
+        metrics_record(METRIC_MODE_SWITCH_US, esp_timer_get_time() - fr_start);
+      } else {
+        esp_camera_fb_return(fb);
+        fb = NULL;
+      }
+    }
+    sensor_mode_leave();
+  }
 
-  if (!fb) {
+  if (!fb && !pinned) {
+    if (newer) {
+      return send_not_modified(req, NULL);
+    }
     log_e("Camera capture failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
 
+  int64_t timestamp = pinned ? frame.timestamp : (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  char etag[40];
+  frame_etag(etag, sizeof(etag), timestamp, "");
+  if (timestamp <= newer || etag_match(req, etag)) {
+    if (pinned) {
+      frame_ring_release(&frame);
+    } else {
+      esp_camera_fb_return(fb);
+    }
+    return send_not_modified(req, etag);
+  }
+
   httpd_resp_set_type(req, "image/jpeg");
   httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "ETag, X-Timestamp, X-Frame-Age");
+  httpd_resp_set_hdr(req, "ETag", (const char *)etag);
 
   char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+  snprintf(ts, 32, "%lld.%06lld", timestamp / 1000000, timestamp % 1000000);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
+  if (pinned) {
+    char age[12];
+    snprintf(age, sizeof(age), "%lld", (esp_timer_get_time() - frame.timestamp) / 1000);
+    httpd_resp_set_hdr(req, "X-Frame-Age", (const char *)age);
+    res = httpd_resp_send(req, (const char *)frame.buf, frame.len);
+    log_i("JPG: %uB from ring, %sms old", frame.len, age);
+    frame_ring_release(&frame);
+    return res;
+  }
+
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   size_t fb_len = 0;
 #endif
@@ -188,7 +489,10 @@ static esp_err_t capture_handler(httpd_req_t *req) {
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
     fb_len = fb->len;
 #endif
+    int64_t send_start = esp_timer_get_time();
     res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
+    metrics_record(METRIC_SEND_US, esp_timer_get_time() - send_start);
+    metrics_record(METRIC_FRAME_BYTES, fb->len);
   } else {
     jpg_chunking_t jchunk = {req, 0};
     res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
@@ -212,11 +516,11 @@ static esp_err_t stream_handler(httpd_req_t *req) {
   size_t _jpg_buf_len = 0;
   uint8_t *_jpg_buf = NULL;
   char *part_buf[128];
-
-  static int64_t last_frame = 0;
-  if (!last_frame) {
-    last_frame = esp_timer_get_time();
-  }
+  ring_frame_t frame;
+  bool pinned = false;
+  uint32_t last_seq = 0;
+  jpg_buf_t encoded = {NULL, 0, -1};
+  int64_t last_frame = esp_timer_get_time();
 
   res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
   if (res != ESP_OK) {
@@ -231,27 +535,59 @@ static esp_err_t stream_handler(httpd_req_t *req) {
   enable_led(true);
 #endif
 
+  int client = metrics_client_open(httpd_req_to_sockfd(req));
   while (true) {
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      log_e("Camera capture failed");
-      res = ESP_FAIL;
-    } else {
-      _timestamp.tv_sec = fb->timestamp.tv_sec;
-      _timestamp.tv_usec = fb->timestamp.tv_usec;
-      if (fb->format != PIXFORMAT_JPEG) {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
-        fb = NULL;
-        if (!jpeg_converted) {
-          log_e("JPEG compression failed");
-          res = ESP_FAIL;
+    uint32_t dropped = 0;
+    if (frame_ring_enabled()) {
+      // share the capture task with the recorder and clip export: send the
+      // newest frame from the ring in place instead of taking a frame buffer
+      pinned = frame_ring_latest(last_seq, &frame, pdMS_TO_TICKS(1000));
+      if (!pinned) {
+        log_e("Camera capture failed");
+        res = ESP_FAIL;
+      } else {
+        if (last_seq) {
+          dropped = frame.seq - last_seq - 1;
         }
+        last_seq = frame.seq;
+        _timestamp.tv_sec = frame.timestamp / 1000000;
+        _timestamp.tv_usec = frame.timestamp % 1000000;
+        _jpg_buf_len = frame.len;
+        _jpg_buf = (uint8_t *)frame.buf;
+      }
+    } else {
+      int64_t fb_start = esp_timer_get_time();
+      fb = esp_camera_fb_get();
+      metrics_record(METRIC_FB_GET_US, esp_timer_get_time() - fb_start);
+      if (!fb) {
+        log_e("Camera capture failed");
+        res = ESP_FAIL;
       } else {
-        _jpg_buf_len = fb->len;
-        _jpg_buf = fb->buf;
+        _timestamp.tv_sec = fb->timestamp.tv_sec;
+        _timestamp.tv_usec = fb->timestamp.tv_usec;
+        if (fb->format != PIXFORMAT_JPEG) {
+          int64_t encode_start = esp_timer_get_time();
+          bool jpeg_converted = jpg_pool_encode(fb, JPG_POOL_QUALITY, &encoded);
+          metrics_record(METRIC_ENCODE_US, esp_timer_get_time() - encode_start);
+          esp_camera_fb_return(fb);
+          fb = NULL;
+          if (!jpeg_converted) {
+            log_e("JPEG compression failed");
+            res = ESP_FAIL;
+          } else {
+            _jpg_buf_len = encoded.len;
+            _jpg_buf = encoded.buf;
+          }
+        } else {
+          _jpg_buf_len = fb->len;
+          _jpg_buf = fb->buf;
+        }
+        if (res == ESP_OK) {
+          metrics_record(METRIC_FRAME_BYTES, _jpg_buf_len);
+        }
       }
     }
+    int64_t send_start = esp_timer_get_time();
     if (res == ESP_OK) {
       res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
     }
@@ -262,12 +598,20 @@ static esp_err_t stream_handler(httpd_req_t *req) {
     if (res == ESP_OK) {
       res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
     }
-    if (fb) {
+    if (res == ESP_OK) {
+      metrics_record(METRIC_SEND_US, esp_timer_get_time() - send_start);
+      metrics_client_frame(client, dropped);
+    }
+    if (pinned) {
+      frame_ring_release(&frame);
+      pinned = false;
+      _jpg_buf = NULL;
+    } else if (fb) {
       esp_camera_fb_return(fb);
       fb = NULL;
       _jpg_buf = NULL;
     } else if (_jpg_buf) {
-      free(_jpg_buf);
+      jpg_pool_release(&encoded);
       _jpg_buf = NULL;
     }
     if (res != ESP_OK) {
@@ -280,14 +624,9 @@ static esp_err_t stream_handler(httpd_req_t *req) {
     last_frame = fr_end;
 
     frame_time /= 1000;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-#endif
-    log_i(
-      "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)", (uint32_t)(_jpg_buf_len), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time, avg_frame_time,
-      1000.0 / avg_frame_time
-    );
+    log_i("MJPG: %uB %ums (%.1ffps)", (uint32_t)(_jpg_buf_len), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
   }
+  metrics_client_close(client);
 
 #if defined(LED_GPIO_NUM)
   isStreaming = false;
@@ -318,29 +657,15 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
   return ESP_FAIL;
 }
 
-static esp_err_t cmd_handler(httpd_req_t *req) {
-  char *buf = NULL;
-  char variable[32];
-  char value[32];
-
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
-  }
-  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
-    free(buf);
-    httpd_resp_send_404(req);
-    return ESP_FAIL;
-  }
-  free(buf);
-
-  int val = atoi(value);
+// Shared by /control and control messages on /ws, returns < 0 on failure.
+static int apply_cmd(const char *variable, int val) {
   log_i("%s = %d", variable, val);
   sensor_t *s = esp_camera_sensor_get();
   int res = 0;
 
   if (!strcmp(variable, "framesize")) {
     if (s->pixformat == PIXFORMAT_JPEG) {
-      res = s->set_framesize(s, (framesize_t)val);
+      res = val >= 0 && val < FRAMESIZE_INVALID && sensor_mode_set((framesize_t)val) ? 0 : -1;
     }
   } else if (!strcmp(variable, "quality")) {
     res = s->set_quality(s, val);
@@ -388,6 +713,8 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
     res = s->set_wb_mode(s, val);
   } else if (!strcmp(variable, "ae_level")) {
     res = s->set_ae_level(s, val);
+  } else if (!strcmp(variable, "httpd_profile")) {
+    res = httpd_profile_select(val) ? 0 : -1;
   }
 #if defined(LED_GPIO_NUM)
   else if (!strcmp(variable, "led_intensity")) {
@@ -401,8 +728,28 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
     log_i("Unknown command: %s", variable);
     res = -1;
   }
+  if (res >= 0) {
+    ws_channel_status_changed();
+  }
+  return res;
+}
 
-  if (res < 0) {
+static esp_err_t cmd_handler(httpd_req_t *req) {
+  char *buf = NULL;
+  char variable[32];
+  char value[32];
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  free(buf);
+
+  if (apply_cmd(variable, atoi(value)) < 0) {
     return httpd_resp_send_500(req);
   }
 
@@ -415,7 +762,7 @@ static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask) {
 }
 
 static esp_err_t status_handler(httpd_req_t *req) {
-  static char json_response[1024];
+  static char json_response[1536];
 
   sensor_t *s = esp_camera_sensor_get();
   char *p = json_response;
@@ -482,6 +829,16 @@ static esp_err_t status_handler(httpd_req_t *req) {
 #else
   p += sprintf(p, ",\"led_intensity\":%d", -1);
 #endif
+  ring_stats_t ring;
+  frame_ring_stats(&ring);
+  p += sprintf(
+    p, ",\"ring_budget\":%u,\"ring_used\":%u,\"ring_peak\":%u,\"ring_frames\":%u,\"ring_dropped\":%u,\"ring_holding\":%u", ring.budget, ring.used, ring.peak,
+    ring.frames, ring.dropped, ring.holding
+  );
+  recorder_stats_t rec;
+  recorder_stats(&rec);
+  p += sprintf(p, ",\"rec\":%u,\"rec_kbps\":%u", rec.recording, rec.write_kbps);
+  p += sprintf(p, ",\"httpd_profile\":%d", httpd_profile);
   *p++ = '}';
   *p++ = 0;
   httpd_resp_set_type(req, "application/json");
@@ -489,6 +846,14 @@ static esp_err_t status_handler(httpd_req_t *req) {
   return httpd_resp_send(req, json_response, strlen(json_response));
 }
 
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  static char json_response[3072];
+  size_t len = metrics_json(json_response, sizeof(json_response), camera_httpd, stream_httpd);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
 static esp_err_t xclk_handler(httpd_req_t *req) {
   char *buf = NULL;
   char _xclk[32];
@@ -508,6 +873,7 @@ static esp_err_t xclk_handler(httpd_req_t *req) {
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
+  sensor_modes_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -540,6 +906,7 @@ static esp_err_t reg_handler(httpd_req_t *req) {
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_reg(s, reg, mask, val);
+  sensor_modes_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -578,14 +945,6 @@ static esp_err_t greg_handler(httpd_req_t *req) {
   return httpd_resp_send(req, val, strlen(val));
 }
 
-static int parse_get_var(char *buf, const char *key, int def) {
-  char _int[16];
-  if (httpd_query_key_value(buf, key, _int, sizeof(_int)) != ESP_OK) {
-    return def;
-  }
-  return atoi(_int);
-}
-
 static esp_err_t pll_handler(httpd_req_t *req) {
   char *buf = NULL;
 
@@ -606,6 +965,7 @@ static esp_err_t pll_handler(httpd_req_t *req) {
   log_i("Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  sensor_modes_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -641,6 +1001,165 @@ static esp_err_t win_handler(httpd_req_t *req) {
   );
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);  // codespell:ignore totaly
+  sensor_modes_invalidate();
+  if (res) {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t clip_handler(httpd_req_t *req) {
+  esp_err_t res = ESP_OK;
+  char *part_buf[128];
+  char query[64];
+  uint32_t first_seq = 0;
+  int64_t end_ts = 0;
+
+  // ?pre=<ms>&post=<ms> starts a new event now, otherwise export the held clip
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    frame_ring_hold(parse_get_var(query, "pre", RING_CLIP_PRE_MS), parse_get_var(query, "post", RING_CLIP_POST_MS), RING_CLIP_KEEP_MS);
+  }
+  if (!frame_ring_clip(&first_seq, &end_ts)) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+  httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=clip.mjpeg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  // frames are sent from the ring in place, pinned only while being sent
+  uint32_t after = first_seq - 1;
+  size_t frames = 0;
+  ring_frame_t frame;
+  while (res == ESP_OK) {
+    if (!frame_ring_next(after, &frame, pdMS_TO_TICKS(1000))) {
+      if (esp_timer_get_time() > end_ts) {
+        break;
+      }
+      continue;
+    }
+    after = frame.seq;
+    if (frame.timestamp > end_ts) {
+      frame_ring_release(&frame);
+      break;
+    }
+    res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+    if (res == ESP_OK) {
+      size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, frame.len, (int)(frame.timestamp / 1000000), (int)(frame.timestamp % 1000000));
+      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
+    }
+    if (res == ESP_OK) {
+      res = httpd_resp_send_chunk(req, (const char *)frame.buf, frame.len);
+    }
+    frame_ring_release(&frame);
+    frames++;
+  }
+  if (res == ESP_OK) {
+    httpd_resp_send_chunk(req, _STREAM_END, strlen(_STREAM_END));
+    httpd_resp_send_chunk(req, NULL, 0);
+  }
+  frame_ring_release_hold(first_seq);
+  log_i("Clip: %u frames from seq %u", frames, first_seq);
+  return res;
+}
+
+static esp_err_t record_handler(httpd_req_t *req) {
+  static char json_response[384];
+  char query[32];
+
+  // ?start=1 or ?stop=1, always answers with the recorder state
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (parse_get_var(query, "start", 0) == 1 && !recorder_start()) {
+      return httpd_resp_send_500(req);
+    }
+    if (parse_get_var(query, "stop", 0) == 1) {
+      recorder_stop();
+    }
+  }
+
+  recorder_stats_t rec;
+  recorder_stats(&rec);
+  int len = snprintf(
+    json_response, sizeof(json_response),
+    "{\"mounted\":%u,\"recording\":%u,\"file\":\"%s\",\"frames\":%u,\"bytes\":%llu,\"segments\":%u,\"total_frames\":%u,\"skipped\":%u,"
+    "\"write_kbps\":%u,\"max_write_ms\":%u,\"card_free\":%llu}",
+    rec.mounted, rec.recording, rec.file, rec.frames, rec.bytes, rec.segments, rec.total_frames, rec.skipped, rec.write_kbps, rec.max_write_ms, rec.card_free
+  );
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+static int print_roi(char *p, const camera_roi_t *roi) {
+  return sprintf(
+    p, "{\"name\":\"%s\",\"sx\":%d,\"sy\":%d,\"ex\":%d,\"ey\":%d,\"offx\":%d,\"offy\":%d,\"tx\":%d,\"ty\":%d,\"ox\":%d,\"oy\":%d,\"scale\":%u,\"binning\":%u}",
+    roi->name, roi->startX, roi->startY, roi->endX, roi->endY, roi->offsetX, roi->offsetY, roi->totalX, roi->totalY, roi->outputX, roi->outputY, roi->scale,  // codespell:ignore totaly
+    roi->binning
+  );
+}
+
+static esp_err_t roi_handler(httpd_req_t *req) {
+  char *buf = NULL;
+  char name[ROI_NAME_LEN];
+  int res = 0;
+
+  // without arguments list the saved regions
+  if (httpd_req_get_url_query_len(req) == 0) {
+    static char json_response[128 + ROI_MAX * 256];
+    char *p = json_response;
+    p += sprintf(p, "{\"upload\":\"%s\",\"rois\":[", roi_upload_name());
+    camera_roi_t roi;
+    for (int i = 0; roi_at(i, &roi); i++) {
+      if (i) {
+        *p++ = ',';
+      }
+      p += print_roi(p, &roi);
+    }
+    p += sprintf(p, "]}");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json_response, p - json_response);
+  }
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  if (httpd_query_key_value(buf, "upload", name, sizeof(name)) == ESP_OK) {
+    log_i("Set upload ROI: '%s'", name);
+    res = roi_set_upload_name(name) ? 0 : -1;
+  } else if (httpd_query_key_value(buf, "name", name, sizeof(name)) != ESP_OK || !name[0]) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  } else if (parse_get_var(buf, "delete", 0) == 1) {
+    log_i("Delete ROI: '%s'", name);
+    res = roi_delete(name) ? 0 : -1;
+  } else {
+    // same arguments as /resolution
+    camera_roi_t roi;
+    memset(&roi, 0, sizeof(roi));
+    strlcpy(roi.name, name, sizeof(roi.name));
+    roi.startX = parse_get_var(buf, "sx", 0);
+    roi.startY = parse_get_var(buf, "sy", 0);
+    roi.endX = parse_get_var(buf, "ex", 0);
+    roi.endY = parse_get_var(buf, "ey", 0);
+    roi.offsetX = parse_get_var(buf, "offx", 0);
+    roi.offsetY = parse_get_var(buf, "offy", 0);
+    roi.totalX = parse_get_var(buf, "tx", 0);
+    roi.totalY = parse_get_var(buf, "ty", 0);  // codespell:ignore totaly
+    roi.outputX = parse_get_var(buf, "ox", 0);
+    roi.outputY = parse_get_var(buf, "oy", 0);
+    roi.scale = parse_get_var(buf, "scale", 0) == 1;
+    roi.binning = parse_get_var(buf, "binning", 0) == 1;
+    log_i("Save ROI: '%s' output %dx%d", roi.name, roi.outputX, roi.outputY);
+    res = (roi.outputX > 0 && roi.outputY > 0 && roi_save(&roi)) ? 0 : -1;
+  }
+  free(buf);
+
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -649,6 +1168,48 @@ static esp_err_t win_handler(httpd_req_t *req) {
   return httpd_resp_send(req, NULL, 0);
 }
 
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t ws_handler(httpd_req_t *req) {
+  if (req->method == HTTP_GET) {
+    // handshake: from now on the client receives pushes
+    return ws_channel_add(httpd_req_to_sockfd(req)) ? ESP_OK : ESP_FAIL;
+  }
+
+  // control messages use the /control query syntax: var=framesize&val=8
+  char buf[96];
+  httpd_ws_frame_t pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  esp_err_t res = httpd_ws_recv_frame(req, &pkt, 0);
+  if (res != ESP_OK) {
+    return res;
+  }
+  if (pkt.type != HTTPD_WS_TYPE_TEXT || pkt.len >= sizeof(buf)) {
+    log_e("WS: unexpected frame type %d, %u bytes", pkt.type, pkt.len);
+    return ESP_FAIL;
+  }
+  pkt.payload = (uint8_t *)buf;
+  res = httpd_ws_recv_frame(req, &pkt, pkt.len);
+  if (res != ESP_OK) {
+    return res;
+  }
+  buf[pkt.len] = 0;
+
+  char variable[32];
+  char value[32];
+  char reply[80];
+  int cmd_res = -1;
+  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) == ESP_OK && httpd_query_key_value(buf, "val", value, sizeof(value)) == ESP_OK) {
+    cmd_res = apply_cmd(variable, atoi(value));
+  } else {
+    strcpy(variable, "");
+  }
+  pkt.type = HTTPD_WS_TYPE_TEXT;
+  pkt.payload = (uint8_t *)reply;
+  pkt.len = snprintf(reply, sizeof(reply), "{\"type\":\"control\",\"var\":\"%s\",\"res\":%d}", variable, cmd_res < 0 ? -1 : 0);
+  return httpd_ws_send_frame(req, &pkt);
+}
+#endif
+
 static esp_err_t index_handler(httpd_req_t *req) {
   httpd_resp_set_type(req, "text/html");
   httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
@@ -667,9 +1228,19 @@ static esp_err_t index_handler(httpd_req_t *req) {
   }
 }
 
+#if defined(LED_GPIO_NUM)
+static void flash_led(bool on) {
+  enable_led(on || isStreaming);
+}
+#endif
+
 void startCameraServer() {
+  httpd_profile = httpd_profile_load(CONFIG_HTTPD_PROFILE);
+  const httpd_profile_t *profile = httpd_profile_get(httpd_profile);
+
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.max_uri_handlers = 16;
+  httpd_profile_apply(&config, &profile->control);
 
   httpd_uri_t index_uri = {
     .uri = "/",
@@ -697,6 +1268,19 @@ void startCameraServer() {
 #endif
   };
 
+  httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t cmd_uri = {
     .uri = "/control",
     .method = HTTP_GET,
@@ -749,6 +1333,19 @@ void startCameraServer() {
 #endif
   };
 
+  httpd_uri_t raw_uri = {
+    .uri = "/raw",
+    .method = HTTP_GET,
+    .handler = raw_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t xclk_uri = {
     .uri = "/xclk",
     .method = HTTP_GET,
@@ -814,28 +1411,115 @@ void startCameraServer() {
 #endif
   };
 
-  ra_filter_init(&ra_filter, 20);
+  httpd_uri_t roi_uri = {
+    .uri = "/roi",
+    .method = HTTP_GET,
+    .handler = roi_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t clip_uri = {
+    .uri = "/clip",
+    .method = HTTP_GET,
+    .handler = clip_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+  httpd_uri_t ws_uri = {
+    .uri = "/ws",
+    .method = HTTP_GET,
+    .handler = ws_handler,
+    .user_ctx = NULL,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+  };
+#endif
+
+  httpd_uri_t record_uri = {
+    .uri = "/record",
+    .method = HTTP_GET,
+    .handler = record_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  roi_init();
+  sensor_modes_init();
+  sensor_t *s = esp_camera_sensor_get();
+  if (s->pixformat != PIXFORMAT_JPEG) {
+    // q80 JPEG of an RGB565/grayscale frame stays well under a byte per pixel
+    const resolution_info_t *res = &resolution[s->status.framesize];
+    jpg_pool_init(JPG_POOL_BUFFERS, (size_t)res->width * res->height / 2);
+  }
+#if defined(LED_GPIO_NUM)
+  flash_sync_init(flash_led);
+#endif
+  if (frame_ring_init(CONFIG_RING_BUDGET, CONFIG_RING_WINDOW_MS)) {
+    frame_ring_start_capture(5, tskNO_AFFINITY);
+    analytics_start(3, tskNO_AFFINITY);
+    rtsp_server_start(CONFIG_RTSP_PORT, 5, tskNO_AFFINITY);
+    recorder_init();
+  }
+
+  // without the queue or a waiter, ?newer= polls get a 503
+  longpoll_queue = xQueueCreate(CONFIG_LONGPOLL_WAITERS, sizeof(longpoll_t));
+  SemaphoreHandle_t free_waiters = longpoll_queue ? xSemaphoreCreateCounting(CONFIG_LONGPOLL_WAITERS, 0) : NULL;
+  for (int i = 0; free_waiters && i < CONFIG_LONGPOLL_WAITERS; i++) {
+    if (xTaskCreate(longpoll_task, "longpoll", 6144, NULL, 5, &longpoll_waiters[i]) == pdPASS) {
+      xSemaphoreGive(free_waiters);
+    }
+  }
+  longpoll_free = free_waiters;
 
   log_i("Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&camera_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(camera_httpd, &index_uri);
     httpd_register_uri_handler(camera_httpd, &cmd_uri);
     httpd_register_uri_handler(camera_httpd, &status_uri);
+    httpd_register_uri_handler(camera_httpd, &metrics_uri);
     httpd_register_uri_handler(camera_httpd, &capture_uri);
     httpd_register_uri_handler(camera_httpd, &bmp_uri);
+    httpd_register_uri_handler(camera_httpd, &raw_uri);
 
     httpd_register_uri_handler(camera_httpd, &xclk_uri);
     httpd_register_uri_handler(camera_httpd, &reg_uri);
     httpd_register_uri_handler(camera_httpd, &greg_uri);
     httpd_register_uri_handler(camera_httpd, &pll_uri);
     httpd_register_uri_handler(camera_httpd, &win_uri);
+    httpd_register_uri_handler(camera_httpd, &roi_uri);
+    httpd_register_uri_handler(camera_httpd, &record_uri);
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    httpd_register_uri_handler(camera_httpd, &ws_uri);
+    ws_channel_start(camera_httpd);
+#endif
   }
 
   config.server_port += 1;
   config.ctrl_port += 1;
+  httpd_profile_apply(&config, &profile->stream);
   log_i("Starting stream server on port: '%d'", config.server_port);
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(stream_httpd, &stream_uri);
+    httpd_register_uri_handler(stream_httpd, &clip_uri);
   }
 }
 
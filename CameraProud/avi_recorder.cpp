@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "board_config.h"
+#include "frame_ring.h"
+#include "avi_recorder.h"
+
+#if defined(SD_MMC_1BIT)
+#include "SD_MMC.h"
+
+#define SD_MOUNT      "/sdcard"
+#define AVI_HEADER    224  // RIFF + hdrl + LIST movi, frames start right after
+#define AVI_MOVI_FCC  220  // idx1 offsets are relative to the 'movi' fourcc
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEY     0x10
+
+typedef struct {
+  uint32_t ckid;
+  uint32_t flags;
+  uint32_t offset;
+  uint32_t size;
+} avi_index_t;
+
+static volatile bool rec_run = false;
+static volatile uint32_t rec_start_seq = 0;
+static recorder_stats_t stats;
+
+static FILE *avi = NULL;
+static uint8_t *wbuf = NULL;
+static size_t wbuf_size = 0;
+static size_t wbuf_used = 0;
+static avi_index_t *avi_index = NULL;
+static uint32_t movi_len = 4;
+static uint32_t max_frame = 0;
+static uint16_t avi_width = 0;
+static uint16_t avi_height = 0;
+static int64_t first_ts = 0;
+static int64_t last_ts = 0;
+static uint64_t written = 0;
+static int64_t write_us = 0;
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_fcc(uint8_t *p, const char *fcc) {
+  memcpy(p, fcc, 4);
+}
+
+static void avi_header(uint8_t *h, uint32_t frames) {
+  uint32_t us_per_frame = 0;
+  if (frames > 1) {
+    us_per_frame = (last_ts - first_ts) / (frames - 1);
+  }
+  uint32_t fps_milli = us_per_frame ? 1000000000ULL / us_per_frame : 10000;
+  uint32_t riff_len = AVI_HEADER - 8 + (movi_len - 4) + 8 + frames * sizeof(avi_index_t);
+
+  memset(h, 0, AVI_HEADER);
+  put_fcc(h + 0, "RIFF");
+  put32(h + 4, riff_len);
+  put_fcc(h + 8, "AVI ");
+  put_fcc(h + 12, "LIST");
+  put32(h + 16, 192);
+  put_fcc(h + 20, "hdrl");
+
+  put_fcc(h + 24, "avih");
+  put32(h + 28, 56);
+  put32(h + 32, us_per_frame);
+  put32(h + 36, us_per_frame ? (uint64_t)max_frame * 1000000 / us_per_frame : 0);
+  put32(h + 44, AVIF_HASINDEX);
+  put32(h + 48, frames);
+  put32(h + 56, 1);  // streams
+  put32(h + 60, max_frame);
+  put32(h + 64, avi_width);
+  put32(h + 68, avi_height);
+
+  put_fcc(h + 88, "LIST");
+  put32(h + 92, 116);
+  put_fcc(h + 96, "strl");
+  put_fcc(h + 100, "strh");
+  put32(h + 104, 56);
+  put_fcc(h + 108, "vids");
+  put_fcc(h + 112, "MJPG");
+  put32(h + 128, 1000);  // scale, rate / scale = fps
+  put32(h + 132, fps_milli);
+  put32(h + 140, frames);
+  put32(h + 144, max_frame);
+  put32(h + 148, 0xFFFFFFFF);  // default quality
+  put16(h + 160, avi_width);
+  put16(h + 162, avi_height);
+
+  put_fcc(h + 164, "strf");
+  put32(h + 168, 40);
+  put32(h + 172, 40);
+  put32(h + 176, avi_width);
+  put32(h + 180, avi_height);
+  put16(h + 184, 1);
+  put16(h + 186, 24);
+  put_fcc(h + 188, "MJPG");
+  put32(h + 192, (uint32_t)avi_width * avi_height * 3);
+
+  put_fcc(h + 212, "LIST");
+  put32(h + 216, movi_len);
+  put_fcc(h + 220, "movi");
+}
+
+static bool rec_flush() {
+  if (!wbuf_used) {
+    return true;
+  }
+  int64_t start = esp_timer_get_time();
+  size_t n = fwrite(wbuf, 1, wbuf_used, avi);
+  int64_t elapsed = esp_timer_get_time() - start;
+  write_us += elapsed;
+  written += n;
+  if (elapsed / 1000 > stats.max_write_ms) {
+    stats.max_write_ms = elapsed / 1000;
+  }
+  if (write_us) {
+    stats.write_kbps = written * 1000000 / write_us / 1024;
+  }
+  bool ok = n == wbuf_used;
+  wbuf_used = 0;
+  return ok;
+}
+
+// Only full buffers are written while recording, so writes stay cluster aligned.
+static bool rec_write(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len) {
+    size_t n = wbuf_size - wbuf_used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(wbuf + wbuf_used, p, n);
+    wbuf_used += n;
+    p += n;
+    len -= n;
+    if (wbuf_used == wbuf_size && !rec_flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int segment_number(const char *name) {
+  int n = 0;
+  if (sscanf(name, "%d.avi", &n) != 1) {
+    return -1;
+  }
+  return n;
+}
+
+// Highest segment number on the card, and optionally the lowest one.
+static int scan_segments(int *oldest) {
+  int newest = 0;
+  if (oldest) {
+    *oldest = -1;
+  }
+  DIR *dir = opendir(SD_MOUNT RECORDER_DIR);
+  if (!dir) {
+    return 0;
+  }
+  struct dirent *e;
+  while ((e = readdir(dir)) != NULL) {
+    int n = segment_number(e->d_name);
+    if (n < 0) {
+      continue;
+    }
+    if (n > newest) {
+      newest = n;
+    }
+    if (oldest && (*oldest < 0 || n < *oldest)) {
+      *oldest = n;
+    }
+  }
+  closedir(dir);
+  return newest;
+}
+
+static void free_space() {
+  while (SD_MMC.totalBytes() - SD_MMC.usedBytes() < RECORDER_MIN_FREE_BYTES) {
+    int oldest;
+    scan_segments(&oldest);
+    if (oldest < 0) {
+      return;
+    }
+    char path[48];
+    snprintf(path, sizeof(path), SD_MOUNT RECORDER_DIR "/%05d.avi", oldest);
+    log_i("Recorder: card full, deleting %s", path);
+    if (unlink(path) != 0) {
+      return;
+    }
+  }
+}
+
+static bool open_segment(const ring_frame_t *frame) {
+  free_space();
+  snprintf(stats.file, sizeof(stats.file), RECORDER_DIR "/%05d.avi", scan_segments(NULL) + 1);
+  char path[48];
+  snprintf(path, sizeof(path), SD_MOUNT "%s", stats.file);
+  avi = fopen(path, "wb");
+  if (!avi) {
+    log_e("Recorder: cannot create %s", path);
+    return false;
+  }
+  setvbuf(avi, NULL, _IONBF, 0);
+
+  avi_width = frame->width;
+  avi_height = frame->height;
+  first_ts = last_ts = frame->timestamp;
+  movi_len = 4;
+  max_frame = 0;
+  stats.frames = 0;
+  stats.bytes = AVI_HEADER;
+
+  // placeholder header, rewritten with the final sizes on close
+  uint8_t h[AVI_HEADER];
+  avi_header(h, 0);
+  log_i("Recorder: writing %s (%ux%u)", path, avi_width, avi_height);
+  return rec_write(h, AVI_HEADER);
+}
+
+static void close_segment() {
+  if (!avi) {
+    return;
+  }
+  uint8_t chunk[8];
+  put_fcc(chunk, "idx1");
+  put32(chunk + 4, stats.frames * sizeof(avi_index_t));
+  bool ok = rec_write(chunk, 8) && rec_write(avi_index, stats.frames * sizeof(avi_index_t)) && rec_flush();
+
+  uint8_t h[AVI_HEADER];
+  avi_header(h, stats.frames);
+  ok = ok && fseek(avi, 0, SEEK_SET) == 0 && fwrite(h, 1, AVI_HEADER, avi) == AVI_HEADER;
+  fclose(avi);
+  avi = NULL;
+  wbuf_used = 0;
+  stats.segments++;
+  log_i("Recorder: closed %s, %u frames, %llu bytes%s", stats.file, stats.frames, stats.bytes, ok ? "" : " (write error)");
+}
+
+static bool segment_full(const ring_frame_t *frame) {
+  return stats.frames >= RECORDER_MAX_FRAMES || stats.bytes + frame->len + 8 + 16 * (stats.frames + 1) > RECORDER_SEGMENT_BYTES
+         || frame->timestamp - first_ts > (int64_t)RECORDER_SEGMENT_MS * 1000 || frame->width != avi_width || frame->height != avi_height;
+}
+
+static bool append_frame(const ring_frame_t *frame) {
+  uint8_t chunk[8];
+  uint32_t padded = (frame->len + 1) & ~1;
+  put_fcc(chunk, "00dc");
+  put32(chunk + 4, frame->len);
+  static const uint8_t pad = 0;
+  if (!rec_write(chunk, 8) || !rec_write(frame->buf, frame->len) || (padded != frame->len && !rec_write(&pad, 1))) {
+    return false;
+  }
+
+  avi_index_t *idx = &avi_index[stats.frames];
+  put_fcc((uint8_t *)&idx->ckid, "00dc");
+  put32((uint8_t *)&idx->flags, AVIIF_KEY);
+  put32((uint8_t *)&idx->offset, movi_len);
+  put32((uint8_t *)&idx->size, frame->len);
+
+  movi_len += 8 + padded;
+  last_ts = frame->timestamp;
+  if (frame->len > max_frame) {
+    max_frame = frame->len;
+  }
+  stats.frames++;
+  stats.total_frames++;
+  stats.bytes += 8 + padded;
+  return true;
+}
+
+static void recorder_task(void *arg) {
+  ring_frame_t frame;
+  uint32_t after = 0;
+  bool running = false;
+  while (true) {
+    if (!rec_run) {
+      if (running) {
+        close_segment();
+        running = false;
+      }
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    if (!running) {
+      // start with the next frame, not with what is already in the ring
+      after = rec_start_seq;
+      running = true;
+    }
+    if (!frame_ring_next(after, &frame, pdMS_TO_TICKS(500))) {
+      continue;
+    }
+    if (frame.seq > after + 1) {
+      stats.skipped += frame.seq - after - 1;
+    }
+    after = frame.seq;
+
+    if (avi && segment_full(&frame)) {
+      close_segment();
+    }
+    bool ok = (avi || open_segment(&frame)) && append_frame(&frame);
+    frame_ring_release(&frame);
+    if (!ok) {
+      log_e("Recorder: write failed, stopping");
+      close_segment();
+      rec_run = false;
+      running = false;
+    }
+  }
+}
+
+bool recorder_init() {
+  if (stats.mounted) {
+    return true;
+  }
+  if (!frame_ring_enabled()) {
+    log_e("Recorder: needs the PSRAM frame ring");
+    return false;
+  }
+  if (!SD_MMC.begin(SD_MOUNT, true)) {
+    log_i("Recorder: no SD card");
+    return false;
+  }
+  SD_MMC.mkdir(RECORDER_DIR);
+
+  wbuf_size = RECORDER_WRITE_BUF;
+  wbuf = (uint8_t *)heap_caps_malloc(wbuf_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  avi_index = (avi_index_t *)heap_caps_malloc(RECORDER_MAX_FRAMES * sizeof(avi_index_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!wbuf || !avi_index) {
+    log_e("Recorder: out of memory");
+    free(wbuf);
+    free(avi_index);
+    wbuf = NULL;
+    avi_index = NULL;
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(recorder_task, "recorder", 4096, NULL, 4, NULL, tskNO_AFFINITY) != pdPASS) {
+    return false;
+  }
+  stats.mounted = true;
+  log_i("Recorder: card %lluMB, %lluMB used", SD_MMC.totalBytes() >> 20, SD_MMC.usedBytes() >> 20);
+  return true;
+}
+
+bool recorder_start() {
+  if (!stats.mounted) {
+    return false;
+  }
+  if (!rec_run) {
+    ring_stats_t ring;
+    frame_ring_stats(&ring);
+    rec_start_seq = ring.newest_seq;
+    written = 0;
+    write_us = 0;
+    stats.max_write_ms = 0;
+    rec_run = true;
+  }
+  return true;
+}
+
+void recorder_stop() {
+  rec_run = false;
+}
+
+void recorder_stats(recorder_stats_t *out) {
+  *out = stats;
+  out->recording = rec_run;
+  if (stats.mounted) {
+    out->card_free = SD_MMC.totalBytes() - SD_MMC.usedBytes();
+  }
+}
+
+#else
+
+bool recorder_init() {
+  return false;
+}
+
+bool recorder_start() {
+  return false;
+}
+
+void recorder_stop() {}
+
+void recorder_stats(recorder_stats_t *out) {
+  memset(out, 0, sizeof(recorder_stats_t));
+}
+
+#endif  // SD_MMC_1BIT
@@ -0,0 +1,46 @@
+#ifndef AVI_RECORDER_H
+#define AVI_RECORDER_H
+
+//
+// MJPEG-AVI recorder for the microSD slot (SD_MMC_1BIT in camera_pins.h).
+//
+// Frames come from the frame ring, so recording shares the capture task with
+// /stream instead of competing for frame buffers. Writes go through one
+// DMA-capable buffer whose size is a multiple of the FAT cluster size, so every
+// write but the last of a segment covers whole clusters. The idx1 index is
+// kept in PSRAM and written when a segment is closed; segments rotate on
+// duration, size or index capacity, and the oldest segment is deleted when the
+// card runs low on space.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RECORDER_DIR            "/rec"
+#define RECORDER_WRITE_BUF      (32 * 1024)
+#define RECORDER_SEGMENT_MS     (5 * 60 * 1000)
+#define RECORDER_SEGMENT_BYTES  (512UL * 1024 * 1024)
+#define RECORDER_MAX_FRAMES     12000
+#define RECORDER_MIN_FREE_BYTES (64ULL * 1024 * 1024)
+
+typedef struct {
+  bool mounted;
+  bool recording;
+  char file[32];
+  uint32_t frames;         // current segment
+  uint64_t bytes;          // current segment
+  uint32_t segments;       // closed since boot
+  uint32_t total_frames;   // since boot
+  uint32_t skipped;        // frames evicted from the ring before they were written
+  uint32_t write_kbps;     // sustained card throughput: bytes / time spent writing
+  uint32_t max_write_ms;   // slowest single write
+  uint64_t card_free;
+} recorder_stats_t;
+
+// Mounts the card and starts the recorder task, returns false without a card.
+bool recorder_init();
+bool recorder_start();
+void recorder_stop();
+void recorder_stats(recorder_stats_t *stats);
+
+#endif  // AVI_RECORDER_H
@@ -0,0 +1,198 @@
+// Int8 bowl-state classifier, see bowl_classifier.h for the blob layout.
+//
+// Preprocessing and arithmetic must stay bit-exact with AI/bowl_classifier.py,
+// which trains, quantizes and evaluates the same network on the server.
+#include <string.h>
+#include <math.h>
+#include "bowl_classifier.h"
+
+#if defined(ARDUINO)
+#include "esp_partition.h"
+#include "esp32-hal-log.h"
+#else
+#define log_e(...)
+#define log_i(...)
+#endif
+
+static const char *bowl_class_names[BOWL_CLASS_MAX] = {"normal", "tipped", "not_found"};
+
+const char *bowl_class_name(bowl_class_t c) {
+  if (c >= BOWL_CLASS_MAX) {
+    return "unknown";
+  }
+  return bowl_class_names[c];
+}
+
+static bool section_ok(const bowl_model_header_t *h, uint32_t off, size_t len) {
+  return (off & 3) == 0 && off >= h->header_size && off + len <= h->total_size;
+}
+
+bool bowl_model_load(bowl_model_t *model, const void *blob, size_t len) {
+  const bowl_model_header_t *h = (const bowl_model_header_t *)blob;
+  memset(model, 0, sizeof(bowl_model_t));
+
+  if (len < sizeof(bowl_model_header_t) || h->magic != BOWL_MODEL_MAGIC) {
+    log_e("Bowl model: bad magic");
+    return false;
+  }
+  if (h->version != BOWL_MODEL_VERSION || h->header_size < sizeof(bowl_model_header_t) || h->total_size > len) {
+    log_e("Bowl model: unsupported version %u or truncated blob", h->version);
+    return false;
+  }
+  size_t inputs = (size_t)h->in_w * h->in_h;
+  if (!inputs || inputs > BOWL_MAX_INPUT || !h->hidden || h->hidden > BOWL_MAX_HIDDEN || h->classes != BOWL_CLASS_MAX) {
+    log_e("Bowl model: bad shape %ux%u/%u/%u", h->in_w, h->in_h, h->hidden, h->classes);
+    return false;
+  }
+  if (!h->crop_w || !h->crop_h || h->crop_x + h->crop_w > 1000 || h->crop_y + h->crop_h > 1000 || h->l1_shift < 0 || h->l1_shift > 62) {
+    log_e("Bowl model: bad crop or scale");
+    return false;
+  }
+  if (!section_ok(h, h->w1_off, inputs * h->hidden) || !section_ok(h, h->b1_off, h->hidden * sizeof(int32_t))
+      || !section_ok(h, h->w2_off, (size_t)h->classes * h->hidden) || !section_ok(h, h->b2_off, h->classes * sizeof(int32_t))) {
+    log_e("Bowl model: section out of range");
+    return false;
+  }
+
+  const uint8_t *base = (const uint8_t *)blob;
+  model->hdr = h;
+  model->w1 = (const int8_t *)(base + h->w1_off);
+  model->b1 = (const int32_t *)(base + h->b1_off);
+  model->w2 = (const int8_t *)(base + h->w2_off);
+  model->b2 = (const int32_t *)(base + h->b2_off);
+  log_i("Bowl model: %ux%u input, %u hidden, %u bytes", h->in_w, h->in_h, h->hidden, h->total_size);
+  return true;
+}
+
+void bowl_preprocess(const bowl_model_t *model, const uint8_t *luma, uint16_t width, uint16_t height, int8_t *input) {
+  const bowl_model_header_t *h = model->hdr;
+  int cx = (int)h->crop_x * width / 1000;
+  int cy = (int)h->crop_y * height / 1000;
+  int cw = (int)h->crop_w * width / 1000;
+  int ch = (int)h->crop_h * height / 1000;
+  if (cw < h->in_w) {
+    cw = h->in_w < width ? h->in_w : width;
+  }
+  if (ch < h->in_h) {
+    ch = h->in_h < height ? h->in_h : height;
+  }
+  if (cx + cw > width) {
+    cx = width - cw;
+  }
+  if (cy + ch > height) {
+    cy = height - ch;
+  }
+
+  // area resample the crop down to the network input size
+  int n = h->in_w * h->in_h;
+  uint8_t cells[BOWL_MAX_INPUT];
+  uint32_t sum = 0;
+  for (int oy = 0; oy < h->in_h; oy++) {
+    int y0 = cy + oy * ch / h->in_h;
+    int y1 = cy + (oy + 1) * ch / h->in_h;
+    if (y1 <= y0) {
+      y1 = y0 + 1;
+    }
+    for (int ox = 0; ox < h->in_w; ox++) {
+      int x0 = cx + ox * cw / h->in_w;
+      int x1 = cx + (ox + 1) * cw / h->in_w;
+      if (x1 <= x0) {
+        x1 = x0 + 1;
+      }
+      uint32_t acc = 0;
+      for (int y = y0; y < y1; y++) {
+        const uint8_t *row = luma + (size_t)y * width;
+        for (int x = x0; x < x1; x++) {
+          acc += row[x];
+        }
+      }
+      uint8_t v = acc / ((y1 - y0) * (x1 - x0));
+      cells[oy * h->in_w + ox] = v;
+      sum += v;
+    }
+  }
+
+  // contrast normalization, so the flash LED and room light look the same
+  int mean = sum / n;
+  uint32_t dev = 0;
+  for (int i = 0; i < n; i++) {
+    dev += cells[i] > mean ? cells[i] - mean : mean - cells[i];
+  }
+  int mad = dev / n;
+  if (mad < 1) {
+    mad = 1;
+  }
+  for (int i = 0; i < n; i++) {
+    int v = (cells[i] - mean) * 32 / mad;
+    input[i] = v > 127 ? 127 : (v < -127 ? -127 : v);
+  }
+}
+
+void bowl_infer(const bowl_model_t *model, const int8_t *input, bowl_result_t *result) {
+  const bowl_model_header_t *h = model->hdr;
+  int n = h->in_w * h->in_h;
+  int8_t hidden[BOWL_MAX_HIDDEN];
+
+  for (int j = 0; j < h->hidden; j++) {
+    const int8_t *w = model->w1 + (size_t)j * n;
+    int32_t acc = model->b1[j];
+    for (int i = 0; i < n; i++) {
+      acc += (int32_t)w[i] * input[i];
+    }
+    int64_t v = ((int64_t)acc * h->l1_mult) >> h->l1_shift;
+    hidden[j] = v > 127 ? 127 : (v < 0 ? 0 : v);
+  }
+
+  int best = 0;
+  for (int c = 0; c < BOWL_CLASS_MAX; c++) {
+    const int8_t *w = model->w2 + (size_t)c * h->hidden;
+    int32_t acc = model->b2[c];
+    for (int j = 0; j < h->hidden; j++) {
+      acc += (int32_t)w[j] * hidden[j];
+    }
+    result->logits[c] = acc;
+    if (acc > result->logits[best]) {
+      best = c;
+    }
+  }
+
+  float denom = 0;
+  for (int c = 0; c < BOWL_CLASS_MAX; c++) {
+    denom += expf((result->logits[c] - result->logits[best]) * h->out_scale);
+  }
+  result->label = (bowl_class_t)best;
+  result->confidence = 1.0f / denom;
+}
+
+bool bowl_classify(const bowl_model_t *model, const uint8_t *luma, uint16_t width, uint16_t height, bowl_result_t *result) {
+  if (!model->hdr || !luma || !width || !height) {
+    return false;
+  }
+  int8_t input[BOWL_MAX_INPUT];
+  bowl_preprocess(model, luma, width, height, input);
+  bowl_infer(model, input, result);
+  return true;
+}
+
+#if defined(ARDUINO)
+bool bowl_model_load_partition(bowl_model_t *model, const char *label) {
+  const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!part) {
+    log_e("Partition '%s' not found", label);
+    return false;
+  }
+
+  // The mapping is kept for the lifetime of the firmware, the handle is never released.
+  const void *blob = NULL;
+  esp_partition_mmap_handle_t handle;
+  if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &blob, &handle) != ESP_OK) {
+    log_e("Partition '%s' mmap failed", label);
+    return false;
+  }
+  if (!bowl_model_load(model, blob, part->size)) {
+    esp_partition_munmap(handle);
+    return false;
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef BOWL_CLASSIFIER_H
+#define BOWL_CLASSIFIER_H
+
+//
+// Tiny int8 bowl-state classifier (normal / tipped / not_found).
+//
+// The model blob is produced by AI/bowl_classifier.py and flashed into the
+// "fr" data partition (see partitions.csv):
+//
+//   parttool.py write_partition --partition-name fr --input bowl_model.bin
+//
+// On the camera the blob is memory-mapped straight from flash, nothing is
+// copied to RAM. The same code builds on Linux (host/bowl_classify_host.cpp)
+// so accuracy and latency can be checked against a recorded image set.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BOWL_MODEL_MAGIC   0x314C5742  // "BWL1"
+#define BOWL_MODEL_VERSION 1
+#define BOWL_MAX_INPUT     (48 * 48)
+#define BOWL_MAX_HIDDEN    64
+
+typedef enum {
+  BOWL_NORMAL = 0,
+  BOWL_TIPPED,
+  BOWL_NOT_FOUND,
+  BOWL_CLASS_MAX
+} bowl_class_t;
+
+// All offsets are relative to the start of the blob and 4-byte aligned.
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t total_size;
+  uint16_t in_w;    // network input, e.g. 32x32 grayscale
+  uint16_t in_h;
+  uint16_t hidden;  // hidden units
+  uint16_t classes;
+  uint16_t crop_x;  // bowl crop inside the frame, in 1/1000 of width/height
+  uint16_t crop_y;
+  uint16_t crop_w;
+  uint16_t crop_h;
+  int32_t l1_mult;  // hidden = clamp((acc1 * l1_mult) >> l1_shift, 0, 127)
+  int32_t l1_shift;
+  float out_scale;  // logits * out_scale -> float logits for softmax
+  uint32_t w1_off;  // int8  [hidden][in_w * in_h]
+  uint32_t b1_off;  // int32 [hidden]
+  uint32_t w2_off;  // int8  [classes][hidden]
+  uint32_t b2_off;  // int32 [classes]
+} bowl_model_header_t;
+
+typedef struct {
+  const bowl_model_header_t *hdr;
+  const int8_t *w1;
+  const int32_t *b1;
+  const int8_t *w2;
+  const int32_t *b2;
+} bowl_model_t;
+
+typedef struct {
+  bowl_class_t label;
+  float confidence;  // softmax probability of label
+  int32_t logits[BOWL_CLASS_MAX];
+} bowl_result_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *bowl_class_name(bowl_class_t c);
+
+// Validates a blob and fills the model pointers. The blob must outlive the model.
+bool bowl_model_load(bowl_model_t *model, const void *blob, size_t len);
+
+// Crops the bowl region out of a grayscale frame, resamples it to the network
+// input size and normalizes it to int8. `input` must hold in_w * in_h values.
+void bowl_preprocess(const bowl_model_t *model, const uint8_t *luma, uint16_t width, uint16_t height, int8_t *input);
+
+void bowl_infer(const bowl_model_t *model, const int8_t *input, bowl_result_t *result);
+
+// preprocess + infer
+bool bowl_classify(const bowl_model_t *model, const uint8_t *luma, uint16_t width, uint16_t height, bowl_result_t *result);
+
+#if defined(ARDUINO)
+// Maps the "fr" partition and loads the model found there.
+bool bowl_model_load_partition(bowl_model_t *model, const char *label);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BOWL_CLASSIFIER_H
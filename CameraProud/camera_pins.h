@@ -179,6 +179,9 @@
 // 4 for flash led or 33 for normal led
 #define LED_GPIO_NUM   4
 
+// microSD slot, driven in 1-bit SD_MMC mode so GPIO4 stays the flash LED
+#define SD_MMC_1BIT    1
+
 #elif defined(CAMERA_MODEL_TTGO_T_JOURNAL)
 #define PWDN_GPIO_NUM  0
 #define RESET_GPIO_NUM 15
@@ -0,0 +1,200 @@
+#include <Preferences.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "camera_roi.h"
+#include "frame_ring.h"
+#include "sensor_modes.h"
+
+#define ROI_NVS_NAMESPACE "camroi"
+#define ROI_STALE_FRAMES  4  // max frames dropped while the new window settles
+
+static camera_roi_t rois[ROI_MAX];
+static int roi_used = 0;
+static char upload_name[ROI_NAME_LEN] = "";
+static SemaphoreHandle_t roi_mutex = NULL;  // the table and the upload name
+
+static void roi_key(int index, char *key) {
+  snprintf(key, 8, "r%d", index);
+}
+
+static bool roi_store() {
+  Preferences prefs;
+  if (!prefs.begin(ROI_NVS_NAMESPACE, false)) {
+    log_e("ROI: NVS open failed");
+    return false;
+  }
+  char key[8];
+  bool ok = true;
+  for (int i = 0; i < ROI_MAX; i++) {
+    roi_key(i, key);
+    if (i < roi_used) {
+      ok &= prefs.putBytes(key, &rois[i], sizeof(camera_roi_t)) == sizeof(camera_roi_t);
+    } else if (prefs.isKey(key)) {
+      prefs.remove(key);
+    }
+  }
+  ok &= prefs.putString("upload", upload_name) == strlen(upload_name);
+  prefs.end();
+  return ok;
+}
+
+void roi_init() {
+  if (!roi_mutex) {
+    roi_mutex = xSemaphoreCreateMutex();
+  }
+
+  Preferences prefs;
+  if (!prefs.begin(ROI_NVS_NAMESPACE, true)) {
+    // namespace does not exist before the first save
+    return;
+  }
+  char key[8];
+  roi_used = 0;
+  for (int i = 0; i < ROI_MAX; i++) {
+    roi_key(i, key);
+    if (prefs.getBytesLength(key) == sizeof(camera_roi_t) && prefs.getBytes(key, &rois[roi_used], sizeof(camera_roi_t)) == sizeof(camera_roi_t)) {
+      rois[roi_used].name[ROI_NAME_LEN - 1] = 0;
+      roi_used++;
+    }
+  }
+  prefs.getString("upload", upload_name, sizeof(upload_name));
+  prefs.end();
+  log_i("ROI: %d region(s) loaded, upload ROI: '%s'", roi_used, upload_name);
+}
+
+// Callers hold roi_mutex
+static camera_roi_t *roi_slot(const char *name) {
+  for (int i = 0; i < roi_used; i++) {
+    if (!strcmp(rois[i].name, name)) {
+      return &rois[i];
+    }
+  }
+  return NULL;
+}
+
+int roi_count() {
+  return roi_used;
+}
+
+bool roi_at(int index, camera_roi_t *roi) {
+  xSemaphoreTake(roi_mutex, portMAX_DELAY);
+  bool found = index >= 0 && index < roi_used;
+  if (found) {
+    *roi = rois[index];
+  }
+  xSemaphoreGive(roi_mutex);
+  return found;
+}
+
+bool roi_find(const char *name, camera_roi_t *roi) {
+  xSemaphoreTake(roi_mutex, portMAX_DELAY);
+  const camera_roi_t *slot = roi_slot(name);
+  if (slot && roi) {
+    *roi = *slot;
+  }
+  xSemaphoreGive(roi_mutex);
+  return slot;
+}
+
+bool roi_save(const camera_roi_t *roi) {
+  if (!roi->name[0]) {
+    return false;
+  }
+  xSemaphoreTake(roi_mutex, portMAX_DELAY);
+  camera_roi_t *slot = roi_slot(roi->name);
+  if (!slot && roi_used < ROI_MAX) {
+    slot = &rois[roi_used++];
+  }
+  bool ok = false;
+  if (slot) {
+    *slot = *roi;
+    ok = roi_store();
+  } else {
+    log_e("ROI: table full");
+  }
+  xSemaphoreGive(roi_mutex);
+  return ok;
+}
+
+bool roi_delete(const char *name) {
+  xSemaphoreTake(roi_mutex, portMAX_DELAY);
+  camera_roi_t *roi = roi_slot(name);
+  bool ok = false;
+  if (roi) {
+    int index = roi - rois;
+    memmove(&rois[index], &rois[index + 1], (roi_used - index - 1) * sizeof(camera_roi_t));
+    roi_used--;
+    if (!strcmp(upload_name, name)) {
+      upload_name[0] = 0;
+    }
+    ok = roi_store();
+  }
+  xSemaphoreGive(roi_mutex);
+  return ok;
+}
+
+const char *roi_upload_name() {
+  return upload_name;
+}
+
+bool roi_set_upload_name(const char *name) {
+  xSemaphoreTake(roi_mutex, portMAX_DELAY);
+  bool ok = !name[0] || roi_slot(name);
+  if (ok) {
+    strlcpy(upload_name, name, sizeof(upload_name));
+    ok = roi_store();
+  }
+  xSemaphoreGive(roi_mutex);
+  return ok;
+}
+
+camera_fb_t *roi_capture(const char *name, int64_t not_before) {
+  // the entry is copied, a /roi request may change the table meanwhile
+  camera_roi_t roi;
+  sensor_t *s = esp_camera_sensor_get();
+  if (!roi_find(name, &roi) || !s || s->pixformat != PIXFORMAT_JPEG) {
+    return NULL;
+  }
+
+  // The sensor lock keeps ROI captures and /capture?framesize= mode switches
+  // from reprogramming the sensor under each other. The ring's capture task is
+  // paused meanwhile: it would race for the frame buffers, and /stream and the
+  // analytics frame would get the windowed frames.
+  sensor_lock();
+  bool paused = frame_ring_pause();
+  framesize_t framesize = s->status.framesize;
+  camera_fb_t *fb = NULL;
+  if (s->set_res_raw(
+        s, roi.startX, roi.startY, roi.endX, roi.endY, roi.offsetX, roi.offsetY, roi.totalX, roi.totalY,  // codespell:ignore totaly
+        roi.outputX, roi.outputY, roi.scale, roi.binning
+      )
+      == 0) {
+    // drop the frames that were already exposed or buffered with the old window
+    int64_t windowed = esp_timer_get_time();
+    if (windowed < not_before) {
+      windowed = not_before;
+    }
+    for (int i = 0; i < ROI_STALE_FRAMES; i++) {
+      fb = esp_camera_fb_get();
+      if (!fb) {
+        break;
+      }
+      int64_t ts = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+      if (ts >= windowed) {
+        break;
+      }
+      esp_camera_fb_return(fb);
+      fb = NULL;
+    }
+  } else {
+    log_e("ROI: set_res_raw failed for '%s'", name);
+  }
+  s->set_framesize(s, framesize);
+  if (paused) {
+    frame_ring_resume(esp_timer_get_time());
+  }
+  sensor_unlock();
+  return fb;
+}
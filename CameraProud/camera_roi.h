@@ -0,0 +1,55 @@
+#ifndef CAMERA_ROI_H
+#define CAMERA_ROI_H
+
+//
+// Named sensor regions of interest, persisted in NVS.
+//
+// A ROI holds the same raw window as the /resolution (win_handler) knob and is
+// programmed with set_res_raw(), so the sensor itself only reads out and
+// compresses the bowl region: smaller JPEGs and cheaper inference.
+//
+
+#include "esp_camera.h"
+
+#define ROI_NAME_LEN 16
+#define ROI_MAX      4
+
+typedef struct {
+  char name[ROI_NAME_LEN];
+  int16_t startX;
+  int16_t startY;
+  int16_t endX;
+  int16_t endY;
+  int16_t offsetX;
+  int16_t offsetY;
+  int16_t totalX;
+  int16_t totalY;  // codespell:ignore totaly
+  int16_t outputX;
+  int16_t outputY;
+  uint8_t scale;
+  uint8_t binning;
+} camera_roi_t;
+
+void roi_init();
+
+// The table is shared by the HTTP tasks and the uploader, lookups copy the
+// entry out. `roi` may be NULL to only test for it.
+int roi_count();
+bool roi_at(int index, camera_roi_t *roi);
+bool roi_find(const char *name, camera_roi_t *roi = NULL);
+bool roi_save(const camera_roi_t *roi);
+bool roi_delete(const char *name);
+
+// ROI the uploader asks for, empty when uploads use the full frame
+const char *roi_upload_name();
+bool roi_set_upload_name(const char *name);
+
+// Windows the sensor on the ROI, grabs the first frame exposed with the new
+// window and restores the current frame size. Frames starting before
+// `not_before` (esp_timer clock, e.g. a flash_acquire() result) are dropped as
+// well. The frame ring's capture task is paused meanwhile and skips the
+// windowed frames once it resumes. The caller returns the frame with
+// esp_camera_fb_return(). Returns NULL if the ROI is unknown.
+camera_fb_t *roi_capture(const char *name, int64_t not_before = 0);
+
+#endif  // CAMERA_ROI_H
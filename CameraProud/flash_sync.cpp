@@ -0,0 +1,95 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "frame_ring.h"
+#include "flash_sync.h"
+
+static void (*led_fn)(bool on) = NULL;
+static SemaphoreHandle_t flash_mutex = NULL;
+static esp_timer_handle_t off_timer = NULL;
+static int users = 0;
+static int64_t on_since = 0;  // 0 while the LED is off
+static int64_t frame_us = FLASH_DEFAULT_FRAME_US;
+
+static void flash_off(void *arg) {
+  xSemaphoreTake(flash_mutex, portMAX_DELAY);
+  if (!users && on_since) {
+    led_fn(false);
+    on_since = 0;
+  }
+  xSemaphoreGive(flash_mutex);
+}
+
+void flash_sync_init(void (*set_led)(bool on)) {
+  if (flash_mutex) {
+    return;
+  }
+  led_fn = set_led;
+  flash_mutex = xSemaphoreCreateMutex();
+  const esp_timer_create_args_t args = {
+    .callback = flash_off,
+    .arg = NULL,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "flash_off",
+    .skip_unhandled_events = true,
+  };
+  esp_timer_create(&args, &off_timer);
+}
+
+// Frame period from the ring when it has frames, else the last measurement.
+static int64_t frame_period() {
+  ring_stats_t ring;
+  frame_ring_stats(&ring);
+  if (ring.frames >= 2 && ring.newest_ts > ring.oldest_ts) {
+    frame_us = (ring.newest_ts - ring.oldest_ts) / (ring.frames - 1);
+  }
+  return frame_us;
+}
+
+int64_t flash_acquire() {
+  int64_t period = frame_period();
+  xSemaphoreTake(flash_mutex, portMAX_DELAY);
+  users++;
+  esp_timer_stop(off_timer);
+  if (!on_since) {
+    led_fn(true);
+    on_since = esp_timer_get_time();
+  }
+  int64_t lit_ts = on_since + period;
+  xSemaphoreGive(flash_mutex);
+  return lit_ts;
+}
+
+void flash_release() {
+  xSemaphoreTake(flash_mutex, portMAX_DELAY);
+  if (users && !--users) {
+    esp_timer_start_once(off_timer, (uint64_t)FLASH_HOLD_MS * 1000);
+  }
+  xSemaphoreGive(flash_mutex);
+}
+
+camera_fb_t *flash_fb_get(int64_t lit_ts) {
+  int64_t prev_ts = 0;
+  for (int i = 0; i <= FLASH_MAX_STALE; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+      return NULL;
+    }
+    int64_t ts = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    if (prev_ts && ts > prev_ts) {
+      frame_us = ts - prev_ts;
+    }
+    if (ts >= lit_ts) {
+      return fb;
+    }
+    if (i == FLASH_MAX_STALE) {
+      log_w("Flash: no lit frame after %d frames", FLASH_MAX_STALE);
+      return fb;
+    }
+    prev_ts = ts;
+    esp_camera_fb_return(fb);
+  }
+  return NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef FLASH_SYNC_H
+#define FLASH_SYNC_H
+
+//
+// Flash LED synchronized to frame timestamps.
+//
+// fb->timestamp is taken at VSYNC, i.e. when readout of a frame starts. A
+// frame whose readout starts less than one frame period after the LED came on
+// had rows exposing while the LED was still off, so the first fully lit frame
+// is the first one with timestamp >= LED on + frame period. Capturing waits
+// for exactly that frame instead of sleeping a fixed 150 ms.
+//
+// The LED stays on for FLASH_HOLD_MS after the last lit capture, so a burst of
+// captures shares one flash-on period and only the first pays the wait.
+//
+
+#include "esp_camera.h"
+
+#define FLASH_HOLD_MS          400
+#define FLASH_DEFAULT_FRAME_US 100000  // until a frame period has been measured
+#define FLASH_MAX_STALE        6       // max frames dropped waiting for a lit one
+
+// `set_led` switches the LED, it is called from the caller's task and from the
+// esp_timer task.
+void flash_sync_init(void (*set_led)(bool on));
+
+// Turns the LED on (or keeps it on) and returns the earliest start-of-frame
+// timestamp that is fully lit. Every call needs a flash_release().
+int64_t flash_acquire();
+void flash_release();
+
+// Next frame buffer with timestamp >= `lit_ts`, dropping older ones. With the
+// frame ring running, use frame_ring_since() instead.
+camera_fb_t *flash_fb_get(int64_t lit_ts);
+
+#endif  // FLASH_SYNC_H
@@ -0,0 +1,410 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "jpg_pool.h"
+#include "esp32-hal-log.h"
+#include "frame_ring.h"
+#include "perf_metrics.h"
+
+#define RING_ALIGN(x)   (((x) + 3) & ~3)
+#define RING_SLOT(i)    slots[(head + (i)) % RING_MAX_FRAMES]
+#define RING_POLL_TICKS pdMS_TO_TICKS(5)
+
+typedef struct {
+  uint32_t seq;
+  int64_t timestamp;
+  size_t offset;
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  uint16_t refs;
+  bool ready;
+} ring_slot_t;
+
+typedef struct {
+  bool active;
+  uint32_t first_seq;
+  int64_t end_ts;
+  int64_t expires;
+} ring_hold_t;
+
+static uint8_t *storage = NULL;
+static size_t budget = 0;
+static int64_t window_us = 0;
+static ring_slot_t slots[RING_MAX_FRAMES];
+static int head = 0;
+static int count = 0;
+static uint32_t next_seq = 1;
+static size_t used = 0;
+static size_t peak = 0;
+static uint32_t pushed = 0;
+static uint32_t evicted = 0;
+static uint32_t dropped = 0;
+static ring_hold_t hold;
+static SemaphoreHandle_t ring_mutex = NULL;
+
+// pausing the capture task, see frame_ring_pause()
+static TaskHandle_t capture_handle = NULL;
+static SemaphoreHandle_t pause_lock = NULL;  // one pauser at a time
+static SemaphoreHandle_t pause_ack = NULL;   // given by the capture task once it is idle
+static volatile bool pause_requested = false;
+static int64_t resume_after = 0;             // frames starting earlier are dropped
+
+bool frame_ring_init(size_t size, uint32_t window_ms) {
+  if (storage) {
+    return true;
+  }
+  storage = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!storage) {
+    log_e("Frame ring: cannot allocate %u bytes of PSRAM", size);
+    return false;
+  }
+  ring_mutex = xSemaphoreCreateMutex();
+  budget = size;
+  window_us = (int64_t)window_ms * 1000;
+  memset(&hold, 0, sizeof(hold));
+  log_i("Frame ring: %u bytes, %ums window", size, window_ms);
+  return true;
+}
+
+bool frame_ring_enabled() {
+  return storage != NULL;
+}
+
+static bool slot_evictable(const ring_slot_t *slot) {
+  if (slot->refs || !slot->ready) {
+    return false;
+  }
+  return !(hold.active && slot->seq >= hold.first_seq && slot->timestamp <= hold.end_ts);
+}
+
+static bool slot_overlaps(size_t pos, size_t len) {
+  for (int i = 0; i < count; i++) {
+    const ring_slot_t *slot = &RING_SLOT(i);
+    if (slot->offset < pos + len && pos < slot->offset + RING_ALIGN(slot->len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Called with the mutex held. Frames are laid out in capture order, so the
+// oldest frames are always the ones in front of the write position.
+static ring_slot_t *ring_reserve(size_t len, int64_t timestamp) {
+  size_t need = RING_ALIGN(len);
+  if (need > budget) {
+    return NULL;
+  }
+  if (hold.active && esp_timer_get_time() > hold.expires) {
+    hold.active = false;
+  }
+
+  size_t pos = 0;
+  if (count) {
+    const ring_slot_t *newest = &RING_SLOT(count - 1);
+    pos = newest->offset + RING_ALIGN(newest->len);
+    if (pos + need > budget) {
+      pos = 0;
+    }
+  }
+
+  while (count) {
+    ring_slot_t *oldest = &slots[head];
+    bool overlap = slot_overlaps(pos, need);
+    bool full = count == RING_MAX_FRAMES;
+    bool stale = oldest->timestamp < timestamp - window_us;
+    if (!overlap && !full && !stale) {
+      break;
+    }
+    if (!slot_evictable(oldest)) {
+      if (overlap || full) {
+        return NULL;
+      }
+      break;  // old but pinned, keep it until it is released
+    }
+    used -= RING_ALIGN(oldest->len);
+    head = (head + 1) % RING_MAX_FRAMES;
+    count--;
+    evicted++;
+  }
+
+  ring_slot_t *slot = &RING_SLOT(count);
+  count++;
+  slot->seq = next_seq++;
+  slot->timestamp = timestamp;
+  slot->offset = pos;
+  slot->len = len;
+  slot->refs = 0;
+  slot->ready = false;
+  used += need;
+  if (used > peak) {
+    peak = used;
+  }
+  return slot;
+}
+
+static bool ring_push_jpeg(const uint8_t *jpg, size_t len, uint16_t width, uint16_t height, int64_t timestamp) {
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  ring_slot_t *slot = ring_reserve(len, timestamp);
+  if (!slot) {
+    dropped++;
+    xSemaphoreGive(ring_mutex);
+    return false;
+  }
+  slot->width = width;
+  slot->height = height;
+  uint8_t *dst = storage + slot->offset;
+  xSemaphoreGive(ring_mutex);
+
+  // the only copy of the payload; the slot is invisible to readers until ready
+  memcpy(dst, jpg, len);
+
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  slot->ready = true;
+  pushed++;
+  xSemaphoreGive(ring_mutex);
+  return true;
+}
+
+bool frame_ring_push(camera_fb_t *fb) {
+  if (!storage) {
+    return false;
+  }
+  int64_t timestamp = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  if (fb->format == PIXFORMAT_JPEG) {
+    metrics_record(METRIC_FRAME_BYTES, fb->len);
+    return ring_push_jpeg(fb->buf, fb->len, fb->width, fb->height, timestamp);
+  }
+
+  jpg_buf_t jpg;
+  int64_t encode_start = esp_timer_get_time();
+  if (!jpg_pool_encode(fb, JPG_POOL_QUALITY, &jpg)) {
+    log_e("Frame ring: JPEG compression failed");
+    return false;
+  }
+  metrics_record(METRIC_ENCODE_US, esp_timer_get_time() - encode_start);
+  metrics_record(METRIC_FRAME_BYTES, jpg.len);
+  bool res = ring_push_jpeg(jpg.buf, jpg.len, fb->width, fb->height, timestamp);
+  jpg_pool_release(&jpg);
+  return res;
+}
+
+static void ring_fill(const ring_slot_t *slot, ring_frame_t *frame) {
+  frame->seq = slot->seq;
+  frame->timestamp = slot->timestamp;
+  frame->buf = storage + slot->offset;
+  frame->len = slot->len;
+  frame->width = slot->width;
+  frame->height = slot->height;
+}
+
+bool frame_ring_next(uint32_t after_seq, ring_frame_t *frame, TickType_t wait) {
+  if (!storage) {
+    return false;
+  }
+  TickType_t start = xTaskGetTickCount();
+  while (true) {
+    xSemaphoreTake(ring_mutex, portMAX_DELAY);
+    for (int i = 0; i < count; i++) {
+      ring_slot_t *slot = &RING_SLOT(i);
+      if (slot->ready && slot->seq > after_seq) {
+        slot->refs++;
+        ring_fill(slot, frame);
+        xSemaphoreGive(ring_mutex);
+        return true;
+      }
+    }
+    xSemaphoreGive(ring_mutex);
+    if (xTaskGetTickCount() - start >= wait) {
+      return false;
+    }
+    vTaskDelay(RING_POLL_TICKS);
+  }
+}
+
+bool frame_ring_latest(uint32_t after_seq, ring_frame_t *frame, TickType_t wait) {
+  if (!storage) {
+    return false;
+  }
+  TickType_t start = xTaskGetTickCount();
+  while (true) {
+    xSemaphoreTake(ring_mutex, portMAX_DELAY);
+    for (int i = count - 1; i >= 0; i--) {
+      ring_slot_t *slot = &RING_SLOT(i);
+      if (slot->ready) {
+        if (slot->seq <= after_seq) {
+          break;
+        }
+        slot->refs++;
+        ring_fill(slot, frame);
+        xSemaphoreGive(ring_mutex);
+        return true;
+      }
+    }
+    xSemaphoreGive(ring_mutex);
+    if (xTaskGetTickCount() - start >= wait) {
+      return false;
+    }
+    vTaskDelay(RING_POLL_TICKS);
+  }
+}
+
+bool frame_ring_since(int64_t since, ring_frame_t *frame, TickType_t wait) {
+  TickType_t start = xTaskGetTickCount();
+  uint32_t after = 0;
+  while (true) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited > wait || !frame_ring_latest(after, frame, wait - waited)) {
+      return false;
+    }
+    if (frame->timestamp >= since) {
+      return true;
+    }
+    after = frame->seq;
+    frame_ring_release(frame);
+  }
+}
+
+void frame_ring_release(const ring_frame_t *frame) {
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  for (int i = 0; i < count; i++) {
+    ring_slot_t *slot = &RING_SLOT(i);
+    if (slot->seq == frame->seq) {
+      if (slot->refs) {
+        slot->refs--;
+      }
+      break;
+    }
+  }
+  xSemaphoreGive(ring_mutex);
+}
+
+bool frame_ring_hold(uint32_t pre_ms, uint32_t post_ms, uint32_t keep_ms) {
+  if (!storage) {
+    return false;
+  }
+  int64_t now = esp_timer_get_time();
+  int64_t since = now - (int64_t)pre_ms * 1000;
+
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  uint32_t first = next_seq;
+  for (int i = 0; i < count; i++) {
+    const ring_slot_t *slot = &RING_SLOT(i);
+    if (slot->ready && slot->timestamp >= since) {
+      first = slot->seq;
+      break;
+    }
+  }
+  hold.active = true;
+  hold.first_seq = first;
+  hold.end_ts = now + (int64_t)post_ms * 1000;
+  hold.expires = hold.end_ts + (int64_t)keep_ms * 1000;
+  xSemaphoreGive(ring_mutex);
+  log_i("Frame ring: holding clip from seq %u, %ums pre, %ums post", first, pre_ms, post_ms);
+  return true;
+}
+
+bool frame_ring_clip(uint32_t *first_seq, int64_t *end_ts) {
+  if (!storage) {
+    return false;
+  }
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  if (hold.active && esp_timer_get_time() > hold.expires) {
+    hold.active = false;
+  }
+  bool active = hold.active;
+  *first_seq = hold.first_seq;
+  *end_ts = hold.end_ts;
+  xSemaphoreGive(ring_mutex);
+  return active;
+}
+
+void frame_ring_release_hold(uint32_t first_seq) {
+  if (!storage) {
+    return;
+  }
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  if (hold.first_seq == first_seq) {
+    hold.active = false;
+  }
+  xSemaphoreGive(ring_mutex);
+}
+
+void frame_ring_stats(ring_stats_t *stats) {
+  memset(stats, 0, sizeof(ring_stats_t));
+  if (!storage) {
+    return;
+  }
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  stats->budget = budget;
+  stats->used = used;
+  stats->peak = peak;
+  stats->window_ms = window_us / 1000;
+  stats->frames = count;
+  stats->pushed = pushed;
+  stats->evicted = evicted;
+  stats->dropped = dropped;
+  stats->newest_seq = next_seq - 1;
+  if (count) {
+    stats->oldest_ts = slots[head].timestamp;
+    stats->newest_ts = RING_SLOT(count - 1).timestamp;
+  }
+  stats->holding = hold.active && esp_timer_get_time() <= hold.expires;
+  xSemaphoreGive(ring_mutex);
+}
+
+static void capture_task(void *arg) {
+  while (true) {
+    if (pause_requested) {
+      xSemaphoreGive(pause_ack);
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    int64_t start = esp_timer_get_time();
+    camera_fb_t *fb = esp_camera_fb_get();
+    metrics_record(METRIC_FB_GET_US, esp_timer_get_time() - start);
+    if (!fb) {
+      log_e("Camera capture failed");
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    int64_t ts = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    if (ts >= resume_after) {
+      frame_ring_push(fb);
+    }
+    esp_camera_fb_return(fb);
+  }
+}
+
+bool frame_ring_start_capture(UBaseType_t priority, BaseType_t core) {
+  if (!storage) {
+    return false;
+  }
+  if (capture_handle) {
+    return true;
+  }
+  pause_lock = xSemaphoreCreateMutex();
+  pause_ack = xSemaphoreCreateBinary();
+  return xTaskCreatePinnedToCore(capture_task, "frame_ring", 4096, NULL, priority, &capture_handle, core) == pdPASS;
+}
+
+bool frame_ring_pause() {
+  if (!capture_handle) {
+    return false;
+  }
+  xSemaphoreTake(pause_lock, portMAX_DELAY);
+  pause_requested = true;
+  // the frame being captured is pushed first, at most one frame time
+  xSemaphoreTake(pause_ack, portMAX_DELAY);
+  return true;
+}
+
+void frame_ring_resume(int64_t not_before) {
+  resume_after = not_before;
+  pause_requested = false;
+  xTaskNotifyGive(capture_handle);
+  xSemaphoreGive(pause_lock);
+}
@@ -0,0 +1,90 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+//
+// PSRAM ring of the last few seconds of JPEG frames.
+//
+// A capture task copies every frame buffer into the ring exactly once and
+// hands the buffer straight back to the driver. Readers pin frames in place
+// instead of copying them; eviction is byte-budgeted, oldest first, and never
+// touches a pinned frame or a frame held for an event clip (the new frame is
+// dropped instead).
+//
+
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+#define RING_MAX_FRAMES 64
+
+// default event clip: seconds before/after the trigger, and how long an
+// unexported clip stays pinned
+#define RING_CLIP_PRE_MS  5000
+#define RING_CLIP_POST_MS 5000
+#define RING_CLIP_KEEP_MS 60000
+
+typedef struct {
+  uint32_t seq;
+  int64_t timestamp;  // start of frame, esp_timer clock in us
+  const uint8_t *buf;
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+} ring_frame_t;
+
+typedef struct {
+  size_t budget;
+  size_t used;
+  size_t peak;
+  uint32_t window_ms;
+  uint32_t frames;
+  uint32_t pushed;
+  uint32_t evicted;
+  uint32_t dropped;
+  uint32_t newest_seq;
+  int64_t oldest_ts;
+  int64_t newest_ts;
+  bool holding;
+} ring_stats_t;
+
+// Allocates `budget` bytes of PSRAM for frames no older than `window_ms`.
+bool frame_ring_init(size_t budget, uint32_t window_ms);
+bool frame_ring_enabled();
+
+// Starts the task that feeds the ring from esp_camera_fb_get().
+bool frame_ring_start_capture(UBaseType_t priority, BaseType_t core);
+
+// Stops the capture task between two frames, so the caller can reconfigure the
+// sensor and take frames from the driver itself without racing the task. The
+// ring keeps serving the frames it holds. Returns false, and does nothing, when
+// the capture task is not running; otherwise frame_ring_resume() must follow.
+// Frames that started before `not_before` (esp_timer clock) are not pushed
+// after resuming, e.g. those still exposed with the caller's settings.
+bool frame_ring_pause();
+void frame_ring_resume(int64_t not_before = 0);
+
+// Copies the frame into the ring. Non-JPEG frames are compressed first.
+bool frame_ring_push(camera_fb_t *fb);
+
+// Pins the oldest frame newer than `after_seq`, waiting up to `wait` ticks.
+bool frame_ring_next(uint32_t after_seq, ring_frame_t *frame, TickType_t wait);
+// Pins the newest frame if it is newer than `after_seq`, waiting up to `wait`
+// ticks. Live viewers use this so a slow client skips frames instead of lagging.
+bool frame_ring_latest(uint32_t after_seq, ring_frame_t *frame, TickType_t wait);
+// Pins the newest frame that started at or after `since` (esp_timer clock),
+// waiting up to `wait` ticks for one. Serves /capture from the ring as a
+// snapshot cache and picks the first lit frame for the flash.
+bool frame_ring_since(int64_t since, ring_frame_t *frame, TickType_t wait);
+void frame_ring_release(const ring_frame_t *frame);
+
+// Event clips: keeps the frames from `pre_ms` before now to `post_ms` after
+// now out of eviction until the clip is released or `keep_ms` after its end.
+bool frame_ring_hold(uint32_t pre_ms, uint32_t post_ms, uint32_t keep_ms);
+// Current clip; `first_seq - 1` can be passed to frame_ring_next()
+bool frame_ring_clip(uint32_t *first_seq, int64_t *end_ts);
+// Releases the clip starting at `first_seq`. A newer hold that replaced it in
+// the meantime is kept.
+void frame_ring_release_hold(uint32_t first_seq);
+
+void frame_ring_stats(ring_stats_t *stats);
+
+#endif  // FRAME_RING_H
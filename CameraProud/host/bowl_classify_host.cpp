@@ -0,0 +1,140 @@
+// Runs the on-device bowl classifier on Linux against a recorded image set.
+//
+// Build:
+//   g++ -O2 -I.. -o bowl_classify_host bowl_classify_host.cpp ../bowl_classifier.cpp
+//
+// The image set is exported by AI/bowl_classifier.py (export command), which
+// decodes the recorded JPEGs at the same reduced scale as the camera and
+// writes a manifest of "<label> <file.pgm>" lines:
+//
+//   ./bowl_classify_host bowl_model.bin dataset_pgm/manifest.txt
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "bowl_classifier.h"
+
+static std::vector<uint8_t> read_file(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return data;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+  return data;
+}
+
+// binary PGM (P5, maxval 255) only
+static bool read_pgm(const char *path, std::vector<uint8_t> &pixels, uint16_t *w, uint16_t *h) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  unsigned width, height, maxval;
+  bool ok = fscanf(f, "P5 %u %u %u", &width, &height, &maxval) == 3 && maxval == 255 && fgetc(f) != EOF;
+  if (ok) {
+    pixels.resize((size_t)width * height);
+    ok = fread(pixels.data(), 1, pixels.size(), f) == pixels.size();
+    *w = width;
+    *h = height;
+  }
+  fclose(f);
+  return ok;
+}
+
+static int class_index(const char *name) {
+  for (int c = 0; c < BOWL_CLASS_MAX; c++) {
+    if (!strcmp(name, bowl_class_name((bowl_class_t)c))) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <model.bin> <manifest.txt>\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> blob = read_file(argv[1]);
+  bowl_model_t model;
+  if (!bowl_model_load(&model, blob.data(), blob.size())) {
+    fprintf(stderr, "invalid model: %s\n", argv[1]);
+    return 1;
+  }
+
+  std::string manifest = argv[2];
+  std::string base = manifest.substr(0, manifest.find_last_of('/') + 1);
+  FILE *f = fopen(argv[2], "r");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", argv[2]);
+    return 1;
+  }
+
+  int confusion[BOWL_CLASS_MAX][BOWL_CLASS_MAX] = {};
+  std::vector<double> latency;
+  char label[32], file[512];
+  while (fscanf(f, "%31s %511s", label, file) == 2) {
+    int expected = class_index(label);
+    std::vector<uint8_t> luma;
+    uint16_t w, h;
+    std::string path = file[0] == '/' ? file : base + file;
+    if (expected < 0 || !read_pgm(path.c_str(), luma, &w, &h)) {
+      fprintf(stderr, "skipping %s %s\n", label, file);
+      continue;
+    }
+
+    bowl_result_t r;
+    double start = now_us();
+    bowl_classify(&model, luma.data(), w, h, &r);
+    latency.push_back(now_us() - start);
+    confusion[expected][r.label]++;
+    printf("%s %s %s %.3f\n", file, label, bowl_class_name(r.label), r.confidence);
+  }
+  fclose(f);
+
+  if (latency.empty()) {
+    fprintf(stderr, "no images\n");
+    return 1;
+  }
+
+  int correct = 0;
+  printf("\nconfusion (rows = expected):\n%-10s", "");
+  for (int c = 0; c < BOWL_CLASS_MAX; c++) {
+    printf(" %9s", bowl_class_name((bowl_class_t)c));
+  }
+  printf("\n");
+  for (int e = 0; e < BOWL_CLASS_MAX; e++) {
+    printf("%-10s", bowl_class_name((bowl_class_t)e));
+    for (int c = 0; c < BOWL_CLASS_MAX; c++) {
+      printf(" %9d", confusion[e][c]);
+    }
+    printf("\n");
+    correct += confusion[e][e];
+  }
+
+  std::sort(latency.begin(), latency.end());
+  double sum = 0;
+  for (double l : latency) {
+    sum += l;
+  }
+  printf("\nimages: %zu, accuracy: %.2f%%\n", latency.size(), 100.0 * correct / latency.size());
+  printf("latency: mean %.1fus, p50 %.1fus, p95 %.1fus\n", sum / latency.size(), latency[latency.size() / 2], latency[latency.size() * 95 / 100]);
+  return 0;
+}
@@ -0,0 +1,250 @@
+// Compares the HTTP server profiles of httpd_profile.cpp on a running camera.
+//
+// Build:
+//   g++ -O2 -std=c++17 -pthread -o httpd_bench httpd_bench.cpp
+//
+// For every profile the camera is switched with /control?var=httpd_profile (it
+// restarts), then loaded with <streams> clients on :81/stream while one client
+// polls /status and /capture on :80 back to back, the way the web UI does.
+// stream_handler keeps the stream server's only task for as long as a stream
+// runs, so a second stream client is not served until the first one ends;
+// more than one only measures that wait.
+//
+//   ./httpd_bench 192.168.1.50 [seconds=20] [streams=1] [profiles=0,1,2]
+//
+// Reported per profile: stream frame rate (sum and slowest client), stream
+// throughput, control request latency and the number of refused or reset
+// connections.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#define BOUNDARY         "--123456789000000000000987654321"
+#define TIMEOUT_S        5
+#define RESTART_WAIT_S   60
+#define SETTLE_S         3
+
+typedef std::chrono::steady_clock clock_type;
+
+static const char *host;
+
+static double ms_since(clock_type::time_point start) {
+  return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+static int connect_to(uint16_t port) {
+  addrinfo hints = {}, *res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &res)) {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, 0);
+  timeval tv = {TIMEOUT_S, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  if (connect(fd, res->ai_addr, res->ai_addrlen)) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+static bool send_get(int fd, const char *path) {
+  char req[256];
+  int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+  return send(fd, req, n, 0) == n;
+}
+
+// GET with a fresh connection, returns the status code or -1
+static int http_get(uint16_t port, const char *path, std::string *body) {
+  int fd = connect_to(port);
+  if (fd < 0) {
+    return -1;
+  }
+  std::string response;
+  if (send_get(fd, path)) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      response.append(buf, n);
+    }
+  }
+  close(fd);
+  int status = -1;
+  if (sscanf(response.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+    return -1;
+  }
+  if (body) {
+    size_t end = response.find("\r\n\r\n");
+    *body = end == std::string::npos ? "" : response.substr(end + 4);
+  }
+  return status;
+}
+
+static int current_profile() {
+  std::string body;
+  if (http_get(80, "/status", &body) != 200) {
+    return -1;
+  }
+  size_t pos = body.find("\"httpd_profile\":");
+  return pos == std::string::npos ? -1 : atoi(body.c_str() + pos + 16);
+}
+
+static bool switch_profile(int profile) {
+  if (current_profile() == profile) {
+    return true;
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/control?var=httpd_profile&val=%d", profile);
+  int status = http_get(80, path, NULL);
+  if (status != 200) {
+    // every later profile would be measured as the current one
+    fprintf(stderr, "switching to profile %d failed: %s -> %d\n", profile, path, status);
+    exit(1);
+  }
+  sleep(2);  // restart delay
+  for (int i = 0; i < RESTART_WAIT_S; i++) {
+    if (current_profile() == profile) {
+      return true;
+    }
+    sleep(1);
+  }
+  return false;
+}
+
+struct stream_result {
+  uint32_t frames = 0;
+  uint64_t bytes = 0;
+  uint32_t errors = 0;
+};
+
+static void stream_client(std::atomic<bool> *stop, stream_result *r) {
+  while (!*stop) {
+    int fd = connect_to(81);
+    if (fd < 0 || !send_get(fd, "/stream")) {
+      r->errors++;
+      if (fd >= 0) {
+        close(fd);
+      }
+      sleep(1);
+      continue;
+    }
+    // count boundaries, keeping a tail so one split across reads is seen
+    std::string window;
+    char buf[8192];
+    ssize_t n;
+    while (!*stop && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      r->bytes += n;
+      window.append(buf, n);
+      for (size_t pos = 0; (pos = window.find(BOUNDARY, pos)) != std::string::npos; pos += strlen(BOUNDARY)) {
+        r->frames++;
+      }
+      size_t keep = strlen(BOUNDARY) - 1;
+      if (window.size() > keep) {
+        window.erase(0, window.size() - keep);
+      }
+    }
+    if (!*stop) {
+      r->errors++;  // closed by the camera, e.g. by LRU purge
+    }
+    close(fd);
+  }
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <camera> [seconds=20] [streams=1] [profiles=0,1,2]\n", argv[0]);
+    return 1;
+  }
+  host = argv[1];
+  int seconds = argc > 2 ? atoi(argv[2]) : 20;
+  int streams = argc > 3 ? atoi(argv[3]) : 1;
+  std::vector<int> profiles;
+  for (const char *p = argc > 4 ? argv[4] : "0,1,2"; *p;) {
+    profiles.push_back(strtol(p, (char **)&p, 10));
+    if (*p == ',') {
+      p++;
+    }
+  }
+
+  printf("profile  fps_sum  fps_min   Mbps  status_p50  status_p95  capture_p50  capture_p95  max_ms  errors\n");
+  for (int profile : profiles) {
+    if (!switch_profile(profile)) {
+      printf("%7d  camera did not come back with this profile\n", profile);
+      continue;
+    }
+    sleep(SETTLE_S);
+
+    std::atomic<bool> stop(false);
+    std::vector<stream_result> results(streams);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < streams; i++) {
+      threads.emplace_back(stream_client, &stop, &results[i]);
+    }
+
+    std::vector<double> status_ms, capture_ms;
+    uint32_t control_errors = 0;
+    clock_type::time_point start = clock_type::now();
+    while (ms_since(start) < seconds * 1000.0) {
+      clock_type::time_point t = clock_type::now();
+      if (http_get(80, "/status", NULL) == 200) {
+        status_ms.push_back(ms_since(t));
+      } else {
+        control_errors++;
+      }
+      t = clock_type::now();
+      if (http_get(80, "/capture", NULL) == 200) {
+        capture_ms.push_back(ms_since(t));
+      } else {
+        control_errors++;
+      }
+    }
+    double elapsed = ms_since(start) / 1000.0;
+    stop = true;
+    for (std::thread &t : threads) {
+      t.join();
+    }
+
+    double fps_sum = 0, fps_min = 1e9, mbps = 0;
+    uint32_t errors = control_errors;
+    for (const stream_result &r : results) {
+      fps_sum += r.frames / elapsed;
+      fps_min = std::min(fps_min, r.frames / elapsed);
+      mbps += r.bytes * 8 / elapsed / 1e6;
+      errors += r.errors;
+    }
+    std::vector<double> all(status_ms);
+    all.insert(all.end(), capture_ms.begin(), capture_ms.end());
+    printf(
+      "%7d  %7.1f  %7.1f  %5.2f  %10.0f  %10.0f  %11.0f  %11.0f  %6.0f  %6u\n", profile, fps_sum, streams ? fps_min : 0, mbps, percentile(status_ms, 0.5),
+      percentile(status_ms, 0.95), percentile(capture_ms, 0.5), percentile(capture_ms, 0.95), percentile(all, 1), errors
+    );
+    fflush(stdout);
+  }
+  return 0;
+}
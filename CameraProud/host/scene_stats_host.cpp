@@ -0,0 +1,238 @@
+// Checks scene_stats.cpp on Linux against fully decoded JPEGs.
+//
+// Build:
+//   g++ -O2 -I.. -o scene_stats_host scene_stats_host.cpp ../scene_stats.cpp -ljpeg
+//
+// Every JPEG is decoded to luma with libjpeg, and the means of its 8x8 blocks
+// are binned the way scene_stats_from_jpeg() bins the DC coefficients. The
+// DC-only numbers must match them within rounding:
+//
+//   ./scene_stats_host                  encodes and checks a synthetic set:
+//                                       4:2:0, 4:2:2, 4:4:4, grayscale, with
+//                                       and without restart intervals
+//   ./scene_stats_host a.jpg b.jpg ...  checks recorded frames
+//
+// It also feeds truncated and corrupted copies of each JPEG through the
+// parser, which must reject or survive them. Exits with 1 on any mismatch.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <jpeglib.h>
+#include "scene_stats.h"
+
+#define MEAN_TOLERANCE    2  // levels, edge blocks and IDCT rounding
+#define GRID_TOLERANCE    3
+#define PERCENT_TOLERANCE 2
+
+static std::vector<uint8_t> read_file(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return data;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+  return data;
+}
+
+// hs/vs: luma sampling factors, 0 for grayscale
+static std::vector<uint8_t> encode(int w, int h, int hs, int vs, int restart, int quality) {
+  std::vector<uint8_t> rgb((size_t)w * h * 3);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      uint8_t *p = &rgb[((size_t)y * w + x) * 3];
+      // a gradient with a black and a white patch, so dark and bright are not empty
+      int v = x * 255 / w;
+      if (x < w / 4 && y < h / 3) {
+        v = 0;
+      } else if (x >= w * 3 / 4 && y >= h * 2 / 3) {
+        v = 255;
+      } else {
+        v = (v + ((x * 7 + y * 13) % 23) - 11) & 0xFF;
+      }
+      p[0] = v;
+      p[1] = v;
+      p[2] = (v * 3 + (y & 0xFF)) / 4;  // some chroma
+    }
+  }
+
+  jpeg_compress_struct c;
+  jpeg_error_mgr err;
+  c.err = jpeg_std_error(&err);
+  jpeg_create_compress(&c);
+  unsigned char *out = NULL;
+  unsigned long out_len = 0;
+  jpeg_mem_dest(&c, &out, &out_len);
+  c.image_width = w;
+  c.image_height = h;
+  c.input_components = 3;
+  c.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&c);
+  if (!hs) {
+    jpeg_set_colorspace(&c, JCS_GRAYSCALE);
+  } else {
+    c.comp_info[0].h_samp_factor = hs;
+    c.comp_info[0].v_samp_factor = vs;
+  }
+  c.restart_interval = restart;
+  jpeg_set_quality(&c, quality, TRUE);
+  jpeg_start_compress(&c, TRUE);
+  while (c.next_scanline < c.image_height) {
+    JSAMPROW row = &rgb[(size_t)c.next_scanline * w * 3];
+    jpeg_write_scanlines(&c, &row, 1);
+  }
+  jpeg_finish_compress(&c);
+  jpeg_destroy_compress(&c);
+  std::vector<uint8_t> jpg(out, out + out_len);
+  free(out);
+  return jpg;
+}
+
+static bool decode_luma(const std::vector<uint8_t> &jpg, std::vector<uint8_t> &luma, int *w, int *h) {
+  jpeg_decompress_struct d;
+  jpeg_error_mgr err;
+  d.err = jpeg_std_error(&err);
+  jpeg_create_decompress(&d);
+  jpeg_mem_src(&d, jpg.data(), jpg.size());
+  if (jpeg_read_header(&d, TRUE) != JPEG_HEADER_OK) {
+    jpeg_destroy_decompress(&d);
+    return false;
+  }
+  d.out_color_space = JCS_GRAYSCALE;  // Y as coded, no color conversion
+  d.dct_method = JDCT_ISLOW;
+  jpeg_start_decompress(&d);
+  *w = d.output_width;
+  *h = d.output_height;
+  luma.resize((size_t)*w * *h);
+  while (d.output_scanline < d.output_height) {
+    JSAMPROW row = &luma[(size_t)d.output_scanline * *w];
+    jpeg_read_scanlines(&d, &row, 1);
+  }
+  jpeg_finish_decompress(&d);
+  jpeg_destroy_decompress(&d);
+  return true;
+}
+
+// The same statistics as scene_stats_from_jpeg(), from the decoded block means
+static void reference_stats(const std::vector<uint8_t> &luma, int w, int h, scene_stats_t *stats) {
+  int block_cols = (w + 7) / 8;
+  int block_rows = (h + 7) / 8;
+  uint32_t sums[SCENE_GRID_ROWS * SCENE_GRID_COLS] = {0};
+  uint32_t counts[SCENE_GRID_ROWS * SCENE_GRID_COLS] = {0};
+  uint32_t total = 0, blocks = 0, dark = 0, bright = 0;
+  for (int by = 0; by < block_rows; by++) {
+    for (int bx = 0; bx < block_cols; bx++) {
+      uint32_t sum = 0, n = 0;
+      for (int y = by * 8; y < by * 8 + 8 && y < h; y++) {
+        for (int x = bx * 8; x < bx * 8 + 8 && x < w; x++) {
+          sum += luma[(size_t)y * w + x];
+          n++;
+        }
+      }
+      int level = (sum + n / 2) / n;
+      int region = (by * SCENE_GRID_ROWS / block_rows) * SCENE_GRID_COLS + bx * SCENE_GRID_COLS / block_cols;
+      sums[region] += level;
+      counts[region]++;
+      total += level;
+      blocks++;
+      dark += level < SCENE_DARK;
+      bright += level >= SCENE_BRIGHT;
+    }
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->width = w;
+  stats->height = h;
+  stats->blocks = blocks;
+  stats->mean = total / blocks;
+  for (int i = 0; i < SCENE_GRID_ROWS * SCENE_GRID_COLS; i++) {
+    stats->grid[i] = counts[i] ? sums[i] / counts[i] : 0;
+  }
+  stats->dark = (dark * 100 + blocks / 2) / blocks;
+  stats->bright = (bright * 100 + blocks / 2) / blocks;
+}
+
+static bool near(int a, int b, int tolerance) {
+  return abs(a - b) <= tolerance;
+}
+
+// Truncated copies and flipped header bytes must not crash the parser or read
+// past the buffer (run under -fsanitize=address to see the latter).
+static void fuzz(const std::vector<uint8_t> &jpg) {
+  scene_stats_t stats;
+  for (size_t len = 0; len < jpg.size(); len += len < 1024 ? 5 : 97) {
+    std::vector<uint8_t> cut(jpg.begin(), jpg.begin() + len);
+    scene_stats_from_jpeg(cut.data(), cut.size(), &stats);
+  }
+  srand(1);
+  for (int i = 0; i < 300; i++) {
+    std::vector<uint8_t> bad = jpg;
+    size_t at = rand() % (bad.size() < 1024 ? bad.size() : 1024);
+    bad[at] ^= 1 << (rand() % 8);
+    scene_stats_from_jpeg(bad.data(), bad.size(), &stats);
+  }
+}
+
+static bool check(const char *name, const std::vector<uint8_t> &jpg) {
+  std::vector<uint8_t> luma;
+  int w, h;
+  if (!decode_luma(jpg, luma, &w, &h)) {
+    printf("%-24s not a JPEG libjpeg can decode\n", name);
+    return false;
+  }
+  scene_stats_t want, got;
+  reference_stats(luma, w, h, &want);
+  if (!scene_stats_from_jpeg(jpg.data(), jpg.size(), &got)) {
+    printf("%-24s FAIL: rejected\n", name);
+    return false;
+  }
+
+  bool ok = got.width == want.width && got.height == want.height && got.blocks == want.blocks && near(got.mean, want.mean, MEAN_TOLERANCE)
+            && near(got.dark, want.dark, PERCENT_TOLERANCE) && near(got.bright, want.bright, PERCENT_TOLERANCE);
+  int worst = 0;
+  for (int i = 0; i < SCENE_GRID_ROWS * SCENE_GRID_COLS; i++) {
+    int diff = abs(got.grid[i] - want.grid[i]);
+    worst = diff > worst ? diff : worst;
+  }
+  ok = ok && worst <= GRID_TOLERANCE;
+  printf(
+    "%-24s %s %ux%u blocks %u/%u mean %u/%u dark %u/%u bright %u/%u grid +-%d\n", name, ok ? "ok  " : "FAIL", got.width, got.height, got.blocks, want.blocks,
+    got.mean, want.mean, got.dark, want.dark, got.bright, want.bright, worst
+  );
+  fuzz(jpg);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int failed = 0;
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      std::vector<uint8_t> jpg = read_file(argv[i]);
+      failed += !check(argv[i], jpg);
+    }
+    return failed ? 1 : 0;
+  }
+
+  static const struct {
+    const char *name;
+    int hs, vs, restart;
+  } sets[] = {
+    {"4:2:0", 2, 2, 0}, {"4:2:2", 2, 1, 0}, {"4:4:4", 1, 1, 0}, {"gray", 0, 0, 0}, {"4:2:0 restart 3", 2, 2, 3}, {"4:2:2 restart 1", 2, 1, 1}, {"gray restart 7", 0, 0, 7},
+  };
+  for (const auto &set : sets) {
+    for (int quality : {12, 80, 97}) {
+      // odd sizes leave partial MCUs on the right and bottom edges
+      std::vector<uint8_t> jpg = encode(331, 245, set.hs, set.vs, set.restart, quality);
+      char name[48];
+      snprintf(name, sizeof(name), "%s q%d", set.name, quality);
+      failed += !check(name, jpg);
+    }
+  }
+  printf("\n%d failed\n", failed);
+  return failed ? 1 : 0;
+}
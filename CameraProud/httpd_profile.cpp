@@ -0,0 +1,99 @@
+#include <Preferences.h>
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp32-hal-log.h"
+#include "sdkconfig.h"
+#include "httpd_profile.h"
+
+#define HTTPD_NVS_NAMESPACE "httpd"
+#define HTTPD_RESTART_DELAY (500 * 1000)  // us
+
+// Sockets outside the two servers' clients: both listening sockets and their
+// control sockets, RTSP with one session, MQTT and the uploader
+#define HTTPD_OTHER_SOCKETS 10
+
+static const httpd_profile_t profiles[] = {
+  // IDF defaults, the baseline for host/httpd_bench.cpp
+  {"default", {5, tskNO_AFFINITY, 4096, 7, false}, {5, tskNO_AFFINITY, 4096, 7, false}},
+  // Streams on the core WiFi does not run on, one above the capture task so a
+  // frame goes out as soon as it is in the ring. The control server is sized
+  // by HTTPD_CONTROL_SOCKETS and never closes a WS client or a long poll to
+  // make room. The stream server has one socket, purged when a new client
+  // arrives after a finished /clip left its keep-alive connection open.
+  {"pinned", {5, tskNO_AFFINITY, 4096, HTTPD_CONTROL_SOCKETS, false}, {6, HTTPD_APP_CORE, 4096, HTTPD_STREAM_SOCKETS, true}},
+  // Like "pinned", with the control server on the WiFi core below the stream
+  // server, so UI and /status polling never preempt a stream.
+  {"split", {4, HTTPD_WIFI_CORE, 4096, HTTPD_CONTROL_SOCKETS, false}, {6, HTTPD_APP_CORE, 4096, HTTPD_STREAM_SOCKETS, true}},
+};
+
+int httpd_profile_count() {
+  return sizeof(profiles) / sizeof(profiles[0]);
+}
+
+const httpd_profile_t *httpd_profile_get(int index) {
+  if (index < 0 || index >= httpd_profile_count()) {
+    return NULL;
+  }
+  return &profiles[index];
+}
+
+int httpd_profile_load(int build_default) {
+  int index = build_default;
+  Preferences prefs;
+  // namespace does not exist before the first select
+  if (prefs.begin(HTTPD_NVS_NAMESPACE, true)) {
+    index = prefs.getUChar("profile", build_default);
+    prefs.end();
+  }
+  if (!httpd_profile_get(index)) {
+    index = build_default;
+  }
+  const httpd_profile_t *p = &profiles[index];
+  int sockets = p->control.max_open_sockets + p->stream.max_open_sockets;
+  // Over budget only when every client is connected at once; lwIP then
+  // refuses the next accept() and established connections stay open.
+  log_i("HTTPD profile '%s': %d client sockets, %d of %d lwIP sockets with all open", p->name, sockets,
+        sockets + HTTPD_OTHER_SOCKETS, CONFIG_LWIP_MAX_SOCKETS);
+  return index;
+}
+
+void httpd_profile_apply(httpd_config_t *config, const httpd_server_profile_t *server) {
+  config->task_priority = server->priority;
+  config->core_id = server->core_id;
+  config->stack_size = server->stack_size;
+  config->max_open_sockets = server->max_open_sockets;
+  config->lru_purge_enable = server->lru_purge_enable;
+}
+
+static void restart(void *arg) {
+  esp_restart();
+}
+
+bool httpd_profile_select(int index) {
+  if (!httpd_profile_get(index)) {
+    return false;
+  }
+  Preferences prefs;
+  if (!prefs.begin(HTTPD_NVS_NAMESPACE, false)) {
+    log_e("HTTPD profile: NVS open failed");
+    return false;
+  }
+  bool ok = prefs.putUChar("profile", index) == 1;
+  prefs.end();
+  if (!ok) {
+    return false;
+  }
+
+  static esp_timer_handle_t timer = NULL;
+  if (!timer) {
+    esp_timer_create_args_t args = {};
+    args.callback = restart;
+    args.name = "httpd_restart";
+    if (esp_timer_create(&args, &timer) != ESP_OK) {
+      return false;
+    }
+  }
+  log_i("HTTPD profile '%s' selected, restarting", profiles[index].name);
+  esp_timer_start_once(timer, HTTPD_RESTART_DELAY);
+  return true;
+}
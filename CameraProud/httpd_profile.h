@@ -0,0 +1,73 @@
+#ifndef HTTPD_PROFILE_H
+#define HTTPD_PROFILE_H
+
+//
+// Task and socket settings of the two camera HTTP servers.
+//
+// HTTPD_DEFAULT_CONFIG() starts both servers at priority 5 on any core, with 7
+// sockets each and no LRU purge. That is 14 client sockets out of the 16 lwIP
+// has (CONFIG_LWIP_MAX_SOCKETS, fixed in the Arduino core), before the
+// listening sockets, RTSP, MQTT and the uploader. Once they run out, a new
+// browser tab is refused until an old keep-alive connection times out.
+//
+// A profile sets both servers at once. The build default is
+// CONFIG_HTTPD_PROFILE in app_httpd.cpp. /control?var=httpd_profile&val=<index>
+// stores another one in NVS and restarts, because a running httpd cannot be
+// reconfigured. host/httpd_bench.cpp loads each profile in turn and compares
+// them.
+//
+
+#include "esp_http_server.h"
+#include "ws_channel.h"
+
+// WiFi tasks run on this core, the stream server is pinned to the other one
+#if defined(CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1)
+#define HTTPD_WIFI_CORE 1
+#else
+#define HTTPD_WIFI_CORE 0
+#endif
+#if CONFIG_FREERTOS_UNICORE
+#define HTTPD_APP_CORE tskNO_AFFINITY
+#else
+#define HTTPD_APP_CORE (1 - HTTPD_WIFI_CORE)
+#endif
+
+// Client sockets of the control server in the tuned profiles. /ws clients and
+// ?newer= long polls keep their connection open for as long as they last, and
+// httpd counts a session as used only when a request arrives on it, so LRU
+// purge would close exactly those first. The control server therefore gets
+// room for all of them plus a few UI connections, and never purges.
+#define HTTPD_UI_SOCKETS       2
+#define HTTPD_LONGPOLL_SOCKETS 2  // one long-poll waiter task each, see app_httpd.cpp
+#define HTTPD_CONTROL_SOCKETS  (HTTPD_UI_SOCKETS + WS_MAX_CLIENTS + HTTPD_LONGPOLL_SOCKETS)
+
+// stream_handler runs in the stream server's only task until the viewer
+// leaves, so /stream, and /clip behind it, serve one client at a time. A
+// second socket would only hold a connection the task cannot get to.
+#define HTTPD_STREAM_SOCKETS 1
+
+typedef struct {
+  UBaseType_t priority;
+  BaseType_t core_id;
+  size_t stack_size;
+  uint16_t max_open_sockets;
+  bool lru_purge_enable;  // close the least recently used socket instead of refusing
+} httpd_server_profile_t;
+
+typedef struct {
+  const char *name;
+  httpd_server_profile_t control;  // camera_httpd: UI, /capture, /status, /ws
+  httpd_server_profile_t stream;   // stream_httpd: /stream, /clip
+} httpd_profile_t;
+
+// Profile stored in NVS, or `build_default` when none is stored.
+int httpd_profile_load(int build_default);
+const httpd_profile_t *httpd_profile_get(int index);
+int httpd_profile_count();
+
+void httpd_profile_apply(httpd_config_t *config, const httpd_server_profile_t *server);
+
+// Stores `index` and restarts a moment later, after the reply went out.
+bool httpd_profile_select(int index);
+
+#endif  // HTTPD_PROFILE_H
@@ -0,0 +1,114 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_jpg_decode.h"
+#include "img_luma.h"
+
+static SemaphoreHandle_t decode_mutex = NULL;
+static portMUX_TYPE decode_mux = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct {
+  const uint8_t *src;
+  size_t src_len;
+  uint8_t *out;
+  uint8_t *rgb;  // optional RGB565 output
+  size_t out_len;
+  uint16_t width;
+  uint16_t height;
+} luma_decoder_t;
+
+esp_err_t jpg_decode_locked(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg) {
+  if (!decode_mutex) {
+    // first decode, possibly from two tasks at once: only one mutex is kept
+    SemaphoreHandle_t m = xSemaphoreCreateMutex();
+    if (!m) {
+      return ESP_ERR_NO_MEM;
+    }
+    portENTER_CRITICAL(&decode_mux);
+    if (!decode_mutex) {
+      decode_mutex = m;
+      m = NULL;
+    }
+    portEXIT_CRITICAL(&decode_mux);
+    if (m) {
+      vSemaphoreDelete(m);
+    }
+  }
+  xSemaphoreTake(decode_mutex, portMAX_DELAY);
+  esp_err_t res = esp_jpg_decode(len, scale, reader, writer, arg);
+  xSemaphoreGive(decode_mutex);
+  return res;
+}
+
+jpg_scale_t luma_pick_scale(uint16_t width, uint16_t min_width) {
+  int scale = JPG_SCALE_8X;
+  while (scale > JPG_SCALE_NONE && (width >> scale) < min_width) {
+    scale--;
+  }
+  return (jpg_scale_t)scale;
+}
+
+static size_t luma_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  luma_decoder_t *d = (luma_decoder_t *)arg;
+  if (index >= d->src_len) {
+    return 0;
+  }
+  if (index + len > d->src_len) {
+    len = d->src_len - index;
+  }
+  if (buf) {
+    memcpy(buf, d->src + index, len);
+  }
+  return len;
+}
+
+static bool luma_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  luma_decoder_t *d = (luma_decoder_t *)arg;
+  if (!data) {
+    if (x == 0 && y == 0) {
+      // output start
+      if ((size_t)w * h > d->out_len) {
+        return false;
+      }
+      d->width = w;
+      d->height = h;
+    }
+    return true;
+  }
+  // blocks arrive as RGB888, clip the partial MCUs at the right/bottom edge
+  for (uint16_t iy = 0; iy < h; iy++) {
+    if (y + iy >= d->height) {
+      break;
+    }
+    size_t row = (size_t)(y + iy) * d->width + x;
+    uint8_t *o = d->out + row;
+    const uint8_t *p = data + (size_t)iy * w * 3;
+    for (uint16_t ix = 0; ix < w && x + ix < d->width; ix++, p += 3) {
+      o[ix] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    }
+    if (d->rgb) {
+      uint8_t *c = d->rgb + row * 2;
+      p = data + (size_t)iy * w * 3;
+      for (uint16_t ix = 0; ix < w && x + ix < d->width; ix++, p += 3, c += 2) {
+        uint16_t v = ((p[0] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[2] >> 3);
+        c[0] = v >> 8;
+        c[1] = v & 0xFF;
+      }
+    }
+  }
+  return true;
+}
+
+bool jpg2luma(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t *out, size_t out_len, uint16_t *width, uint16_t *height) {
+  return jpg2luma_rgb565(src, src_len, scale, out, NULL, out_len, width, height);
+}
+
+bool jpg2luma_rgb565(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t *luma, uint8_t *rgb, size_t pixels, uint16_t *width, uint16_t *height) {
+  luma_decoder_t d = {src, src_len, luma, rgb, pixels, 0, 0};
+  if (jpg_decode_locked(src_len, scale, luma_read, luma_write, &d) != ESP_OK) {
+    return false;
+  }
+  *width = d.width;
+  *height = d.height;
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef IMG_LUMA_H
+#define IMG_LUMA_H
+
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "esp_jpg_decode.h"
+
+// esp_jpg_decode() behind one lock. The decoder's work area is not safe to
+// share between tasks, and the analytics task, the bowl classifier and the
+// /bmp and /raw handlers all decode ring frames, so every caller goes through
+// here. A streamed decode holds the lock while its chunks go out.
+esp_err_t jpg_decode_locked(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg);
+
+// Smallest JPEG decode scale that still leaves at least `min_width` pixels.
+jpg_scale_t luma_pick_scale(uint16_t width, uint16_t min_width);
+
+// Decodes a JPEG straight into an 8-bit luma image at the given DCT scale.
+// Only the block buffer of the decoder is used, no RGB frame is allocated.
+// `out` must hold (width >> scale) * (height >> scale) bytes.
+bool jpg2luma(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t *out, size_t out_len, uint16_t *width, uint16_t *height);
+
+// Same decode, also writing big-endian RGB565 (the driver's layout) to `rgb`,
+// which must hold 2 * `pixels` bytes. `rgb` may be NULL.
+bool jpg2luma_rgb565(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t *luma, uint8_t *rgb, size_t pixels, uint16_t *width, uint16_t *height);
+
+#endif  // IMG_LUMA_H
@@ -0,0 +1,240 @@
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_jpg_decode.h"
+#include "esp32-hal-log.h"
+#include "img_stream.h"
+#include "img_luma.h"
+
+#define BAND_MAX_ROWS   16  // tallest MCU (4:2:0) at full scale
+#define BMP_HEADER_SIZE 54
+
+typedef struct {
+  const uint8_t *src;
+  size_t src_len;
+  img_stream_format_t format;
+  jpg_out_cb cb;
+  void *arg;
+  size_t index;  // bytes sent so far
+  uint16_t width;
+  uint16_t height;
+  size_t stride;
+  uint8_t *band;
+  uint16_t band_rows;  // allocated
+  uint16_t band_y;     // first image row in the band
+  uint16_t band_h;     // rows filled
+} img_stream_t;
+
+static uint8_t stream_bpp(img_stream_format_t format) {
+  return format == IMG_STREAM_BMP ? 3 : format == IMG_STREAM_RGB565 ? 2 : 1;
+}
+
+static size_t stream_stride(img_stream_format_t format, uint16_t width) {
+  size_t len = (size_t)width * stream_bpp(format);
+  return format == IMG_STREAM_BMP ? (len + 3) & ~3 : len;  // BMP rows are 4-byte aligned
+}
+
+size_t img_stream_size(img_stream_format_t format, uint16_t width, uint16_t height) {
+  return (format == IMG_STREAM_BMP ? BMP_HEADER_SIZE : 0) + stream_stride(format, width) * height;
+}
+
+static bool stream_emit(img_stream_t *st, const void *data, size_t len) {
+  if (st->cb(st->arg, st->index, data, len) != len) {
+    return false;
+  }
+  st->index += len;
+  return true;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  put_le16(p, v & 0xFFFF);
+  put_le16(p + 2, v >> 16);
+}
+
+static bool stream_begin(img_stream_t *st, uint16_t width, uint16_t height, uint16_t band_rows) {
+  st->width = width;
+  st->height = height;
+  st->stride = stream_stride(st->format, width);
+  st->band_rows = band_rows;
+  st->band_y = 0;
+  st->band_h = 0;
+  // zeroed once, so the BMP row padding never has to be written
+  st->band = (uint8_t *)heap_caps_calloc(band_rows, st->stride, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!st->band) {
+    st->band = (uint8_t *)calloc(band_rows, st->stride);
+  }
+  if (!st->band) {
+    log_e("Stream: no memory for a %ux%u band", st->stride, band_rows);
+    return false;
+  }
+  if (st->format != IMG_STREAM_BMP) {
+    return true;
+  }
+
+  uint8_t header[BMP_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  size_t image_size = st->stride * height;
+  header[0] = 'B';
+  header[1] = 'M';
+  put_le32(header + 2, BMP_HEADER_SIZE + image_size);
+  put_le32(header + 10, BMP_HEADER_SIZE);
+  put_le32(header + 14, 40);
+  put_le32(header + 18, width);
+  put_le32(header + 22, -(int32_t)height);  // top-down, rows go out in decode order
+  put_le16(header + 26, 1);
+  put_le16(header + 28, 24);
+  put_le32(header + 34, image_size);
+  put_le32(header + 38, 2835);  // 72 dpi
+  put_le32(header + 42, 2835);
+  return stream_emit(st, header, sizeof(header));
+}
+
+static bool stream_flush(img_stream_t *st) {
+  if (!st->band_h) {
+    return true;
+  }
+  bool res = stream_emit(st, st->band, st->stride * st->band_h);
+  st->band_y += st->band_h;
+  st->band_h = 0;
+  return res;
+}
+
+static inline void put_pixel(uint8_t *o, img_stream_format_t format, uint8_t r, uint8_t g, uint8_t b) {
+  if (format == IMG_STREAM_BMP) {
+    o[0] = b;
+    o[1] = g;
+    o[2] = r;
+  } else if (format == IMG_STREAM_RGB565) {
+    uint16_t v = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    o[0] = v >> 8;
+    o[1] = v & 0xFF;
+  } else {
+    o[0] = (77 * r + 150 * g + 29 * b) >> 8;
+  }
+}
+
+static size_t stream_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  img_stream_t *st = (img_stream_t *)arg;
+  if (index >= st->src_len) {
+    return 0;
+  }
+  if (index + len > st->src_len) {
+    len = st->src_len - index;
+  }
+  if (buf) {
+    memcpy(buf, st->src + index, len);
+  }
+  return len;
+}
+
+static bool stream_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  img_stream_t *st = (img_stream_t *)arg;
+  if (!data) {
+    if (x == 0 && y == 0) {
+      // output start, band_rows was set to the scaled MCU height
+      return stream_begin(st, w, h, st->band_rows);
+    }
+    return stream_flush(st);  // output end
+  }
+  if (y != st->band_y) {
+    // blocks arrive left to right, a new y means the MCU row is complete
+    if (!stream_flush(st)) {
+      return false;
+    }
+    st->band_y = y;
+  }
+  if (h > st->band_rows) {
+    log_e("Stream: %u row block does not fit the band", h);
+    return false;
+  }
+  uint8_t bpp = stream_bpp(st->format);
+  uint16_t rows = 0;
+  for (uint16_t iy = 0; iy < h && y + iy < st->height; iy++, rows++) {
+    uint8_t *o = st->band + iy * st->stride + (size_t)x * bpp;
+    const uint8_t *p = data + (size_t)iy * w * 3;
+    for (uint16_t ix = 0; ix < w && x + ix < st->width; ix++, p += 3, o += bpp) {
+      put_pixel(o, st->format, p[0], p[1], p[2]);
+    }
+  }
+  if (rows > st->band_h) {
+    st->band_h = rows;
+  }
+  return true;
+}
+
+bool jpg2stream(
+  const uint8_t *src, size_t src_len, jpg_scale_t scale, img_stream_format_t format, jpg_out_cb cb, void *arg, uint16_t *width, uint16_t *height
+) {
+  img_stream_t st;
+  memset(&st, 0, sizeof(st));
+  st.src = src;
+  st.src_len = src_len;
+  st.format = format;
+  st.cb = cb;
+  st.arg = arg;
+  st.band_rows = BAND_MAX_ROWS >> scale ? BAND_MAX_ROWS >> scale : 1;
+  bool res = jpg_decode_locked(src_len, scale, stream_read, stream_write, &st) == ESP_OK;
+  free(st.band);
+  *width = st.width;
+  *height = st.height;
+  return res;
+}
+
+static bool raw2stream(camera_fb_t *fb, jpg_scale_t scale, img_stream_format_t format, jpg_out_cb cb, void *arg, uint16_t *width, uint16_t *height) {
+  uint8_t in_bpp = fb->format == PIXFORMAT_RGB565 ? 2 : 1;
+  int step = 1 << scale;
+  *width = fb->width / step;
+  *height = fb->height / step;
+
+  bool same = (fb->format == PIXFORMAT_RGB565 && format == IMG_STREAM_RGB565) || (fb->format == PIXFORMAT_GRAYSCALE && format == IMG_STREAM_GRAY);
+  if (same && step == 1) {
+    return cb(arg, 0, fb->buf, fb->len) == fb->len;
+  }
+
+  img_stream_t st;
+  memset(&st, 0, sizeof(st));
+  st.format = format;
+  st.cb = cb;
+  st.arg = arg;
+  if (!stream_begin(&st, *width, *height, BAND_MAX_ROWS)) {
+    free(st.band);
+    return false;
+  }
+  uint8_t bpp = stream_bpp(format);
+  bool res = true;
+  for (uint16_t y = 0; y < *height && res; y++) {
+    const uint8_t *p = fb->buf + (size_t)y * step * fb->width * in_bpp;
+    uint8_t *o = st.band + st.band_h * st.stride;
+    for (uint16_t x = 0; x < *width; x++, p += step * in_bpp, o += bpp) {
+      if (in_bpp == 2) {
+        uint16_t v = (p[0] << 8) | p[1];
+        put_pixel(o, format, (v >> 8) & 0xF8, (v >> 3) & 0xFC, (v << 3) & 0xF8);
+      } else {
+        put_pixel(o, format, p[0], p[0], p[0]);
+      }
+    }
+    if (++st.band_h == st.band_rows) {
+      res = stream_flush(&st);
+    }
+  }
+  if (res) {
+    res = stream_flush(&st);
+  }
+  free(st.band);
+  return res;
+}
+
+bool frame2stream(camera_fb_t *fb, jpg_scale_t scale, img_stream_format_t format, jpg_out_cb cb, void *arg, uint16_t *width, uint16_t *height) {
+  if (fb->format == PIXFORMAT_JPEG) {
+    return jpg2stream(fb->buf, fb->len, scale, format, cb, arg, width, height);
+  }
+  if (fb->format == PIXFORMAT_RGB565 || fb->format == PIXFORMAT_GRAYSCALE) {
+    return raw2stream(fb, scale, format, cb, arg, width, height);
+  }
+  log_e("Stream: unsupported pixel format %u", fb->format);
+  return false;
+}
@@ -0,0 +1,37 @@
+#ifndef IMG_STREAM_H
+#define IMG_STREAM_H
+
+//
+// Chunked BMP/raw encoders that never hold a whole decoded frame.
+//
+// JPEG frames are decoded MCU row by MCU row into a band buffer that already
+// holds the output format, and every completed band goes to the callback as
+// one chunk. Peak memory is one band: output row stride x 16 rows (less at a
+// reduced scale), about 30 KB for a VGA BMP, instead of a full bitmap.
+// Frames from a sensor in RGB565 or grayscale mode are converted row by row
+// the same way.
+//
+
+#include "esp_camera.h"
+#include "img_converters.h"
+
+typedef enum {
+  IMG_STREAM_BMP,     // 24-bit top-down BMP, file header included
+  IMG_STREAM_GRAY,    // 8-bit luma, no header
+  IMG_STREAM_RGB565,  // 16-bit, big-endian like the driver's RGB565 frames
+} img_stream_format_t;
+
+// Output size once the dimensions are known, BMP header included.
+size_t img_stream_size(img_stream_format_t format, uint16_t width, uint16_t height);
+
+// Streams a JPEG in `format` at a DCT scale. `cb` has the frame2jpg_cb()
+// signature and gets chunks in order; width/height report the output size.
+bool jpg2stream(
+  const uint8_t *src, size_t src_len, jpg_scale_t scale, img_stream_format_t format, jpg_out_cb cb, void *arg, uint16_t *width, uint16_t *height
+);
+
+// Same for a frame buffer. JPEG, RGB565 and grayscale frames are supported;
+// raw frames are subsampled by 1 << scale.
+bool frame2stream(camera_fb_t *fb, jpg_scale_t scale, img_stream_format_t format, jpg_out_cb cb, void *arg, uint16_t *width, uint16_t *height);
+
+#endif  // IMG_STREAM_H
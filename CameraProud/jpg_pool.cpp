@@ -0,0 +1,123 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "img_converters.h"
+#include "esp32-hal-log.h"
+#include "jpg_pool.h"
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+} jpg_sink_t;
+
+static uint8_t *pool[JPG_POOL_MAX];
+static int pool_count = 0;
+static size_t pool_size = 0;
+static uint32_t in_use = 0;  // bitmap
+static uint32_t encodes = 0;
+static uint32_t allocs = 0;
+static uint32_t overflows = 0;
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+bool jpg_pool_init(int count, size_t size) {
+  if (pool_count) {
+    return true;
+  }
+  if (count > JPG_POOL_MAX) {
+    count = JPG_POOL_MAX;
+  }
+  for (int i = 0; i < count; i++) {
+    pool[i] = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!pool[i]) {
+      pool[i] = (uint8_t *)malloc(size);
+    }
+    if (!pool[i]) {
+      log_e("JPG pool: allocated %d of %d buffers", i, count);
+      break;
+    }
+    pool_count++;
+  }
+  pool_size = size;
+  log_i("JPG pool: %d x %u bytes", pool_count, size);
+  return pool_count > 0;
+}
+
+static int pool_take() {
+  int slot = -1;
+  portENTER_CRITICAL(&pool_mux);
+  encodes++;
+  for (int i = 0; i < pool_count; i++) {
+    if (!(in_use & (1 << i))) {
+      in_use |= 1 << i;
+      slot = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&pool_mux);
+  return slot;
+}
+
+static void pool_give(int slot) {
+  portENTER_CRITICAL(&pool_mux);
+  in_use &= ~(1 << slot);
+  portEXIT_CRITICAL(&pool_mux);
+}
+
+static size_t pool_write(void *arg, size_t index, const void *data, size_t len) {
+  jpg_sink_t *sink = (jpg_sink_t *)arg;
+  if (index + len > sink->size) {
+    return 0;  // aborts the encode
+  }
+  memcpy(sink->buf + index, data, len);
+  sink->len = index + len;
+  return len;
+}
+
+bool jpg_pool_encode(camera_fb_t *fb, uint8_t quality, jpg_buf_t *out) {
+  int slot = pool_take();
+  if (slot >= 0) {
+    jpg_sink_t sink = {pool[slot], pool_size, 0};
+    if (frame2jpg_cb(fb, quality, pool_write, &sink)) {
+      out->buf = sink.buf;
+      out->len = sink.len;
+      out->slot = slot;
+      return true;
+    }
+    pool_give(slot);
+    portENTER_CRITICAL(&pool_mux);
+    overflows++;
+    portEXIT_CRITICAL(&pool_mux);
+    log_w("JPG pool: %ux%u frame does not fit %u bytes", fb->width, fb->height, pool_size);
+  }
+
+  portENTER_CRITICAL(&pool_mux);
+  allocs++;
+  portEXIT_CRITICAL(&pool_mux);
+  out->slot = -1;
+  out->buf = NULL;
+  out->len = 0;
+  return frame2jpg(fb, quality, &out->buf, &out->len);
+}
+
+void jpg_pool_release(jpg_buf_t *buf) {
+  if (buf->slot >= 0) {
+    pool_give(buf->slot);
+  } else {
+    free(buf->buf);
+  }
+  buf->buf = NULL;
+  buf->len = 0;
+  buf->slot = -1;
+}
+
+void jpg_pool_stats(jpg_pool_stats_t *stats) {
+  portENTER_CRITICAL(&pool_mux);
+  stats->buffers = pool_count;
+  stats->size = pool_size;
+  stats->in_use = __builtin_popcount(in_use);
+  stats->encodes = encodes;
+  stats->allocs = allocs;
+  stats->overflows = overflows;
+  portEXIT_CRITICAL(&pool_mux);
+}
@@ -0,0 +1,43 @@
+#ifndef JPG_POOL_H
+#define JPG_POOL_H
+
+//
+// Reusable JPEG output buffers for sensors running in RGB565/grayscale.
+//
+// frame2jpg() mallocs a fresh output buffer (128 KB up front with PSRAM) for
+// every frame and the caller frees it again, which fragments the heap under a
+// stream. The pool allocates a few buffers once and encodes into them with the
+// streaming frame2jpg_cb(). When every buffer is in use, or a frame does not
+// fit, it falls back to frame2jpg() and counts the allocation.
+//
+
+#include "esp_camera.h"
+
+#define JPG_POOL_MAX     4
+#define JPG_POOL_BUFFERS 2
+#define JPG_POOL_QUALITY 80
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  int slot;  // -1 when allocated by the fallback
+} jpg_buf_t;
+
+typedef struct {
+  int buffers;
+  size_t size;
+  int in_use;
+  uint32_t encodes;
+  uint32_t allocs;     // fallback frame2jpg() allocations
+  uint32_t overflows;  // frames larger than a pool buffer
+} jpg_pool_stats_t;
+
+// Pre-allocates `count` buffers of `size` bytes, PSRAM when available.
+bool jpg_pool_init(int count, size_t size);
+
+bool jpg_pool_encode(camera_fb_t *fb, uint8_t quality, jpg_buf_t *out);
+void jpg_pool_release(jpg_buf_t *buf);
+
+void jpg_pool_stats(jpg_pool_stats_t *stats);
+
+#endif  // JPG_POOL_H
@@ -0,0 +1,182 @@
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "frame_ring.h"
+#include "jpg_pool.h"
+#include "sensor_modes.h"
+#include "perf_metrics.h"
+
+typedef struct {
+  uint32_t count;
+  uint64_t sum;
+  uint32_t max;
+  uint32_t buckets[METRICS_BUCKETS];
+} histogram_t;
+
+typedef struct {
+  int fd;
+  bool active;
+  uint32_t frames;
+  uint32_t dropped;
+} client_metrics_t;
+
+static const char *metric_names[METRIC_COUNT] = {"fb_get_us", "encode_us", "send_us", "frame_bytes", "lit_capture_us", "mode_switch_us", "scene_us"};
+
+static histogram_t histograms[METRIC_COUNT];
+static client_metrics_t clients[METRICS_MAX_CLIENTS];
+static uint32_t client_dropped_total = 0;
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void metrics_record(metric_id_t id, uint32_t value) {
+  int bucket = value > 1 ? 31 - __builtin_clz(value) : 0;
+  if (bucket >= METRICS_BUCKETS) {
+    bucket = METRICS_BUCKETS - 1;
+  }
+  histogram_t *h = &histograms[id];
+  portENTER_CRITICAL(&metrics_mux);
+  h->count++;
+  h->sum += value;
+  if (value > h->max) {
+    h->max = value;
+  }
+  h->buckets[bucket]++;
+  portEXIT_CRITICAL(&metrics_mux);
+}
+
+int metrics_client_open(int fd) {
+  int client = -1;
+  portENTER_CRITICAL(&metrics_mux);
+  for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+    if (!clients[i].active) {
+      clients[i].fd = fd;
+      clients[i].active = true;
+      clients[i].frames = 0;
+      clients[i].dropped = 0;
+      client = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&metrics_mux);
+  return client;
+}
+
+void metrics_client_frame(int client, uint32_t dropped) {
+  if (client < 0) {
+    return;
+  }
+  portENTER_CRITICAL(&metrics_mux);
+  clients[client].frames++;
+  clients[client].dropped += dropped;
+  client_dropped_total += dropped;
+  portEXIT_CRITICAL(&metrics_mux);
+}
+
+void metrics_client_close(int client) {
+  if (client < 0) {
+    return;
+  }
+  portENTER_CRITICAL(&metrics_mux);
+  clients[client].active = false;
+  portEXIT_CRITICAL(&metrics_mux);
+}
+
+// upper bound of the bucket holding the q-th percentile
+static uint32_t histogram_percentile(const histogram_t *h, uint32_t q) {
+  if (!h->count) {
+    return 0;
+  }
+  uint64_t rank = ((uint64_t)h->count * q + 99) / 100;
+  uint64_t seen = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t upper = (2ULL << i) - 1;
+      return upper < h->max ? (uint32_t)upper : h->max;
+    }
+  }
+  return h->max;
+}
+
+static int socket_count(httpd_handle_t server) {
+  if (!server) {
+    return 0;
+  }
+  int fds[CONFIG_LWIP_MAX_SOCKETS];
+  size_t n = CONFIG_LWIP_MAX_SOCKETS;
+  if (httpd_get_client_list(server, &n, fds) != ESP_OK) {
+    return -1;
+  }
+  return n;
+}
+
+#define JSON_APPEND(...)                        \
+  do {                                            \
+    if (p < len) {                                \
+      p += snprintf(buf + p, len - p, __VA_ARGS__); \
+    }                                             \
+  } while (0)
+
+size_t metrics_json(char *buf, size_t len, httpd_handle_t camera, httpd_handle_t stream) {
+  histogram_t snap[METRIC_COUNT];
+  client_metrics_t client_snap[METRICS_MAX_CLIENTS];
+  uint32_t dropped_total;
+  portENTER_CRITICAL(&metrics_mux);
+  memcpy(snap, histograms, sizeof(snap));
+  memcpy(client_snap, clients, sizeof(client_snap));
+  dropped_total = client_dropped_total;
+  portEXIT_CRITICAL(&metrics_mux);
+
+  size_t p = 0;
+  JSON_APPEND("{\"uptime_ms\":%llu", esp_timer_get_time() / 1000);
+  for (int m = 0; m < METRIC_COUNT; m++) {
+    const histogram_t *h = &snap[m];
+    JSON_APPEND(
+      ",\"%s\":{\"count\":%u,\"avg\":%u,\"max\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"buckets\":[", metric_names[m], h->count,
+      h->count ? (uint32_t)(h->sum / h->count) : 0, h->max, histogram_percentile(h, 50), histogram_percentile(h, 90), histogram_percentile(h, 99)
+    );
+    // trailing empty buckets are left out
+    int last = METRICS_BUCKETS - 1;
+    while (last > 0 && !h->buckets[last]) {
+      last--;
+    }
+    for (int i = 0; i <= last; i++) {
+      JSON_APPEND(i ? ",%u" : "%u", h->buckets[i]);
+    }
+    JSON_APPEND("]}");
+  }
+
+  JSON_APPEND(",\"stream_dropped\":%u,\"clients\":[", dropped_total);
+  bool first = true;
+  for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+    if (client_snap[i].active) {
+      JSON_APPEND("%s{\"fd\":%d,\"frames\":%u,\"dropped\":%u}", first ? "" : ",", client_snap[i].fd, client_snap[i].frames, client_snap[i].dropped);
+      first = false;
+    }
+  }
+  JSON_APPEND("]");
+
+  ring_stats_t ring;
+  frame_ring_stats(&ring);
+  JSON_APPEND(
+    ",\"heap_free\":%u,\"heap_min_free\":%u,\"heap_largest\":%u,\"psram_free\":%u,\"psram_min_free\":%u,\"ring_peak\":%u,\"ring_dropped\":%u",
+    heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+    heap_caps_get_free_size(MALLOC_CAP_SPIRAM), heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM), ring.peak, ring.dropped
+  );
+  jpg_pool_stats_t pool;
+  jpg_pool_stats(&pool);
+  JSON_APPEND(
+    ",\"jpg_pool\":{\"buffers\":%d,\"size\":%u,\"in_use\":%d,\"encodes\":%u,\"allocs\":%u,\"overflows\":%u}", pool.buffers, pool.size, pool.in_use, pool.encodes,
+    pool.allocs, pool.overflows
+  );
+  sensor_modes_stats_t modes;
+  sensor_modes_stats(&modes);
+  JSON_APPEND(
+    ",\"modes\":{\"sensor\":\"%s\",\"cached\":%d,\"fast\":%u,\"slow\":%u,\"fallbacks\":%u,\"last_regs\":%u}", modes.sensor, modes.cached, modes.fast,
+    modes.slow, modes.fallbacks, modes.last_regs
+  );
+  JSON_APPEND(",\"sockets_camera\":%d,\"sockets_stream\":%d}", socket_count(camera), socket_count(stream));
+  return p < len ? p : len - 1;
+}
@@ -0,0 +1,42 @@
+#ifndef PERF_METRICS_H
+#define PERF_METRICS_H
+
+//
+// Always-on capture pipeline counters for /metrics.
+//
+// Each metric is a log2 histogram: bucket i counts values in [2^i, 2^(i+1)),
+// so recording is a count-leading-zeros and three adds under a spinlock, cheap
+// enough for the capture task. Percentiles reported from it are bucket upper
+// bounds, i.e. accurate to a factor of two.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_http_server.h"
+
+#define METRICS_BUCKETS     24
+#define METRICS_MAX_CLIENTS 4
+
+typedef enum {
+  METRIC_FB_GET_US,       // esp_camera_fb_get()
+  METRIC_ENCODE_US,       // frame2jpg/frame2bmp when the sensor is not in JPEG mode
+  METRIC_SEND_US,         // one frame to one client, headers included
+  METRIC_FRAME_BYTES,
+  METRIC_LIT_CAPTURE_US,  // /capture request to the first fully lit frame
+  METRIC_MODE_SWITCH_US,  // /capture?framesize= request to the first frame in that size
+  METRIC_SCENE_US,        // DC brightness statistics of one frame, see scene_stats.h
+  METRIC_COUNT
+} metric_id_t;
+
+void metrics_record(metric_id_t id, uint32_t value);
+
+// Per-client frame accounting for live streams. `dropped` is the number of
+// frames the client skipped because it could not keep up.
+int metrics_client_open(int fd);
+void metrics_client_frame(int client, uint32_t dropped);
+void metrics_client_close(int client);
+
+// Writes the /metrics JSON, socket counts are read from the given servers.
+size_t metrics_json(char *buf, size_t len, httpd_handle_t camera, httpd_handle_t stream);
+
+#endif  // PERF_METRICS_H
@@ -0,0 +1,726 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp32-hal-log.h"
+#include "frame_ring.h"
+#include "perf_metrics.h"
+#include "rtsp_server.h"
+
+#define RTP_HEADER_LEN   12
+#define JPEG_HEADER_LEN  8
+#define RST_HEADER_LEN   4
+#define QT_HEADER_LEN    (4 + 2 * 64)
+#define INTERLEAVE_LEN   4
+#define RTP_PACKET_MAX   (INTERLEAVE_LEN + RTSP_RTP_PACKET)
+#define RTP_PT_JPEG      26
+#define RTSP_FRAME_WAIT  pdMS_TO_TICKS(20)  // bounds request latency while playing
+
+typedef enum {
+  SESSION_FREE,
+  SESSION_INIT,   // connected, no SETUP yet
+  SESSION_READY,  // transport set up, paused
+  SESSION_PLAYING
+} session_state_t;
+
+typedef struct {
+  session_state_t state;
+  int fd;
+  bool tcp;
+  uint8_t channel;              // interleaved RTP channel
+  struct sockaddr_in rtp_addr;  // UDP destination
+  uint16_t rtcp_port;
+  uint32_t id;
+  uint32_t ssrc;
+  uint16_t seq;
+  int64_t last_seen;
+  int64_t stalled_since;  // interleaved: first packet skipped for lack of room, 0 when sending
+  uint8_t *pending;       // interleaved: rest of a packet the socket took only part of
+  size_t pending_len;
+  int client;  // perf_metrics slot while playing
+  char req[RTSP_REQUEST_MAX + 1];
+  size_t req_len;
+} rtsp_session_t;
+
+// Baseline JPEG split into what RFC 2435 carries
+typedef struct {
+  const uint8_t *scan;
+  size_t scan_len;
+  const uint8_t *qt[2];
+  uint16_t width;
+  uint16_t height;
+  uint8_t type;  // 0 = 4:2:2, 1 = 4:2:0
+  uint16_t dri;
+} rtp_jpeg_t;
+
+static rtsp_session_t sessions[RTSP_MAX_SESSIONS];
+static int listen_fd = -1;
+static int rtp_fd = -1;
+static int rtcp_fd = -1;
+static uint8_t packet[RTP_PACKET_MAX];
+static TaskHandle_t task = NULL;
+
+static int playing_count() {
+  int n = 0;
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    n += sessions[i].state == SESSION_PLAYING;
+  }
+  return n;
+}
+
+static bool jpeg_parse(const uint8_t *p, size_t len, rtp_jpeg_t *j) {
+  memset(j, 0, sizeof(*j));
+  if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+    return false;
+  }
+  bool sof = false;
+  size_t i = 2;
+  while (i + 4 <= len) {
+    if (p[i] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = p[i + 1];
+    if (marker == 0xFF) {
+      i++;  // fill byte
+      continue;
+    }
+    size_t seg = (p[i + 2] << 8) | p[i + 3];
+    if (seg < 2 || i + 2 + seg > len) {
+      return false;
+    }
+    const uint8_t *s = p + i + 4;
+    size_t n = seg - 2;
+    switch (marker) {
+      case 0xDB:  // DQT, 8-bit tables only
+        for (size_t k = 0; k + 65 <= n; k += 65) {
+          if (s[k] >> 4) {
+            return false;
+          }
+          if ((s[k] & 0x0F) < 2) {
+            j->qt[s[k] & 0x0F] = s + k + 1;
+          }
+        }
+        break;
+      case 0xC0:  // baseline SOF: Y 2x1 or 2x2 on table 0, Cb/Cr 1x1 on table 1
+        if (n < 15 || s[5] != 3 || s[10] != 0x11 || s[13] != 0x11 || s[8] != 0 || s[11] != 1 || s[14] != 1) {
+          return false;
+        }
+        if (s[7] == 0x21) {
+          j->type = 0;
+        } else if (s[7] == 0x22) {
+          j->type = 1;
+        } else {
+          return false;
+        }
+        j->height = (s[1] << 8) | s[2];
+        j->width = (s[3] << 8) | s[4];
+        if (j->width > 2040 || j->height > 2040) {
+          return false;
+        }
+        sof = true;
+        break;
+      case 0xDD:  // DRI
+        if (n >= 2) {
+          j->dri = (s[0] << 8) | s[1];
+        }
+        break;
+      case 0xDA:  // SOS, the entropy-coded data follows up to EOI
+        if (!sof || !j->qt[0] || !j->qt[1]) {
+          return false;
+        }
+        j->scan = s + n;
+        j->scan_len = p + len - j->scan;
+        // EOI is implied by the marker bit, drop it and any padding after it
+        for (size_t k = 2; k <= 64 && k <= j->scan_len; k++) {
+          if (j->scan[j->scan_len - k] == 0xFF && j->scan[j->scan_len - k + 1] == 0xD9) {
+            j->scan_len -= k;
+            break;
+          }
+        }
+        return j->scan_len > 0;
+      default:
+        // other SOF types: progressive, extended, lossless, arithmetic
+        if (marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+          return false;
+        }
+        break;
+    }
+    i += 2 + seg;
+  }
+  return false;
+}
+
+static bool send_all(int fd, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len) {
+    int n = send(fd, p, len, 0);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void session_close(rtsp_session_t *s) {
+  if (s->state == SESSION_PLAYING) {
+    metrics_client_close(s->client);
+  }
+  if (s->fd >= 0) {
+    close(s->fd);
+  }
+  log_i("RTSP: session %08X closed", s->id);
+  s->state = SESSION_FREE;
+  s->fd = -1;
+  s->req_len = 0;
+  free(s->pending);
+  s->pending = NULL;
+  s->pending_len = 0;
+  s->stalled_since = 0;
+}
+
+// Interleaved RTP never blocks the RTSP task: a packet goes out whole, in part
+// (the rest is kept and sent before anything else on the connection), or not
+// at all when the socket has no room. Returns false when it was not sent.
+static bool tcp_flush(rtsp_session_t *s) {
+  while (s->pending_len) {
+    int n = send(s->fd, s->pending, s->pending_len, MSG_DONTWAIT);
+    if (n <= 0) {
+      return false;
+    }
+    memmove(s->pending, s->pending + n, s->pending_len - n);
+    s->pending_len -= n;
+  }
+  return true;
+}
+
+static bool tcp_send(rtsp_session_t *s, const uint8_t *data, size_t len) {
+  int n = tcp_flush(s) ? send(s->fd, data, len, MSG_DONTWAIT) : 0;
+  if (n <= 0) {
+    return false;
+  }
+  if ((size_t)n < len) {
+    if (!s->pending) {
+      s->pending = (uint8_t *)malloc(RTP_PACKET_MAX);
+    }
+    if (!s->pending) {
+      return send_all(s->fd, data + n, len - n);  // no memory to keep it, finish blocking
+    }
+    memcpy(s->pending, data + n, len - n);
+    s->pending_len = len - n;
+  }
+  return true;
+}
+
+// Sends the RTP packet in `packet` to one session, patching in its sequence
+// number and SSRC. `len` excludes the interleave prefix.
+static bool session_send(rtsp_session_t *s, size_t len) {
+  uint8_t *rtp = packet + INTERLEAVE_LEN;
+  rtp[2] = s->seq >> 8;
+  rtp[3] = s->seq;
+  rtp[8] = s->ssrc >> 24;
+  rtp[9] = s->ssrc >> 16;
+  rtp[10] = s->ssrc >> 8;
+  rtp[11] = s->ssrc;
+  s->seq++;
+
+  if (s->tcp) {
+    packet[0] = '$';
+    packet[1] = s->channel;
+    packet[2] = len >> 8;
+    packet[3] = len;
+    return tcp_send(s, packet, INTERLEAVE_LEN + len);
+  }
+  for (int retry = 0; retry < 3; retry++) {
+    if (sendto(rtp_fd, rtp, len, 0, (struct sockaddr *)&s->rtp_addr, sizeof(s->rtp_addr)) == (int)len) {
+      return true;
+    }
+    if (errno != ENOMEM) {
+      break;
+    }
+    vTaskDelay(1);  // lwIP is out of buffers, let the WiFi task drain them
+  }
+  return false;
+}
+
+static void send_frame(const ring_frame_t *frame, uint32_t dropped) {
+  static bool warned = false;
+  rtp_jpeg_t j;
+  if (!jpeg_parse(frame->buf, frame->len, &j)) {
+    if (!warned) {
+      log_w("RTSP: %ux%u frame is not a baseline YUV JPEG RFC 2435 can carry, skipped", frame->width, frame->height);
+      warned = true;
+    }
+    return;
+  }
+
+  int64_t start = esp_timer_get_time();
+  uint32_t rtptime = (uint32_t)(frame->timestamp * 9 / 100);  // 90 kHz
+  bool failed[RTSP_MAX_SESSIONS] = {};
+  size_t offset = 0;
+  while (offset < j.scan_len) {
+    uint8_t *rtp = packet + INTERLEAVE_LEN;
+    rtp[0] = 0x80;  // version 2
+    rtp[1] = RTP_PT_JPEG;
+    rtp[4] = rtptime >> 24;
+    rtp[5] = rtptime >> 16;
+    rtp[6] = rtptime >> 8;
+    rtp[7] = rtptime;
+
+    uint8_t *h = rtp + RTP_HEADER_LEN;
+    h[0] = 0;  // type-specific
+    h[1] = offset >> 16;
+    h[2] = offset >> 8;
+    h[3] = offset;
+    h[4] = j.type | (j.dri ? 64 : 0);
+    h[5] = 255;  // quantization tables in-band
+    h[6] = (j.width + 7) / 8;
+    h[7] = (j.height + 7) / 8;
+    h += JPEG_HEADER_LEN;
+    if (j.dri) {
+      h[0] = j.dri >> 8;
+      h[1] = j.dri;
+      h[2] = 0xFF;  // F = L = 1, restart count 0x3FFF
+      h[3] = 0xFF;
+      h += RST_HEADER_LEN;
+    }
+    if (!offset) {
+      h[0] = 0;  // MBZ
+      h[1] = 0;  // 8-bit precision
+      h[2] = 0;
+      h[3] = 128;
+      memcpy(h + 4, j.qt[0], 64);
+      memcpy(h + 68, j.qt[1], 64);
+      h += QT_HEADER_LEN;
+    }
+
+    // the first packet also carries the quantization tables, every packet
+    // stays within RTSP_RTP_PACKET
+    size_t room = RTSP_RTP_PACKET - (h - rtp);
+    size_t n = j.scan_len - offset < room ? j.scan_len - offset : room;
+    memcpy(h, j.scan + offset, n);
+    offset += n;
+    if (offset == j.scan_len) {
+      rtp[1] |= 0x80;  // marker: last packet of the frame
+    }
+
+    size_t len = h + n - rtp;
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+      if (sessions[i].state == SESSION_PLAYING && !failed[i]) {
+        failed[i] = !session_send(&sessions[i], len);
+      }
+    }
+  }
+
+  metrics_record(METRIC_SEND_US, esp_timer_get_time() - start);
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    rtsp_session_t *s = &sessions[i];
+    if (s->state != SESSION_PLAYING) {
+      continue;
+    }
+    if (!failed[i]) {
+      metrics_client_frame(s->client, dropped);
+      s->stalled_since = 0;
+    } else if (s->tcp) {
+      // the rest of this frame was skipped; a client that has not taken
+      // anything for a while is gone or too slow
+      int64_t now = esp_timer_get_time();
+      if (!s->stalled_since) {
+        s->stalled_since = now;
+      } else if (now - s->stalled_since > (int64_t)RTSP_TCP_SEND_TIMEOUT_MS * 1000) {
+        log_w("RTSP: session %08X fell behind, closing", s->id);
+        session_close(s);
+      }
+    }
+  }
+}
+
+// Copies the value of header `name` up to the end of its line.
+static bool header_get(const char *req, const char *name, char *out, size_t out_len) {
+  size_t name_len = strlen(name);
+  for (const char *line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, name, name_len) || line[name_len] != ':') {
+      continue;
+    }
+    const char *v = line + name_len + 1;
+    while (*v == ' ') {
+      v++;
+    }
+    size_t n = strcspn(v, "\r\n");
+    if (n >= out_len) {
+      n = out_len - 1;
+    }
+    memcpy(out, v, n);
+    out[n] = 0;
+    return true;
+  }
+  return false;
+}
+
+static bool rtsp_reply(rtsp_session_t *s, int cseq, const char *status, const char *headers, const char *body) {
+  char head[512];
+  int n = snprintf(head, sizeof(head), "RTSP/1.0 %s\r\nCSeq: %d\r\nServer: CameraProud\r\n%s", status, cseq, headers ? headers : "");
+  if (s->state != SESSION_INIT && n < (int)sizeof(head)) {
+    n += snprintf(head + n, sizeof(head) - n, "Session: %08X;timeout=%d\r\n", s->id, RTSP_SESSION_TIMEOUT);
+  }
+  if (body && n < (int)sizeof(head)) {
+    n += snprintf(head + n, sizeof(head) - n, "Content-Length: %u\r\n", strlen(body));
+  }
+  if (n < (int)sizeof(head)) {
+    n += snprintf(head + n, sizeof(head) - n, "\r\n");
+  }
+  if (n >= (int)sizeof(head)) {
+    log_e("RTSP: reply too long");
+    return false;
+  }
+  // finish a cut interleaved packet first, the reply must not land inside it
+  if (!send_all(s->fd, s->pending, s->pending_len)) {
+    return false;
+  }
+  s->pending_len = 0;
+  return send_all(s->fd, head, n) && (!body || send_all(s->fd, body, strlen(body)));
+}
+
+static bool rtsp_describe(rtsp_session_t *s, int cseq, char *url) {
+  struct sockaddr_in local;
+  socklen_t addr_len = sizeof(local);
+  getsockname(s->fd, (struct sockaddr *)&local, &addr_len);
+  uint32_t ip = ntohl(local.sin_addr.s_addr);
+
+  char sdp[256];
+  snprintf(
+    sdp, sizeof(sdp),
+    "v=0\r\n"
+    "o=- %u 1 IN IP4 %u.%u.%u.%u\r\n"
+    "s=CameraProud\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "t=0 0\r\n"
+    "m=video 0 RTP/AVP %d\r\n"
+    "a=control:track1\r\n",
+    esp_random(), ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, RTP_PT_JPEG
+  );
+
+  size_t url_len = strlen(url);
+  if (url_len && url[url_len - 1] == '/') {
+    url[url_len - 1] = 0;
+  }
+  char headers[320];
+  snprintf(headers, sizeof(headers), "Content-Base: %s/\r\nContent-Type: application/sdp\r\n", url);
+  return rtsp_reply(s, cseq, "200 OK", headers, sdp);
+}
+
+static bool rtsp_setup(rtsp_session_t *s, int cseq, const char *req) {
+  char transport[128];
+  if (!header_get(req, "Transport", transport, sizeof(transport)) || strstr(transport, "multicast")) {
+    return rtsp_reply(s, cseq, "461 Unsupported Transport", NULL, NULL);
+  }
+
+  char headers[192];
+  if (strstr(transport, "RTP/AVP/TCP")) {
+    const char *c = strstr(transport, "interleaved=");
+    s->tcp = true;
+    s->channel = c ? atoi(c + 12) : 0;
+    snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u", s->channel, s->channel + 1);
+  } else {
+    const char *c = strstr(transport, "client_port=");
+    if (!c) {
+      return rtsp_reply(s, cseq, "461 Unsupported Transport", NULL, NULL);
+    }
+    char *end;
+    uint16_t rtp_port = strtoul(c + 12, &end, 10);
+    s->rtcp_port = *end == '-' ? strtoul(end + 1, NULL, 10) : rtp_port + 1;
+    socklen_t addr_len = sizeof(s->rtp_addr);
+    getpeername(s->fd, (struct sockaddr *)&s->rtp_addr, &addr_len);
+    s->rtp_addr.sin_port = htons(rtp_port);
+    s->tcp = false;
+    snprintf(
+      headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u", rtp_port, s->rtcp_port, RTSP_RTP_PORT, RTSP_RTP_PORT + 1
+    );
+  }
+  if (s->state == SESSION_INIT) {
+    s->id = esp_random();
+    s->ssrc = esp_random();
+    s->seq = esp_random();
+    s->state = SESSION_READY;
+  }
+  size_t n = strlen(headers);
+  snprintf(headers + n, sizeof(headers) - n, ";ssrc=%08X\r\n", s->ssrc);
+  log_i("RTSP: session %08X set up over %s", s->id, s->tcp ? "TCP" : "UDP");
+  return rtsp_reply(s, cseq, "200 OK", headers, NULL);
+}
+
+// Returns false when the connection is to be closed.
+static bool rtsp_request(rtsp_session_t *s, const char *req) {
+  char method[16], url[256], value[32];
+  if (sscanf(req, "%15s %255s", method, url) != 2) {
+    return false;
+  }
+  int cseq = header_get(req, "CSeq", value, sizeof(value)) ? atoi(value) : 0;
+
+  if (s->state != SESSION_INIT && header_get(req, "Session", value, sizeof(value)) && strtoul(value, NULL, 16) != s->id) {
+    return rtsp_reply(s, cseq, "454 Session Not Found", NULL, NULL);
+  }
+
+  if (!strcmp(method, "OPTIONS")) {
+    return rtsp_reply(s, cseq, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n", NULL);
+  }
+  if (!strcmp(method, "DESCRIBE")) {
+    return rtsp_describe(s, cseq, url);
+  }
+  if (!strcmp(method, "SETUP")) {
+    return rtsp_setup(s, cseq, req);
+  }
+  if (!strcmp(method, "PLAY")) {
+    if (s->state == SESSION_INIT) {
+      return rtsp_reply(s, cseq, "455 Method Not Valid in This State", NULL, NULL);
+    }
+    char headers[320];
+    snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%s;seq=%u\r\n", url, s->seq);
+    if (s->state != SESSION_PLAYING) {
+      s->client = metrics_client_open(s->fd);
+      s->state = SESSION_PLAYING;
+      log_i("RTSP: session %08X playing, %d total", s->id, playing_count());
+    }
+    return rtsp_reply(s, cseq, "200 OK", headers, NULL);
+  }
+  if (!strcmp(method, "PAUSE")) {
+    if (s->state == SESSION_PLAYING) {
+      metrics_client_close(s->client);
+      s->state = SESSION_READY;
+    }
+    return rtsp_reply(s, cseq, "200 OK", NULL, NULL);
+  }
+  if (!strcmp(method, "TEARDOWN")) {
+    rtsp_reply(s, cseq, "200 OK", NULL, NULL);
+    return false;
+  }
+  if (!strcmp(method, "GET_PARAMETER") || !strcmp(method, "SET_PARAMETER")) {
+    return rtsp_reply(s, cseq, "200 OK", NULL, NULL);  // keep-alive
+  }
+  return rtsp_reply(s, cseq, "501 Not Implemented", NULL, NULL);
+}
+
+// Reads from the RTSP connection and handles every complete request. Returns
+// false when the connection is to be closed.
+static bool session_input(rtsp_session_t *s, int64_t now) {
+  int n = recv(s->fd, s->req + s->req_len, RTSP_REQUEST_MAX - s->req_len, 0);
+  if (n <= 0) {
+    return false;
+  }
+  s->req_len += n;
+  s->last_seen = now;
+
+  while (s->req_len) {
+    size_t used;
+    if (s->req[0] == '$') {
+      // interleaved RTCP from the client, only counts as a sign of life
+      if (s->req_len < INTERLEAVE_LEN) {
+        break;
+      }
+      used = INTERLEAVE_LEN + (((uint8_t)s->req[2] << 8) | (uint8_t)s->req[3]);
+    } else {
+      s->req[s->req_len] = 0;
+      char *end = strstr(s->req, "\r\n\r\n");
+      if (!end) {
+        break;
+      }
+      end[2] = 0;  // keep the CRLF of the last header line
+      char value[12];
+      used = end + 4 - s->req;
+      if (header_get(s->req, "Content-Length", value, sizeof(value))) {
+        used += atoi(value);  // bodies, e.g. of SET_PARAMETER, are ignored
+      }
+      if (used <= s->req_len && !rtsp_request(s, s->req)) {
+        return false;
+      }
+      end[2] = '\r';
+    }
+    if (used > s->req_len) {
+      if (used > RTSP_REQUEST_MAX) {
+        return false;
+      }
+      break;
+    }
+    memmove(s->req, s->req + used, s->req_len - used);
+    s->req_len -= used;
+  }
+  if (s->req_len == RTSP_REQUEST_MAX) {
+    log_w("RTSP: request too large");
+    return false;
+  }
+  return true;
+}
+
+static void session_accept(int64_t now) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept(listen_fd, (struct sockaddr *)&addr, &addr_len);
+  if (fd < 0) {
+    return;
+  }
+  rtsp_session_t *s = NULL;
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    if (sessions[i].state == SESSION_FREE) {
+      s = &sessions[i];
+      break;
+    }
+  }
+  if (!s) {
+    log_w("RTSP: all %d sessions in use", RTSP_MAX_SESSIONS);
+    close(fd);
+    return;
+  }
+  // RTP goes out with MSG_DONTWAIT, this bounds the replies
+  struct timeval timeout = {RTSP_TCP_SEND_TIMEOUT_MS / 1000, (RTSP_TCP_SEND_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  s->state = SESSION_INIT;
+  s->fd = fd;
+  s->id = 0;
+  s->client = -1;
+  s->req_len = 0;
+  s->last_seen = now;
+}
+
+// RTCP receiver reports keep UDP sessions alive, their content is not used.
+static void rtcp_input(int fd, int64_t now) {
+  uint8_t buf[128];
+  struct sockaddr_in from;
+  socklen_t addr_len = sizeof(from);
+  if (recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &addr_len) <= 0) {
+    return;
+  }
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    rtsp_session_t *s = &sessions[i];
+    if (s->state >= SESSION_READY && !s->tcp && s->rtp_addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+      s->last_seen = now;
+    }
+  }
+}
+
+static void rtsp_task(void *arg) {
+  uint32_t last_seq = 0;
+  while (true) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(listen_fd, &fds);
+    FD_SET(rtp_fd, &fds);
+    FD_SET(rtcp_fd, &fds);
+    int max_fd = listen_fd > rtp_fd ? listen_fd : rtp_fd;
+    max_fd = rtcp_fd > max_fd ? rtcp_fd : max_fd;
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+      if (sessions[i].state != SESSION_FREE) {
+        FD_SET(sessions[i].fd, &fds);
+        max_fd = sessions[i].fd > max_fd ? sessions[i].fd : max_fd;
+      }
+    }
+
+    // while playing, the frame wait below paces the loop
+    bool playing = playing_count() > 0;
+    struct timeval timeout = {0, playing ? 0 : 100000};
+    int ready = select(max_fd + 1, &fds, NULL, NULL, &timeout);
+    int64_t now = esp_timer_get_time();
+    if (ready > 0) {
+      for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+        rtsp_session_t *s = &sessions[i];
+        if (s->state != SESSION_FREE && FD_ISSET(s->fd, &fds) && !session_input(s, now)) {
+          session_close(s);
+        }
+      }
+      if (FD_ISSET(rtp_fd, &fds)) {
+        rtcp_input(rtp_fd, now);
+      }
+      if (FD_ISSET(rtcp_fd, &fds)) {
+        rtcp_input(rtcp_fd, now);
+      }
+      if (FD_ISSET(listen_fd, &fds)) {
+        session_accept(now);
+      }
+    }
+
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+      rtsp_session_t *s = &sessions[i];
+      // an interleaved session lives as long as its connection
+      if (s->state != SESSION_FREE && !(s->tcp && s->state == SESSION_PLAYING) && now - s->last_seen > RTSP_SESSION_TIMEOUT * 1000000LL) {
+        log_i("RTSP: session %08X timed out", s->id);
+        session_close(s);
+      }
+    }
+
+    if (!playing) {
+      last_seq = 0;
+      continue;
+    }
+    ring_frame_t frame;
+    if (frame_ring_latest(last_seq, &frame, RTSP_FRAME_WAIT)) {
+      uint32_t dropped = last_seq ? frame.seq - last_seq - 1 : 0;
+      last_seq = frame.seq;
+      send_frame(&frame, dropped);
+      frame_ring_release(&frame);
+    }
+  }
+}
+
+static int udp_socket(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool rtsp_server_start(uint16_t port, UBaseType_t priority, BaseType_t core) {
+  if (task) {
+    return true;
+  }
+  if (!frame_ring_enabled()) {
+    log_e("RTSP: needs the frame ring");
+    return false;
+  }
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    sessions[i].state = SESSION_FREE;
+    sessions[i].fd = -1;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  int reuse = 1;
+  if (listen_fd >= 0) {
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  }
+  rtp_fd = udp_socket(RTSP_RTP_PORT);
+  rtcp_fd = udp_socket(RTSP_RTP_PORT + 1);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, RTSP_MAX_SESSIONS) < 0 || rtp_fd < 0 || rtcp_fd < 0) {
+    log_e("RTSP: failed to open the sockets");
+    int fds[] = {listen_fd, rtp_fd, rtcp_fd};
+    for (int i = 0; i < 3; i++) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
+      }
+    }
+    listen_fd = rtp_fd = rtcp_fd = -1;
+    return false;
+  }
+
+  log_i("Starting RTSP server on port: '%d'", port);
+  return xTaskCreatePinnedToCore(rtsp_task, "rtsp", 6144, NULL, priority, &task, core) == pdPASS;
+}
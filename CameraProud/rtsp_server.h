@@ -0,0 +1,38 @@
+#ifndef RTSP_SERVER_H
+#define RTSP_SERVER_H
+
+//
+// RTSP server streaming the frame ring as RTP/JPEG (RFC 2435).
+//
+// MJPEG over HTTP sends every frame as a multipart chunk over TCP, so one lost
+// segment stalls all following frames until it is retransmitted. RTP over UDP
+// loses that packet's frame and carries on with the next. Clients that cannot
+// receive UDP (NAT, firewalls) set up RTP interleaved on the RTSP connection
+// instead (RFC 2326 section 10.12).
+//
+// One task serves the RTSP connections and sends the newest ring frame to all
+// playing sessions, so RTSP adds no capture work next to /stream:
+//
+//   ffplay rtsp://<camera>/
+//   ffplay -rtsp_transport tcp rtsp://<camera>/
+//
+// The JPEG scan data goes out as is. The quantization tables are sent in-band
+// (Q = 255), and the Huffman tables are the standard ones, as required by the
+// RFC and as used by the sensor and by frame2jpg(). Restart intervals are
+// passed on (types 64/65). Frames wider or taller than 2040 px, grayscale and
+// progressive JPEGs are not supported by the payload format and are skipped.
+//
+
+#include "freertos/FreeRTOS.h"
+
+#define RTSP_MAX_SESSIONS        4     // one session per RTSP connection
+#define RTSP_RTP_PORT            6970  // UDP source port of RTP, RTCP is +1
+#define RTSP_RTP_PACKET          1400  // RTP packet size with all headers, one Ethernet frame with IP/UDP
+#define RTSP_SESSION_TIMEOUT     60    // s without a request or RTCP report
+#define RTSP_REQUEST_MAX         1024
+#define RTSP_TCP_SEND_TIMEOUT_MS 1000  // an interleaved client this long without room is dropped
+
+// Needs the frame ring. Playing sessions show up as clients in /metrics.
+bool rtsp_server_start(uint16_t port, UBaseType_t priority, BaseType_t core);
+
+#endif  // RTSP_SERVER_H
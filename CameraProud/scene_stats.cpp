@@ -0,0 +1,372 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "scene_stats.h"
+
+#define HUFF_LOOKAHEAD 8  // bits resolved by one table lookup, longer codes are searched
+#define SCAN_MAX_COMPS 3
+
+typedef struct {
+  uint16_t lookup[1 << HUFF_LOOKAHEAD];  // code length << 8 | value, 0 for longer codes
+  int32_t maxcode[17];                   // largest code of each length, -1 when there is none
+  int32_t valoffset[17];                 // code of a length to its index in values
+  uint8_t values[256];
+  bool valid;
+} huff_table_t;
+
+typedef struct {
+  uint8_t id;
+  uint8_t h;
+  uint8_t v;
+  uint8_t tq;
+  uint8_t td;
+  uint8_t ta;
+} dc_component_t;
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+  uint32_t bits;  // msb first
+  int count;
+  bool marker;  // reached a marker, zeros are shifted in from here on
+} bit_reader_t;
+
+typedef struct {
+  huff_table_t dc[2];
+  huff_table_t ac[2];
+  uint16_t dc_quant[4];
+  dc_component_t comps[SCAN_MAX_COMPS];
+  int ncomps;
+  uint16_t width;
+  uint16_t height;
+  uint16_t dri;
+  const uint8_t *scan;
+} dc_decoder_t;
+
+static bool huff_build(huff_table_t *t, const uint8_t *counts, const uint8_t *values, int total) {
+  if (total > 256) {
+    return false;
+  }
+  memset(t->lookup, 0, sizeof(t->lookup));
+  memcpy(t->values, values, total);
+  int32_t code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; len++) {
+    if (code + counts[len - 1] > (1 << len)) {
+      return false;  // more codes than the length can hold
+    }
+    t->valoffset[len] = k - code;
+    for (int i = 0; i < counts[len - 1]; i++, code++, k++) {
+      if (len <= HUFF_LOOKAHEAD) {
+        int shift = HUFF_LOOKAHEAD - len;
+        for (int pad = 0; pad < (1 << shift); pad++) {
+          t->lookup[(code << shift) | pad] = (len << 8) | values[k];
+        }
+      }
+    }
+    t->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  t->valid = true;
+  return true;
+}
+
+static void bits_fill(bit_reader_t *r) {
+  while (r->count <= 24) {
+    uint32_t byte = 0;
+    if (!r->marker && r->p < r->end) {
+      byte = *r->p++;
+      if (byte == 0xFF) {
+        if (r->p < r->end && *r->p == 0x00) {
+          r->p++;  // stuffed byte
+        } else {
+          r->marker = true;
+          r->p--;
+          byte = 0;
+        }
+      }
+    }
+    r->bits |= byte << (24 - r->count);
+    r->count += 8;
+  }
+}
+
+static uint32_t bits_get(bit_reader_t *r, int n) {
+  if (!n) {
+    return 0;
+  }
+  bits_fill(r);
+  uint32_t v = r->bits >> (32 - n);
+  r->bits <<= n;
+  r->count -= n;
+  return v;
+}
+
+static int huff_decode(bit_reader_t *r, const huff_table_t *t) {
+  bits_fill(r);
+  uint16_t e = t->lookup[r->bits >> (32 - HUFF_LOOKAHEAD)];
+  int len;
+  if (e) {
+    len = e >> 8;
+    r->bits <<= len;
+    r->count -= len;
+    return e & 0xFF;
+  }
+  for (len = HUFF_LOOKAHEAD + 1; len <= 16; len++) {
+    int32_t code = r->bits >> (32 - len);
+    if (code <= t->maxcode[len]) {
+      r->bits <<= len;
+      r->count -= len;
+      return t->values[t->valoffset[len] + code];
+    }
+  }
+  return -1;
+}
+
+static int extend(uint32_t v, int s) {
+  return v < (1u << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+// Restart marker: the bits left in the buffer are padding
+static bool bits_restart(bit_reader_t *r) {
+  r->bits = 0;
+  r->count = 0;
+  if (r->p + 1 < r->end && r->p[0] == 0xFF && (r->p[1] & 0xF8) == 0xD0) {
+    r->p += 2;
+    r->marker = false;
+    return true;
+  }
+  return false;
+}
+
+static bool parse_headers(dc_decoder_t *d, const uint8_t *p, size_t len) {
+  if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+    return false;
+  }
+  size_t i = 2;
+  while (i + 4 <= len) {
+    if (p[i] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = p[i + 1];
+    if (marker == 0xFF) {
+      i++;
+      continue;
+    }
+    size_t seg = (p[i + 2] << 8) | p[i + 3];
+    const uint8_t *s = p + i + 4;
+    const uint8_t *end = p + i + 2 + seg;
+    if (seg < 2 || i + 2 + seg > len) {
+      return false;
+    }
+    switch (marker) {
+      case 0xDB:  // DQT, only the DC entry of each table is needed
+        while (s < end) {
+          int precision = s[0] >> 4;
+          int id = s[0] & 3;
+          if (s + 1 + (precision ? 128 : 64) > end) {
+            return false;
+          }
+          d->dc_quant[id] = precision ? (s[1] << 8) | s[2] : s[1];
+          s += 1 + (precision ? 128 : 64);
+        }
+        break;
+      case 0xC4:  // DHT
+        while (s + 17 <= end) {
+          int cls = s[0] >> 4;
+          int id = s[0] & 1;
+          int total = 0;
+          for (int k = 0; k < 16; k++) {
+            total += s[1 + k];
+          }
+          if (s + 17 + total > end || !huff_build(cls ? &d->ac[id] : &d->dc[id], s + 1, s + 17, total)) {
+            return false;
+          }
+          s += 17 + total;
+        }
+        break;
+      case 0xC0:
+      case 0xC1:  // baseline and extended sequential, 8-bit
+        if (seg < 8 || s[0] != 8) {
+          return false;
+        }
+        d->height = (s[1] << 8) | s[2];
+        d->width = (s[3] << 8) | s[4];
+        d->ncomps = s[5];
+        if (d->ncomps < 1 || d->ncomps > SCAN_MAX_COMPS || seg < 8 + 3 * (size_t)d->ncomps) {
+          return false;
+        }
+        for (int c = 0; c < d->ncomps; c++) {
+          d->comps[c].id = s[6 + 3 * c];
+          d->comps[c].h = s[7 + 3 * c] >> 4;
+          d->comps[c].v = s[7 + 3 * c] & 15;
+          d->comps[c].tq = s[8 + 3 * c] & 3;
+          if (d->comps[c].h < 1 || d->comps[c].h > 2 || d->comps[c].v < 1 || d->comps[c].v > 2) {
+            return false;
+          }
+        }
+        break;
+      case 0xDD:  // DRI
+        if (seg < 4) {
+          return false;
+        }
+        d->dri = (s[0] << 8) | s[1];
+        break;
+      case 0xDA:  // SOS, one interleaved scan of all components
+        if (!d->ncomps || seg < 6 + 2 * (size_t)d->ncomps || s[0] != d->ncomps) {
+          return false;
+        }
+        for (int c = 0; c < d->ncomps; c++) {
+          if (s[1 + 2 * c] != d->comps[c].id) {
+            return false;
+          }
+          d->comps[c].td = (s[2 + 2 * c] >> 4) & 1;
+          d->comps[c].ta = s[2 + 2 * c] & 1;
+          if (!d->dc[d->comps[c].td].valid || !d->ac[d->comps[c].ta].valid) {
+            return false;
+          }
+        }
+        d->scan = end;
+        return d->width && d->height;
+      default:
+        if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+          return false;  // progressive, lossless or arithmetic coding
+        }
+        break;
+    }
+    i += 2 + seg;
+  }
+  return false;
+}
+
+bool scene_stats_from_jpeg(const uint8_t *jpg, size_t len, scene_stats_t *stats) {
+  dc_decoder_t *d = (dc_decoder_t *)calloc(1, sizeof(dc_decoder_t));
+  if (!d) {
+    return false;
+  }
+  if (!parse_headers(d, jpg, len)) {
+    free(d);
+    return false;
+  }
+  // a single component scan has one block per MCU whatever its sampling
+  if (d->ncomps == 1) {
+    d->comps[0].h = d->comps[0].v = 1;
+  }
+  int hmax = 1, vmax = 1;
+  for (int c = 0; c < d->ncomps; c++) {
+    hmax = d->comps[c].h > hmax ? d->comps[c].h : hmax;
+    vmax = d->comps[c].v > vmax ? d->comps[c].v : vmax;
+  }
+  int mcu_cols = (d->width + 8 * hmax - 1) / (8 * hmax);
+  int mcu_rows = (d->height + 8 * vmax - 1) / (8 * vmax);
+  int block_cols = (d->width + 7) / 8;
+  int block_rows = (d->height + 7) / 8;
+  const dc_component_t *luma = &d->comps[0];
+  int luma_quant = d->dc_quant[luma->tq];
+
+  uint32_t sums[SCENE_GRID_ROWS * SCENE_GRID_COLS] = {0};
+  uint32_t counts[SCENE_GRID_ROWS * SCENE_GRID_COLS] = {0};
+  uint32_t hist[SCENE_HIST_BINS] = {0};
+  uint32_t total = 0, blocks = 0, dark = 0, bright = 0;
+  int pred[SCAN_MAX_COMPS] = {0};
+  bit_reader_t r = {d->scan, jpg + len, 0, 0, false};
+  bool ok = true;
+
+  for (int mcu = 0; ok && mcu < mcu_cols * mcu_rows; mcu++) {
+    if (d->dri && mcu && mcu % d->dri == 0) {
+      ok = bits_restart(&r);
+      memset(pred, 0, sizeof(pred));
+    }
+    int mx = mcu % mcu_cols;
+    int my = mcu / mcu_cols;
+    for (int c = 0; ok && c < d->ncomps; c++) {
+      const dc_component_t *comp = &d->comps[c];
+      for (int b = 0; ok && b < comp->h * comp->v; b++) {
+        int s = huff_decode(&r, &d->dc[comp->td]);
+        if (s < 0 || s > 11) {
+          ok = false;
+          break;
+        }
+        if (s) {
+          pred[c] += extend(bits_get(&r, s), s);
+        }
+        // AC coefficients are skipped, only their codes and sizes are read
+        for (int k = 1; k < 64;) {
+          int rs = huff_decode(&r, &d->ac[comp->ta]);
+          if (rs < 0) {
+            ok = false;
+            break;
+          }
+          if (!(rs & 15)) {
+            if (rs != 0xF0) {
+              break;  // end of block
+            }
+            k += 16;
+          } else {
+            k += (rs >> 4) + 1;
+            bits_get(&r, rs & 15);
+          }
+        }
+        if (c) {
+          continue;
+        }
+        int bx = mx * comp->h + b % comp->h;
+        int by = my * comp->v + b / comp->h;
+        if (bx >= block_cols || by >= block_rows) {
+          continue;  // MCU padding past the image edge
+        }
+        int level = pred[0] * luma_quant / 8 + 128;
+        level = level < 0 ? 0 : (level > 255 ? 255 : level);
+        int region = (by * SCENE_GRID_ROWS / block_rows) * SCENE_GRID_COLS + bx * SCENE_GRID_COLS / block_cols;
+        sums[region] += level;
+        counts[region]++;
+        hist[level * SCENE_HIST_BINS / 256]++;
+        total += level;
+        blocks++;
+        dark += level < SCENE_DARK;
+        bright += level >= SCENE_BRIGHT;
+      }
+    }
+  }
+  stats->width = d->width;
+  stats->height = d->height;
+  free(d);
+  if (!ok || !blocks) {
+    return false;
+  }
+  stats->blocks = blocks;
+  stats->mean = total / blocks;
+  for (int i = 0; i < SCENE_GRID_ROWS * SCENE_GRID_COLS; i++) {
+    stats->grid[i] = counts[i] ? sums[i] / counts[i] : 0;
+  }
+  for (int i = 0; i < SCENE_HIST_BINS; i++) {
+    stats->hist[i] = (hist[i] * 100 + blocks / 2) / blocks;
+  }
+  stats->dark = (dark * 100 + blocks / 2) / blocks;
+  stats->bright = (bright * 100 + blocks / 2) / blocks;
+  return true;
+}
+
+#define JSON_APPEND(...)                        \
+  do {                                            \
+    if (p < len) {                                \
+      p += snprintf(buf + p, len - p, __VA_ARGS__); \
+    }                                             \
+  } while (0)
+
+size_t scene_stats_json(const scene_stats_t *stats, char *buf, size_t len) {
+  size_t p = 0;
+  JSON_APPEND(
+    "{\"width\":%u,\"height\":%u,\"mean\":%u,\"dark\":%u,\"bright\":%u,\"aec\":%d,\"agc\":%d,\"grid\":[", stats->width, stats->height, stats->mean, stats->dark,
+    stats->bright, stats->aec, stats->agc
+  );
+  for (int i = 0; i < SCENE_GRID_ROWS * SCENE_GRID_COLS; i++) {
+    JSON_APPEND("%s%u", i ? "," : "", stats->grid[i]);
+  }
+  JSON_APPEND("],\"hist\":[");
+  for (int i = 0; i < SCENE_HIST_BINS; i++) {
+    JSON_APPEND("%s%u", i ? "," : "", stats->hist[i]);
+  }
+  JSON_APPEND("]}");
+  return p < len ? p : len - 1;
+}
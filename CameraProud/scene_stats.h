@@ -0,0 +1,44 @@
+#ifndef SCENE_STATS_H
+#define SCENE_STATS_H
+
+//
+// Scene brightness from the DC coefficients of a JPEG frame.
+//
+// The DC coefficient of an 8x8 luma block is its mean brightness. Reading it
+// takes the Huffman decode of the scan, but no dequantization of the AC
+// coefficients, no IDCT and no color conversion, and needs no image buffer.
+// Every luma block ends up in the region grid and the histogram.
+//
+// The sensor's auto exposure pulls the mean towards mid gray, so a dark scene
+// only shows once exposure and gain run out. The caller adds the exposure
+// from the sensor status, see CameraProud.ino.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCENE_GRID_COLS 4
+#define SCENE_GRID_ROWS 3
+#define SCENE_HIST_BINS 16
+#define SCENE_DARK      32   // blocks below this count as underexposed
+#define SCENE_BRIGHT    224  // blocks from this on count as clipped
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+  uint32_t blocks;                                    // luma blocks read
+  uint8_t mean;                                       // of all blocks, 0-255
+  uint8_t grid[SCENE_GRID_ROWS * SCENE_GRID_COLS];    // mean per region, row by row
+  uint8_t hist[SCENE_HIST_BINS];                      // percent of the blocks per 16 levels
+  uint8_t dark;                                       // percent of the blocks below SCENE_DARK
+  uint8_t bright;                                     // percent of the blocks at or above SCENE_BRIGHT
+  int aec;                                            // exposure and gain, filled in by the caller
+  int agc;
+} scene_stats_t;
+
+// Baseline JPEG only, as the camera sensors produce it.
+bool scene_stats_from_jpeg(const uint8_t *jpg, size_t len, scene_stats_t *stats);
+
+size_t scene_stats_json(const scene_stats_t *stats, char *buf, size_t len);
+
+#endif  // SCENE_STATS_H
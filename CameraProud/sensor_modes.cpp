@@ -0,0 +1,273 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp32-hal-log.h"
+#include "frame_ring.h"
+#include "sensor_modes.h"
+
+#define MODE_SNAPSHOT_GAP_MS  40  // between the two reads that weed out self-changing registers
+#define MODE_OV2640_SETTLE_MS 10  // the driver waits as long after a window change
+
+typedef struct {
+  uint16_t reg;  // as taken by get_reg/set_reg, for the OV2640 with the bank in bit 8
+  uint8_t mask;
+} mode_reg_t;
+
+typedef struct {
+  uint16_t pid;
+  const char *name;
+  framesize_t max_size;
+  const mode_reg_t *regs;
+  int count;
+} mode_table_t;
+
+typedef struct {
+  bool valid;
+  uint8_t values[MODE_MAX_REGS];
+} mode_cache_t;
+
+// What set_window() programs, in the order of the driver's mode tables
+static const mode_reg_t ov2640_regs[] = {
+  // sensor bank: resolution bits of COM7 first (bit 1 is the color bar)
+  {0x112, 0x70}, {0x103, 0xFF}, {0x132, 0xFF}, {0x117, 0xFF}, {0x118, 0xFF}, {0x119, 0xFF}, {0x11A, 0xFF}, {0x14F, 0xFF},
+  {0x150, 0xFF}, {0x15A, 0xFF}, {0x16D, 0xFF}, {0x13D, 0xFF}, {0x139, 0xFF}, {0x135, 0xFF}, {0x122, 0xFF}, {0x137, 0xFF},
+  {0x123, 0xFF}, {0x134, 0xFF}, {0x106, 0xFF}, {0x107, 0xFF}, {0x10D, 0xFF}, {0x10E, 0xFF}, {0x14C, 0xFF}, {0x111, 0xFF},
+  // DSP bank: sizes, offsets, zoom and DVP clock
+  {0x0C0, 0xFF}, {0x0C1, 0xFF}, {0x08C, 0xFF}, {0x051, 0xFF}, {0x052, 0xFF}, {0x053, 0xFF}, {0x054, 0xFF}, {0x055, 0xFF},
+  {0x057, 0xFF}, {0x086, 0xFF}, {0x050, 0xFF}, {0x05A, 0xFF}, {0x05B, 0xFF}, {0x05C, 0xFF}, {0x0D3, 0xFF},
+};
+
+// Window, output size, timing and subsampling (0x3800-0x3815), the binning
+// bits of 0x3820/0x3821 (the others are flip and mirror), scaler enable,
+// JPEG FIFO size, then PLL and PCLK dividers, as set_framesize() orders them
+static const mode_reg_t ov5640_regs[] = {
+  {0x3800, 0xFF}, {0x3801, 0xFF}, {0x3802, 0xFF}, {0x3803, 0xFF}, {0x3804, 0xFF}, {0x3805, 0xFF}, {0x3806, 0xFF}, {0x3807, 0xFF},
+  {0x3808, 0xFF}, {0x3809, 0xFF}, {0x380A, 0xFF}, {0x380B, 0xFF}, {0x380C, 0xFF}, {0x380D, 0xFF}, {0x380E, 0xFF}, {0x380F, 0xFF},
+  {0x3810, 0xFF}, {0x3811, 0xFF}, {0x3812, 0xFF}, {0x3813, 0xFF}, {0x3814, 0xFF}, {0x3815, 0xFF}, {0x3820, 0x01}, {0x3821, 0x01},
+  {0x4514, 0xFF}, {0x4520, 0xFF}, {0x5001, 0x20}, {0x4602, 0xFF}, {0x4603, 0xFF}, {0x4604, 0xFF}, {0x4605, 0xFF}, {0x3034, 0xFF},
+  {0x3035, 0xFF}, {0x3036, 0xFF}, {0x3037, 0xFF}, {0x3039, 0xFF}, {0x3108, 0xFF}, {0x3824, 0xFF}, {0x460C, 0xFF},
+};
+
+// The OV3660 shares the register addresses but not the PLL and timing layout
+// of the OV5640, so it has no table and switches through the driver.
+static const mode_table_t tables[] = {
+  {OV2640_PID, "OV2640", FRAMESIZE_UXGA, ov2640_regs, sizeof(ov2640_regs) / sizeof(mode_reg_t)},
+  {OV5640_PID, "OV5640", FRAMESIZE_QSXGA, ov5640_regs, sizeof(ov5640_regs) / sizeof(mode_reg_t)},
+};
+
+static mode_cache_t cache[FRAMESIZE_INVALID];
+static const mode_table_t *table = NULL;
+static bool current_known = true;  // false after raw writes, the registers no longer match status.framesize
+static framesize_t entered_from = FRAMESIZE_INVALID;
+static framesize_t entered_to = FRAMESIZE_INVALID;
+static bool last_fast = false;
+static sensor_modes_stats_t stats = {"unknown", 0, 0, 0, 0, 0};
+static bool entered_paused = false;
+static SemaphoreHandle_t sensor_mutex = NULL;
+
+void sensor_modes_init() {
+  if (!sensor_mutex) {
+    sensor_mutex = xSemaphoreCreateMutex();
+  }
+  sensor_t *s = esp_camera_sensor_get();
+  for (int i = 0; s && i < (int)(sizeof(tables) / sizeof(tables[0])); i++) {
+    if (tables[i].pid == s->id.PID) {
+      table = &tables[i];
+      stats.sensor = table->name;
+    }
+  }
+}
+
+void sensor_lock() {
+  xSemaphoreTake(sensor_mutex, portMAX_DELAY);
+}
+
+void sensor_unlock() {
+  xSemaphoreGive(sensor_mutex);
+}
+
+static bool read_regs(sensor_t *s, uint8_t *values) {
+  for (int i = 0; i < table->count; i++) {
+    int v = s->get_reg(s, table->regs[i].reg, 0xFF);
+    if (v < 0) {
+      return false;
+    }
+    values[i] = v & table->regs[i].mask;
+  }
+  return true;
+}
+
+// Caches the registers of the current mode, as the driver programmed them.
+static void snapshot(sensor_t *s, framesize_t framesize) {
+  uint8_t first[MODE_MAX_REGS];
+  uint8_t second[MODE_MAX_REGS];
+  if (!read_regs(s, first)) {
+    return;
+  }
+  vTaskDelay(pdMS_TO_TICKS(MODE_SNAPSHOT_GAP_MS));
+  if (!read_regs(s, second)) {
+    return;
+  }
+  if (memcmp(first, second, table->count)) {
+    log_w("Mode: %s registers changed between two reads, %ux%u not cached", table->name, resolution[framesize].width, resolution[framesize].height);
+    return;
+  }
+  memcpy(cache[framesize].values, first, table->count);
+  cache[framesize].valid = true;
+  stats.cached++;
+}
+
+static int write_diff(sensor_t *s, const uint8_t *from, const uint8_t *to) {
+  int written = 0;
+  for (int i = 0; i < table->count; i++) {
+    if (from[i] != to[i]) {
+      if (s->set_reg(s, table->regs[i].reg, table->regs[i].mask, to[i]) < 0) {
+        return -1;
+      }
+      written++;
+    }
+  }
+  return written;
+}
+
+static bool fast_switch(sensor_t *s, framesize_t from, framesize_t to) {
+  bool ov2640 = table->pid == OV2640_PID;
+  if (ov2640) {
+    s->set_reg(s, 0x005, 0xFF, 0x01);  // R_BYPASS: bypass the DSP
+    s->set_reg(s, 0x0E0, 0xFF, 0x04);  // RESET: hold the DVP
+  }
+  int written = write_diff(s, cache[from].values, cache[to].values);
+  if (ov2640) {
+    s->set_reg(s, 0x0E0, 0xFF, 0x00);
+    s->set_reg(s, 0x005, 0xFF, 0x00);
+    vTaskDelay(pdMS_TO_TICKS(MODE_OV2640_SETTLE_MS));
+  }
+  if (written < 0) {
+    log_e("Mode: register write failed");
+    return false;
+  }
+  s->status.framesize = to;
+  // the driver does the same after a size change
+  s->set_quality(s, s->status.quality);
+  stats.last_regs = written;
+  return true;
+}
+
+static bool switch_mode(sensor_t *s, framesize_t to) {
+  framesize_t from = s->status.framesize;
+  if (from == to && current_known) {
+    last_fast = false;
+    return true;
+  }
+  int64_t start = esp_timer_get_time();
+  if (table && current_known && !cache[from].valid) {
+    snapshot(s, from);
+  }
+  if (table && current_known && cache[from].valid && cache[to].valid && fast_switch(s, from, to)) {
+    stats.fast++;
+    last_fast = true;
+    log_i(
+      "Mode: %s %ux%u, %u registers in %ums", table->name, resolution[to].width, resolution[to].height, stats.last_regs,
+      (uint32_t)((esp_timer_get_time() - start) / 1000)
+    );
+    return true;
+  }
+
+  if (s->set_framesize(s, to) != 0) {
+    return false;
+  }
+  stats.slow++;
+  last_fast = false;
+  current_known = true;
+  if (table && !cache[to].valid) {
+    snapshot(s, to);
+  }
+  log_i("Mode: %s %ux%u through the driver in %ums", stats.sensor, resolution[to].width, resolution[to].height, (uint32_t)((esp_timer_get_time() - start) / 1000));
+  return true;
+}
+
+bool sensor_mode_set(framesize_t framesize) {
+  sensor_t *s = esp_camera_sensor_get();
+  sensor_lock();
+  bool ok = (!table || framesize <= table->max_size) && switch_mode(s, framesize);
+  sensor_unlock();
+  return ok;
+}
+
+int64_t sensor_mode_enter(framesize_t framesize) {
+  sensor_t *s = esp_camera_sensor_get();
+  sensor_lock();
+  entered_from = s->status.framesize;
+  entered_to = framesize;
+  entered_paused = frame_ring_pause();
+  if ((table && framesize > table->max_size) || !switch_mode(s, framesize)) {
+    if (entered_paused) {
+      frame_ring_resume();
+    }
+    sensor_unlock();
+    return 0;
+  }
+  return esp_timer_get_time();
+}
+
+static bool jpeg_size(const uint8_t *p, size_t len, uint16_t *width, uint16_t *height) {
+  size_t i = 2;
+  while (i + 9 <= len && p[i] == 0xFF) {
+    uint8_t marker = p[i + 1];
+    if (marker == 0xFF) {
+      i++;
+      continue;
+    }
+    if (marker >= 0xC0 && marker <= 0xC2) {
+      *height = (p[i + 5] << 8) | p[i + 6];
+      *width = (p[i + 7] << 8) | p[i + 8];
+      return true;
+    }
+    if (marker == 0xDA) {
+      break;
+    }
+    i += 2 + ((p[i + 2] << 8) | p[i + 3]);
+  }
+  return false;
+}
+
+bool sensor_mode_check(const uint8_t *jpg, size_t len) {
+  if (!last_fast) {
+    return true;  // set by the driver
+  }
+  uint16_t w = 0, h = 0;
+  if (jpeg_size(jpg, len, &w, &h) && w == resolution[entered_to].width && h == resolution[entered_to].height) {
+    return true;
+  }
+  log_e("Mode: cached %ux%u produced %ux%u, dropped", resolution[entered_to].width, resolution[entered_to].height, w, h);
+  cache[entered_to].valid = false;
+  stats.cached--;
+  stats.fallbacks++;
+  current_known = false;  // leave through the driver
+  return false;
+}
+
+void sensor_mode_leave() {
+  switch_mode(esp_camera_sensor_get(), entered_from);
+  if (entered_paused) {
+    // frames still exposed in the entered size are not pushed
+    frame_ring_resume(esp_timer_get_time());
+  }
+  sensor_unlock();
+}
+
+void sensor_modes_invalidate() {
+  sensor_lock();
+  for (int i = 0; i < FRAMESIZE_INVALID; i++) {
+    cache[i].valid = false;
+  }
+  stats.cached = 0;
+  current_known = false;
+  sensor_unlock();
+}
+
+void sensor_modes_stats(sensor_modes_stats_t *out) {
+  *out = stats;
+}
@@ -0,0 +1,67 @@
+#ifndef SENSOR_MODES_H
+#define SENSOR_MODES_H
+
+//
+// Cached sensor register sets for fast frame size switching.
+//
+// set_framesize() reprograms the whole mode table of the sensor (OV2640: about
+// 40 SCCB writes plus a 10 ms settle; OV3660/OV5640: window, scaler and PLL)
+// even when most registers already hold the right value. The first switch to
+// a frame size still goes through the driver. Afterwards the registers it
+// programmed are read back and cached, and later switches only write the
+// registers that differ from the current mode.
+//
+// Only the OV2640 and OV5640 register lists are known. The OV3660 and other
+// sensors always switch through the driver.
+//
+// Only frames that start after the last write are used, so the switch drops
+// no more frames than it has to. A cached set is checked against the JPEG size
+// of the first frame. A set that produced the wrong size is dropped, and the
+// next switch goes through the driver again.
+//
+// Raw register, PLL or window writes (/reg, /pll, /resolution) drop the cache.
+//
+
+#include "esp_camera.h"
+
+#define MODE_MAX_REGS 48
+
+typedef struct {
+  const char *sensor;
+  int cached;          // frame sizes with a cached register set
+  uint32_t fast;       // switches from the cache
+  uint32_t slow;       // switches through set_framesize()
+  uint32_t fallbacks;  // cached sets dropped after a size mismatch
+  uint32_t last_regs;  // registers written by the last fast switch
+} sensor_modes_stats_t;
+
+// Picks the register list for the attached sensor.
+void sensor_modes_init();
+
+// Switches the frame size for good, e.g. from /control?var=framesize.
+bool sensor_mode_set(framesize_t framesize);
+
+// Switches to `framesize` for a snapshot and holds the sensor until
+// sensor_mode_leave(). The frame ring's capture task is paused meanwhile, so
+// the caller takes the snapshot from the driver and the recorder, RTSP and
+// /stream never see the other size. Returns the esp_timer time from which
+// frames are exposed in the new mode, or 0 on failure, when nothing needs to
+// be left.
+int64_t sensor_mode_enter(framesize_t framesize);
+
+// Checks the snapshot taken in the entered mode, see above.
+bool sensor_mode_check(const uint8_t *jpg, size_t len);
+
+// Switches back to the frame size before sensor_mode_enter().
+void sensor_mode_leave();
+
+void sensor_modes_invalidate();
+
+// Held by whatever reprograms the sensor for a moment and takes frames from
+// the driver itself: mode switches here and roi_capture().
+void sensor_lock();
+void sensor_unlock();
+
+void sensor_modes_stats(sensor_modes_stats_t *stats);
+
+#endif  // SENSOR_MODES_H
@@ -0,0 +1,187 @@
+#include <WiFi.h>
+#include "uploader.h"
+
+#define UPLOAD_BOUNDARY "----CameraProudUpload"
+#define UPLOAD_TIMEOUT  5000
+#define UPLOAD_CHUNK    4096
+#define UPLOAD_LINE_MAX 160
+
+static const char *_UPLOAD_HEAD = "--" UPLOAD_BOUNDARY "\r\n"
+                                  "Content-Disposition: form-data; name=\"imageFile\"; filename=\"capture.jpg\"\r\n"
+                                  "Content-Type: image/jpeg\r\n\r\n";
+static const char *_UPLOAD_TAIL = "\r\n--" UPLOAD_BOUNDARY "--\r\n";
+
+int upload_jpeg(const char *host, uint16_t port, const char *path, const uint8_t *jpg, size_t len) {
+  WiFiClient client;
+  client.setTimeout(UPLOAD_TIMEOUT / 1000);
+  if (!client.connect(host, port)) {
+    return -1;
+  }
+
+  size_t body_len = strlen(_UPLOAD_HEAD) + len + strlen(_UPLOAD_TAIL);
+  client.printf(
+    "POST %s HTTP/1.1\r\nHost: %s:%u\r\nContent-Type: multipart/form-data; boundary=" UPLOAD_BOUNDARY "\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", path,
+    host, port, (unsigned)body_len
+  );
+  client.print(_UPLOAD_HEAD);
+  // WiFiClient splits large writes itself, but keep chunks small so a stalled
+  // socket is noticed quickly
+  for (size_t sent = 0; sent < len;) {
+    size_t n = client.write(jpg + sent, len - sent > UPLOAD_CHUNK ? UPLOAD_CHUNK : len - sent);
+    if (!n) {
+      client.stop();
+      return -1;
+    }
+    sent += n;
+  }
+  client.print(_UPLOAD_TAIL);
+
+  // "HTTP/1.1 200 OK"
+  unsigned long start = millis();
+  while (!client.available() && client.connected() && millis() - start < UPLOAD_TIMEOUT) {
+    delay(5);
+  }
+  char line[32];
+  size_t n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+  line[n] = 0;
+  client.stop();
+  int status = -1;
+  if (sscanf(line, "HTTP/%*s %d", &status) != 1) {
+    return -1;
+  }
+  return status;
+}
+
+static WiFiClient _raw_client;
+static bool _raw_pending = false;  // a response is still to be read
+static char _server_timing[UPLOAD_LINE_MAX];
+
+// One header line without its CRLF, truncated to size - 1. Returns its
+// length, or -1 on timeout or a closed connection.
+static int _read_line(WiFiClient &client, char *line, size_t size) {
+  size_t n = 0;
+  unsigned long start = millis();
+  while (millis() - start < UPLOAD_TIMEOUT) {
+    int c = client.read();
+    if (c < 0) {
+      if (!client.connected()) {
+        break;
+      }
+      delay(1);
+      continue;
+    }
+    if (c == '\n') {
+      while (n && line[n - 1] == '\r') {
+        n--;
+      }
+      line[n] = 0;
+      return n;
+    }
+    if (n < size - 1) {
+      line[n++] = c;
+    }
+  }
+  return -1;
+}
+
+// Reads a whole response so the next one starts at a status line. Returns
+// the status, or -1 if there was none; *keep is cleared when the connection
+// cannot carry another response.
+static int _read_response(WiFiClient &client, bool *keep) {
+  char line[UPLOAD_LINE_MAX];
+  int status = -1;
+  if (_read_line(client, line, sizeof(line)) < 0 || sscanf(line, "HTTP/%*s %d", &status) != 1) {
+    *keep = false;
+    return -1;
+  }
+  long body = -1;
+  *keep = true;
+  _server_timing[0] = 0;
+  int n;
+  while ((n = _read_line(client, line, sizeof(line))) > 0) {
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      body = atol(line + 15);
+    } else if (!strncasecmp(line, "Server-Timing:", 14)) {
+      const char *v = line + 14;
+      while (*v == ' ') {
+        v++;
+      }
+      strlcpy(_server_timing, v, sizeof(_server_timing));
+    } else if (!strncasecmp(line, "Connection:", 11) && strcasestr(line + 11, "close")) {
+      *keep = false;
+    }
+  }
+  // without a length the body runs to the end of the connection
+  if (n < 0 || body < 0) {
+    *keep = false;
+    return n < 0 ? -1 : status;
+  }
+  unsigned long start = millis();
+  while (body > 0 && millis() - start < UPLOAD_TIMEOUT) {
+    char skip[64];
+    int got = client.read((uint8_t *)skip, body > (long)sizeof(skip) ? sizeof(skip) : body);
+    if (got > 0) {
+      body -= got;
+    } else if (!client.connected()) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  if (body) {
+    *keep = false;
+  }
+  return status;
+}
+
+int upload_jpeg_raw(const char *host, uint16_t port, const char *path, const char *camera, const uint8_t *jpg, size_t len) {
+  int status = 0;
+  bool keep = true;
+  // an answer that has already arrived is read before anything is sent: if
+  // the server closed the idle connection since, writing to it would reset
+  // the connection and drop the answer
+  if (_raw_pending && _raw_client.available()) {
+    status = _read_response(_raw_client, &keep);
+    _raw_pending = false;
+  }
+  if (!keep || !_raw_client.connected()) {
+    _raw_client.stop();
+    _raw_pending = false;
+    _raw_client.setTimeout(UPLOAD_TIMEOUT / 1000);
+    if (!_raw_client.connect(host, port)) {
+      return -1;
+    }
+    _raw_client.setNoDelay(true);
+  }
+
+  _raw_client.printf(
+    "POST %s HTTP/1.1\r\nHost: %s:%u\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Camera-Id: %s\r\n\r\n", path, host, port,
+    (unsigned)len, camera
+  );
+  for (size_t sent = 0; sent < len;) {
+    size_t n = _raw_client.write(jpg + sent, len - sent > UPLOAD_CHUNK ? UPLOAD_CHUNK : len - sent);
+    if (!n) {
+      _raw_client.stop();
+      _raw_pending = false;
+      return -1;
+    }
+    sent += n;
+  }
+
+  // this upload is now in flight, collect the answer to the one before it
+  if (_raw_pending) {
+    status = _read_response(_raw_client, &keep);
+  }
+  if (!keep) {
+    // this upload may never be answered, reconnect on the next call
+    _raw_client.stop();
+    _raw_pending = false;
+    return status;
+  }
+  _raw_pending = true;
+  return status;
+}
+
+const char *upload_server_timing() {
+  return _server_timing;
+}
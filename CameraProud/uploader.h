@@ -0,0 +1,26 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// POSTs a JPEG to the AI server as multipart/form-data with the "imageFile"
+// field that upload_file() in AI/ai_server.py expects. The frame is written
+// straight from the frame buffer, no multipart body is assembled in RAM.
+// Returns the HTTP status code, or -1 if the server could not be reached.
+int upload_jpeg(const char *host, uint16_t port, const char *path, const uint8_t *jpg, size_t len);
+
+// POSTs a JPEG as a plain image/jpeg body to upload_raw() in AI/ai_server.py,
+// tagged with X-Camera-Id. The connection is kept open between calls, and the
+// response to an upload is only read after the next one has been sent, so the
+// camera never idles waiting for the server (HTTP/1.1 pipelining, one request
+// in flight). Returns the HTTP status of the previous upload, 0 if none was
+// outstanding, or -1 if the connection failed; a failed connection is opened
+// again on the next call.
+int upload_jpeg_raw(const char *host, uint16_t port, const char *path, const char *camera, const uint8_t *jpg, size_t len);
+
+// Server-Timing header of the last response upload_jpeg_raw() read, "" if it
+// had none.
+const char *upload_server_timing();
+
+#endif  // UPLOADER_H
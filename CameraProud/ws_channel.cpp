@@ -0,0 +1,235 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "esp32-hal-log.h"
+#include "board_config.h"
+#include "frame_ring.h"
+#include "avi_recorder.h"
+#include "analytics_frame.h"
+#include "ws_channel.h"
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+
+#if defined(LED_GPIO_NUM)
+extern int led_duty;
+#endif
+
+typedef struct {
+  size_t len;
+  char *data;
+} ws_msg_t;
+
+static httpd_handle_t server = NULL;
+static TaskHandle_t push_task_handle = NULL;
+
+// only touched from the httpd task (handshakes and queued sends)
+static int clients[WS_MAX_CLIENTS];
+static volatile int client_count = 0;
+
+// each counter has a single writer, the difference is the queue depth
+static volatile uint32_t queued = 0;
+static volatile uint32_t sent = 0;
+
+static volatile bool full_status = true;
+
+static const char *status_keys[] = {
+  "framesize",  "quality", "brightness", "contrast", "saturation", "sharpness", "special_effect", "wb_mode", "awb",     "awb_gain",
+  "aec",        "aec2",    "ae_level",   "aec_value", "agc",       "agc_gain",  "gainceiling",    "bpc",     "wpc",     "raw_gma",
+  "lenc",       "hmirror", "vflip",      "dcw",       "colorbar",  "led_intensity", "rec",
+};
+#define STATUS_FIELDS (sizeof(status_keys) / sizeof(status_keys[0]))
+
+static int status_prev[STATUS_FIELDS];
+
+// same order as status_keys
+static void status_read(int *v) {
+  sensor_t *s = esp_camera_sensor_get();
+  int i = 0;
+  v[i++] = s->status.framesize;
+  v[i++] = s->status.quality;
+  v[i++] = s->status.brightness;
+  v[i++] = s->status.contrast;
+  v[i++] = s->status.saturation;
+  v[i++] = s->status.sharpness;
+  v[i++] = s->status.special_effect;
+  v[i++] = s->status.wb_mode;
+  v[i++] = s->status.awb;
+  v[i++] = s->status.awb_gain;
+  v[i++] = s->status.aec;
+  v[i++] = s->status.aec2;
+  v[i++] = s->status.ae_level;
+  v[i++] = s->status.aec_value;
+  v[i++] = s->status.agc;
+  v[i++] = s->status.agc_gain;
+  v[i++] = s->status.gainceiling;
+  v[i++] = s->status.bpc;
+  v[i++] = s->status.wpc;
+  v[i++] = s->status.raw_gma;
+  v[i++] = s->status.lenc;
+  v[i++] = s->status.hmirror;
+  v[i++] = s->status.vflip;
+  v[i++] = s->status.dcw;
+  v[i++] = s->status.colorbar;
+#if defined(LED_GPIO_NUM)
+  v[i++] = led_duty;
+#else
+  v[i++] = -1;
+#endif
+  recorder_stats_t rec;
+  recorder_stats(&rec);
+  v[i++] = rec.recording;
+}
+
+static void ws_send_work(void *arg) {
+  ws_msg_t *msg = (ws_msg_t *)arg;
+  httpd_ws_frame_t pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  pkt.final = true;
+  pkt.type = HTTPD_WS_TYPE_TEXT;
+  pkt.payload = (uint8_t *)msg->data;
+  pkt.len = msg->len;
+
+  int i = 0;
+  while (i < client_count) {
+    int fd = clients[i];
+    if (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET || httpd_ws_send_frame_async(server, fd, &pkt) != ESP_OK) {
+      log_i("WS client %d gone", fd);
+      clients[i] = clients[client_count - 1];
+      client_count = client_count - 1;
+      continue;
+    }
+    i++;
+  }
+  free(msg);
+  sent = sent + 1;
+}
+
+static bool ws_queue(const char *data, size_t len) {
+  // one allocation for the header and the text
+  ws_msg_t *msg = (ws_msg_t *)malloc(sizeof(ws_msg_t) + len);
+  if (!msg) {
+    return false;
+  }
+  msg->data = (char *)(msg + 1);
+  msg->len = len;
+  memcpy(msg->data, data, len);
+  if (httpd_queue_work(server, ws_send_work, msg) != ESP_OK) {
+    free(msg);
+    return false;
+  }
+  queued = queued + 1;
+  return true;
+}
+
+static void push_status() {
+  static char json[640];
+  int values[STATUS_FIELDS];
+  status_read(values);
+
+  bool full = full_status;
+  full_status = false;
+  char *p = json;
+  p += sprintf(p, "{\"type\":\"status\"");
+  int changed = 0;
+  for (size_t i = 0; i < STATUS_FIELDS; i++) {
+    if (full || values[i] != status_prev[i]) {
+      p += sprintf(p, ",\"%s\":%d", status_keys[i], values[i]);
+      changed++;
+    }
+    status_prev[i] = values[i];
+  }
+  *p++ = '}';
+  *p = 0;
+  if (changed) {
+    ws_queue(json, p - json);
+  }
+}
+
+static void push_task(void *arg) {
+  uint32_t last_seq = 0;
+  int64_t last_status = 0;
+  char json[160];
+
+  while (true) {
+    bool changed;
+    if (client_count && frame_ring_enabled()) {
+      ring_frame_t frame;
+      if (frame_ring_latest(last_seq, &frame, pdMS_TO_TICKS(100))) {
+        last_seq = frame.seq;
+        if (queued - sent < WS_MAX_PENDING) {
+          int motion = analytics_motion();
+          int len = snprintf(
+            json, sizeof(json), "{\"type\":\"frame\",\"seq\":%u,\"ts\":%lld,\"len\":%u,\"w\":%u,\"h\":%u,\"motion\":%d}", frame.seq, frame.timestamp, frame.len,
+            frame.width, frame.height, motion
+          );
+          frame_ring_release(&frame);
+          ws_queue(json, len);
+        } else {
+          frame_ring_release(&frame);
+        }
+      }
+      changed = ulTaskNotifyTake(pdTRUE, 0) > 0;
+    } else {
+      changed = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WS_STATUS_INTERVAL_MS)) > 0;
+    }
+    if (!client_count) {
+      continue;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (changed || full_status || now - last_status >= (int64_t)WS_STATUS_INTERVAL_MS * 1000) {
+      push_status();
+      last_status = now;
+    }
+  }
+}
+
+bool ws_channel_start(httpd_handle_t handle) {
+  if (push_task_handle) {
+    return true;
+  }
+  server = handle;
+  return xTaskCreatePinnedToCore(push_task, "ws_push", 6144, NULL, 4, &push_task_handle, tskNO_AFFINITY) == pdPASS;
+}
+
+bool ws_channel_add(int fd) {
+  for (int i = 0; i < client_count; i++) {
+    if (clients[i] == fd) {
+      return true;
+    }
+  }
+  if (client_count >= WS_MAX_CLIENTS) {
+    log_e("WS: too many clients");
+    return false;
+  }
+  clients[client_count] = fd;
+  client_count = client_count + 1;
+  full_status = true;
+  ws_channel_status_changed();
+  log_i("WS client %d connected", fd);
+  return true;
+}
+
+void ws_channel_status_changed() {
+  if (push_task_handle) {
+    xTaskNotifyGive(push_task_handle);
+  }
+}
+
+#else  // CONFIG_HTTPD_WS_SUPPORT
+
+// httpd built without WebSocket support: no /ws endpoint, nothing to push
+
+bool ws_channel_start(httpd_handle_t handle) {
+  return false;
+}
+
+bool ws_channel_add(int fd) {
+  return false;
+}
+
+void ws_channel_status_changed() {}
+
+#endif  // CONFIG_HTTPD_WS_SUPPORT
@@ -0,0 +1,40 @@
+#ifndef WS_CHANNEL_H
+#define WS_CHANNEL_H
+
+//
+// Push side of the /ws WebSocket endpoint.
+//
+// One task follows the frame ring and queues a JSON message per frame (size,
+// timestamp, motion score) plus a status message holding only the sensor
+// fields that changed since the last one. Messages are sent from the httpd
+// task through httpd_queue_work(), so a slow socket never blocks capture; when
+// too many sends are pending, frame messages are skipped instead of queued.
+//
+// {"type":"frame","seq":12,"ts":1234567,"len":23456,"w":640,"h":480,"motion":3}
+// {"type":"status","framesize":8,"quality":12}
+//
+// `motion` is the score of the newest analytics frame (see analytics_frame.h),
+// -1 until there are two.
+//
+// Needs CONFIG_HTTPD_WS_SUPPORT. Without it the functions below do nothing and
+// ws_channel_start() returns false.
+//
+
+#include "esp_http_server.h"
+
+#define WS_MAX_CLIENTS        2  // part of HTTPD_CONTROL_SOCKETS
+#define WS_MAX_PENDING        4
+#define WS_STATUS_INTERVAL_MS 500
+
+// Starts the push task for clients of `server`.
+bool ws_channel_start(httpd_handle_t server);
+
+// Called from the handshake of the /ws handler. The next status message after
+// a new client joins carries every field, not just the changed ones.
+bool ws_channel_add(int fd);
+
+// Pushes the status delta now instead of at the next interval, e.g. after a
+// control message changed a setting.
+void ws_channel_status_changed();
+
+#endif  // WS_CHANNEL_H
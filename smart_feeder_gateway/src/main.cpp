@@ -15,6 +15,15 @@
 #define AIR_BAD         3500 //ค่าที่มี อากาศแย่มาก/อันตราย
 #define LIGHT_TOO_MUCH  500 //ค่าที่ถือว่า สว่างเกินไป
 #define STILL_TIMEOUT   300000
+#define LIGHT_DARK      300 //ค่า LDR ที่ถือว่ามืด (เริ่มให้อาหาร)
+
+// ค่าความสว่างจากกล้อง (@msg/camera/scene) ใช้ช่วย LDR เมื่อยังได้รับอยู่
+// LDR ยังเป็นตัวตัดสินหลักว่ามืด กล้องนับว่ามืดเพิ่มเติมได้เฉพาะเมื่อ
+// ค่าเฉลี่ยต่ำ และ exposure (aec) ขึ้นไปใกล้ค่าสูงสุดที่เคยเห็นแล้ว
+#define CAMERA_DARK_MEAN     40     //ค่าเฉลี่ยความสว่างของภาพ (0-255) ที่ถือว่ามืด
+#define CAMERA_AEC_FULL_PCT  90     //aec ถึง % นี้ของค่าสูงสุดที่เคยเห็น ถือว่า exposure สุดแล้ว
+#define CAMERA_BRIGHT_PCT    30     //% ของภาพที่สว่างจนขาว ถือว่าสว่างเกินไป
+#define CAMERA_SCENE_TIMEOUT 60000  //ไม่ได้ค่าจากกล้องนานเกินนี้ กลับไปใช้ LDR
 
 // ===================== OBJECT ======================
 WiFiClient client;
@@ -47,6 +56,14 @@ float ultrasonic_d = 0;
 float weightVal = 0;
 int motionFlag = 0;
 
+// ค่าที่กล้องส่งมา
+int cameraMean = -1;
+int cameraAec = -1;
+int cameraAecMax = 0;          // aec สูงสุดที่เคยเห็น หน่วยขึ้นกับรุ่นเซนเซอร์
+int cameraBright = 0;
+int cameraBrightRegion = -1;   // ช่องที่สว่างที่สุดใน grid 4x3 นับจากซ้ายบน
+unsigned long lastSceneTime = 0;
+
 // ===================== MQTT CALLBACK ======================
 void callback(char* topic, byte* payload, unsigned int length) {
     String payloadStr = "";
@@ -66,6 +83,22 @@ void callback(char* topic, byte* payload, unsigned int length) {
     else if (t.equals("@msg/sensor_node/weight")){
         weightVal = payloadStr.toFloat();
     }
+    else if (t.equals("@msg/camera/scene")){
+        StaticJsonDocument<512> doc;
+        if (!deserializeJson(doc, payload, length)) {
+            cameraMean = doc["mean"] | -1;
+            cameraBright = doc["bright"] | 0;
+            cameraAec = doc["aec"] | -1;
+            if (cameraAec > cameraAecMax) cameraAecMax = cameraAec;
+            JsonArray grid = doc["grid"];
+            int brightest = -1;
+            for (int i = 0; i < (int)grid.size(); i++) {
+                if (brightest < 0 || grid[i].as<int>() > grid[brightest].as<int>()) brightest = i;
+            }
+            cameraBrightRegion = brightest;
+            lastSceneTime = millis();
+        }
+    }
     // if (String(topic) == "@msg/sensor_node/ultrasonic"){
     //     ultrasonic_d = payloadStr.toFloat();
     // } else if (String(topic) == "@msg/sensor_node/weight") {
@@ -92,6 +125,7 @@ void sendToFirebase() {
     doc["weight"] = weightVal;
     doc["air"] = airQuality;
     doc["light"] = lightValue;
+    doc["camera_light"] = cameraMean;
     doc["motion"] = motionFlag;
     doc["timestamp"] = millis();
 
@@ -151,6 +185,7 @@ void reconnectMQTT() {
             mqtt.subscribe("@msg/sensor_node/ultrasonic");  // ★ แก้
             mqtt.subscribe("@msg/sensor_node/weight");      // ★ แก้
             mqtt.subscribe("@msg/alias/motion");
+            mqtt.subscribe("@msg/camera/scene");
         } else {
             Serial.println("Retry NETPIE…");
             delay(2000);
@@ -230,14 +265,37 @@ const float FOOD_START_THRESHOLD = 20; // ถ้า < 20g ให้เริ่
 //         }
 //     }
 // }
+// ===================== LIGHT ======================
+bool cameraSceneFresh() {
+    return lastSceneTime != 0 && millis() - lastSceneTime < CAMERA_SCENE_TIMEOUT;
+}
+
+// กล้องมืดจริง: ภาพมืด และ exposure ใกล้สุดแล้ว (ภาพมืดเพราะเพิ่งเปลี่ยนฉาก ไม่นับ)
+bool cameraDark() {
+    if (!cameraSceneFresh() || cameraMean < 0 || cameraMean >= CAMERA_DARK_MEAN) return false;
+    return cameraAec >= 0 && cameraAec * 100 >= cameraAecMax * CAMERA_AEC_FULL_PCT;
+}
+
+bool isDark() {
+    return lightValue < LIGHT_DARK || cameraDark();
+}
+
+bool cameraTooBright() {
+    return cameraSceneFresh() && cameraBright > CAMERA_BRIGHT_PCT;
+}
+
+bool isTooBright() {
+    return lightValue > LIGHT_TOO_MUCH || cameraTooBright();
+}
+
 bool lightFeeding = false;
 unsigned long lightFeedStart = 0;
 bool lightTrigger = false;   // ทำงานครั้งเดียวต่อรอบแสง
 
 void lightFeeder() {
 
-    // ❶ แสงลดต่ำกว่า 300 ครั้งแรก → ให้เริ่มหมุน
-    if (lightValue < 300 && !lightTrigger && !lightFeeding) {
+    // ❶ มืดครั้งแรก (LDR < 300 หรือกล้องมืดจน exposure สุด) → ให้เริ่มหมุน
+    if (isDark() && !lightTrigger && !lightFeeding) {
         fed = true; 
         mqtt.publish("@msg/gateway/fed", "1");
         lightTrigger = true;          // ล็อกไม่ให้ทำซ้ำ
@@ -258,8 +316,8 @@ void lightFeeder() {
         Serial.println("Light condition: Servo CLOSE");
     }
 
-    // ❸ ถ้าแสงกลับมามากกว่า 300 → reset trigger เพื่อให้ทำงานรอบใหม่ได้
-    if (lightValue >= 300) {
+    // ❸ ถ้าแสงกลับมา → reset trigger เพื่อให้ทำงานรอบใหม่ได้
+    if (!isDark()) {
         lightTrigger = false;
     }
 }
@@ -274,6 +332,7 @@ void setup() {
 
     mqtt.setServer(MQTT_SERVER, MQTT_PORT);
     mqtt.setCallback(callback);
+    mqtt.setBufferSize(512);   // @msg/camera/scene ยาวเกิน 256 ที่เป็นค่าเริ่มต้น
 
     feederServo.attach(SERVO_PIN);
     feederServo.write(0);
@@ -285,6 +344,7 @@ void setup() {
         mqtt.subscribe("@msg/sensor_node/ultrasonic");  // ★ แก้
         mqtt.subscribe("@msg/sensor_node/weight");      // ★ แก้
         mqtt.subscribe("@msg/alias/motion");
+        mqtt.subscribe("@msg/camera/scene");
 
         // mqtt.publish("@msg/gateway/fed", String(fed).c_str());
     }
@@ -318,8 +378,12 @@ void loop() {
     }
 
     // ======= แจ้งเตือนแสง =========
-    if (lightValue > LIGHT_TOO_MUCH && now - lastLightNotify > 60000) {
-        sendDiscord("💡 บ้านแฮมสเตอร์สว่างเกินไป (" + String(lightValue) + ")");
+    if (isTooBright() && now - lastLightNotify > 60000) {
+        if (cameraTooBright()) {
+            sendDiscord("💡 บ้านแฮมสเตอร์สว่างเกินไป (กล้อง " + String(cameraBright) + "% ของภาพ, ช่อง " + String(cameraBrightRegion) + ")");
+        } else {
+            sendDiscord("💡 บ้านแฮมสเตอร์สว่างเกินไป (" + String(lightValue) + ")");
+        }
         lastLightNotify = now;
     }
     // ======= แจ้งเตือนว่าหนูอยู่นิ่งนานเกินไป=====================================